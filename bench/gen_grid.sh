@@ -0,0 +1,44 @@
+#!/bin/sh
+# Synthetic map generator.
+#
+# usage: bench/gen_grid.sh ROWS COLS > grid.txt
+#
+# Writes a Simple Street Map of a ROWS x COLS street grid, about 100 m
+# between intersections. Every row and every column is one way. Speed
+# limits vary between 30 and 80 km/hr, and every third street is one-way,
+# alternating in direction. The output is fully determined by ROWS and COLS.
+
+ROWS=${1:?usage: $0 ROWS COLS}
+COLS=${2:?usage: $0 ROWS COLS}
+
+awk -v R="$ROWS" -v C="$COLS" 'BEGIN {
+    srand(7);
+    printf "Simple Street Map\n%d ways\n%d nodes\n", R + C, R * C;
+
+    # ways 0 .. R-1 run along rows, ways R .. R+C-1 along columns
+    for (w = 0; w < R + C; w++) {
+        row = w < R;
+        i = row ? w : w - R;
+        n = row ? C : R;
+        oneway = (i % 3 == 2);
+        reverse = oneway && (i % 2 == 1);
+        printf "way %d %d %s %d\n", w, 1000000 + w, row ? "Row Street" : "Column Avenue", i;
+        printf " %.1f %s %d\n", 30 + 10 * int(rand() * 6), oneway ? "oneway" : "normal", n;
+        line = "";
+        for (k = 0; k < n; k++) {
+            j = reverse ? n - 1 - k : k;
+            id = row ? i * C + j : j * C + i;
+            line = line " " id;
+        }
+        print line;
+    }
+
+    for (r = 0; r < R; r++) {
+        for (c = 0; c < C; c++) {
+            id = r * C + c;
+            printf "node %d %d %.7f %.7f 2\n %d %d\n", id, 2000000 + id,
+                   45.0 + r * 0.0009 + (rand() - 0.5) * 0.0002,
+                   -79.0 + c * 0.00127 + (rand() - 0.5) * 0.0002, r, R + c;
+        }
+    }
+}'
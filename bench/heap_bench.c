@@ -0,0 +1,186 @@
+/*
+ * Priority queue microbenchmark.
+ *
+ * usage: heap_bench [NODES] [DEGREE] [ROUNDS]
+ *
+ * Runs Dijkstra's search over a random implicit graph of NODES nodes, each
+ * with DEGREE out-edges of random weight, using first the min_heap and then
+ * the radix_heap from heap.c. Nothing but the queue is timed: the graph is
+ * generated up front, so the figures show the cost per queue operation.
+ * Build with -DMIN_HEAP_ARITY=N to compare arities (see `make heap-bench`).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include "../heap.h"
+
+struct graph {
+    int nodes;
+    int degree;
+    int *targets; // DEGREE targets per node.
+    double *weights; // Weight of each edge in 'targets'.
+};
+
+struct result {
+    long ops; // Inserts, decrease-keys and extracts performed.
+    double checksum; // Sum of the settled distances, to compare the queues.
+    double seconds;
+};
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned long long next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double elapsed(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static void make_graph(struct graph *g, int nodes, int degree) {
+    g->nodes = nodes;
+    g->degree = degree;
+    g->targets = malloc(sizeof(int) * nodes * degree);
+    g->weights = malloc(sizeof(double) * nodes * degree);
+    for (long i = 0; i < (long)nodes * degree; i++) {
+        g->targets[i] = next_random() % nodes;
+        g->weights[i] = (next_random() % 100000) / 1000.0 + 0.001;
+    }
+}
+
+static struct result run_min_heap(const struct graph *g, min_heap *heap, double *dist, bool *settled) {
+    struct result r = {0, 0, 0};
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+
+    for (int i = 0; i < g->nodes; i++) {
+        dist[i] = INFINITY;
+        settled[i] = false;
+    }
+    dist[0] = 0;
+    insert_min_heap(heap, 0, 0);
+    r.ops++;
+
+    while (heap->size > 0) {
+        heap_node top = extract_min(heap);
+        r.ops++;
+        settled[top.node_id] = true;
+        r.checksum += top.distance;
+
+        for (int e = top.node_id * g->degree; e < (top.node_id + 1) * g->degree; e++) {
+            int v = g->targets[e];
+            double d = top.distance + g->weights[e];
+            if (settled[v] || d >= dist[v]) {
+                continue;
+            }
+            if (is_in_min_heap(heap, v)) {
+                decrease_key(heap, v, d);
+            } else {
+                insert_min_heap(heap, v, d);
+            }
+            dist[v] = d;
+            r.ops++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    r.seconds = elapsed(a, b);
+    return r;
+}
+
+static struct result run_radix_heap(const struct graph *g, radix_heap *heap, double *dist, bool *settled) {
+    struct result r = {0, 0, 0};
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+
+    for (int i = 0; i < g->nodes; i++) {
+        dist[i] = INFINITY;
+        settled[i] = false;
+    }
+    dist[0] = 0;
+    radix_heap_push(heap, 0, 0);
+    r.ops++;
+
+    while (heap->size > 0) {
+        int u = radix_heap_extract_min(heap);
+        r.ops++;
+        if (u < 0) {
+            break;
+        }
+        settled[u] = true;
+        r.checksum += dist[u];
+
+        for (int e = u * g->degree; e < (u + 1) * g->degree; e++) {
+            int v = g->targets[e];
+            double d = dist[u] + g->weights[e];
+            if (settled[v] || d >= dist[v]) {
+                continue;
+            }
+            radix_heap_push(heap, v, d);
+            dist[v] = d;
+            r.ops++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    r.seconds = elapsed(a, b);
+    return r;
+}
+
+static void report(const char *name, struct result best) {
+    printf("%-12s %10ld ops  %7.1f ns/op  checksum %.3f\n",
+           name, best.ops, best.seconds * 1e9 / best.ops, best.checksum);
+}
+
+int main(int argc, char **argv) {
+    int nodes = argc > 1 ? atoi(argv[1]) : 1000000;
+    int degree = argc > 2 ? atoi(argv[2]) : 3;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (nodes <= 0 || degree <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [NODES] [DEGREE] [ROUNDS]\n", argv[0]);
+        return 1;
+    }
+
+    struct graph g;
+    make_graph(&g, nodes, degree);
+    double *dist = malloc(sizeof(double) * nodes);
+    bool *settled = malloc(sizeof(bool) * nodes);
+    min_heap *binary = create_min_heap(nodes);
+    radix_heap *radix = create_radix_heap(nodes);
+    if (g.targets == NULL || g.weights == NULL || dist == NULL || settled == NULL ||
+        binary == NULL || radix == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    struct result best_binary = {0, 0, INFINITY}, best_radix = {0, 0, INFINITY};
+    for (int round = 0; round < rounds; round++) {
+        struct result r = run_min_heap(&g, binary, dist, settled);
+        if (r.seconds < best_binary.seconds) {
+            best_binary = r;
+        }
+        clear_radix_heap(radix);
+        r = run_radix_heap(&g, radix, dist, settled);
+        if (r.seconds < best_radix.seconds) {
+            best_radix = r;
+        }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%d-ary heap", MIN_HEAP_ARITY);
+    report(name, best_binary);
+    report("radix heap", best_radix);
+
+    free_min_heap(binary);
+    free_radix_heap(radix);
+    free(dist);
+    free(settled);
+    free(g.targets);
+    free(g.weights);
+    return 0;
+}
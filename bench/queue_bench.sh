@@ -0,0 +1,24 @@
+#!/bin/sh
+# Priority queue comparison.
+#
+# usage: bench/queue_bench.sh [QUERIES] [MAP...]
+#
+# Runs bench/route_bench.sh for every MAP with each priority queue
+# (--queue binary and --queue radix) and each search mode that uses one.
+# MAPs default to the bundled maps; synthetic grids from bench/gen_grid.sh
+# are good for larger inputs.
+
+QUERIES=${1:-2000}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] || set -- huntsville.txt uoft.txt
+
+dir=$(dirname "$0")
+
+for map in "$@"; do
+    for mode in "" --astar --bidir; do
+        for queue in binary radix; do
+            printf '%-7s ' "$queue"
+            "$dir/route_bench.sh" "$map" "$QUERIES" "./ssmap --queue $queue" $mode
+        done
+    done
+done
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Route latency benchmark.
+#
+# usage: bench/route_bench.sh [MAP] [QUERIES] [BINARY] [OPTION...]
+#
+# Runs QUERIES random "path create" commands against MAP and reports the
+# average latency per route, with the time spent loading the map subtracted.
+# Any OPTIONs (e.g. --astar) are passed on to every path create command.
+# BINARY may include startup flags, e.g. "./ssmap --ch"; the time they take
+# is counted as load time.
+# The query set is generated from a fixed seed, so runs of different builds
+# of BINARY are directly comparable.
+
+MAP=${1:-huntsville.txt}
+QUERIES=${2:-2000}
+BINARY=${3:-./ssmap}
+[ $# -gt 3 ] && shift 3 || set --
+OPTIONS="$*"
+
+nodes=$(sed -n '3s/ nodes//p' "$MAP")
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk -v n="$nodes" -v q="$QUERIES" -v opts="$OPTIONS" 'BEGIN {
+    srand(42);
+    if (opts != "")
+        opts = opts " ";
+    for (i = 0; i < q; i++)
+        printf "path create %s%d %d\n", opts, int(rand() * n), int(rand() * n);
+    print "quit";
+}' > "$script"
+
+now() { date +%s%N; }
+
+t0=$(now)
+echo quit | $BINARY "$MAP" > /dev/null
+t1=$(now)
+$BINARY "$MAP" < "$script" > /dev/null
+t2=$(now)
+
+load_ns=$(( t1 - t0 ))
+run_ns=$(( t2 - t1 - load_ns ))
+echo "$MAP${OPTIONS:+ $OPTIONS}: $QUERIES routes, load $(( load_ns / 1000000 )) ms," \
+     "$(( run_ns / QUERIES / 1000 )) us/route"
@@ -0,0 +1,163 @@
+/*
+ * Parallel route throughput benchmark.
+ *
+ * usage: thread_bench SNAPSHOT [QUERIES] [THREADS] [dijkstra|astar|bidirectional|ch]
+ *
+ * Loads a map snapshot (see ssmap --compile) once and answers QUERIES random
+ * routes on it with ssmap_route, first on 1 thread, then 2, 4, ... up to
+ * THREADS (if omitted or 0, the number of online processors). All threads share
+ * the one map; each has its own query workspace and route buffer, and takes
+ * the next query with an atomic increment. The queries are generated from a
+ * fixed seed, and the checksum of their travel times must be the same for
+ * every thread count.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../streets.h"
+
+struct job {
+    const struct ssmap *m;
+    enum ssmap_route_mode mode;
+    const int *pairs; // Start and end node of each query.
+    int count; // Number of queries.
+    int next; // Next query to hand out; taken with an atomic increment.
+    double *minutes; // Travel time of each query's route.
+    bool failed; // Set if any thread ran out of memory.
+};
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned long long next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double elapsed(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static void *worker(void *arg) {
+    struct job *job = arg;
+    struct ssmap_query_ctx *ctx = ssmap_query_ctx_create(job->m);
+    int *path = malloc(sizeof(int) * ssmap_num_nodes(job->m));
+    if (ctx == NULL || path == NULL) {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        ssmap_query_ctx_destroy(ctx);
+        free(path);
+        return NULL;
+    }
+
+    int i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        struct ssmap_route route = { .node_ids = path, .capacity = ssmap_num_nodes(job->m) };
+        if (!ssmap_route(job->m, ctx, job->pairs[2 * i], job->pairs[2 * i + 1], job->mode, &route)) {
+            __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        }
+        job->minutes[i] = route.minutes;
+    }
+
+    ssmap_query_ctx_destroy(ctx);
+    free(path);
+    return NULL;
+}
+
+// Answers every query of the job on num_threads threads; returns the seconds taken, or -1.
+static double run(struct job *job, int num_threads) {
+    pthread_t threads[num_threads];
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+
+    job->next = 0;
+    for (int t = 0; t < num_threads; t++) {
+        if (pthread_create(&threads[t], NULL, worker, job) != 0) {
+            job->failed = true;
+            num_threads = t;
+        }
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    return job->failed ? -1 : elapsed(a, b);
+}
+
+int main(int argc, char **argv) {
+    static const char *modes[] = { "dijkstra", "astar", "bidirectional", "ch" };
+    int count = argc > 2 ? atoi(argv[2]) : 20000;
+    int max_threads = argc > 3 ? atoi(argv[3]) : 0;
+    if (max_threads == 0) {
+        max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    int mode = argc > 4 ? -1 : SSMAP_ROUTE_ASTAR;
+    for (int i = 0; argc > 4 && i < 4; i++) {
+        if (strcmp(argv[4], modes[i]) == 0) {
+            mode = i;
+        }
+    }
+    if (argc < 2 || count <= 0 || max_threads <= 0 || mode < 0) {
+        fprintf(stderr, "usage: %s SNAPSHOT [QUERIES] [THREADS] [dijkstra|astar|bidirectional|ch]\n", argv[0]);
+        return 1;
+    }
+
+    struct ssmap *m = ssmap_load_snapshot(argv[1]);
+    if (m == NULL) {
+        fprintf(stderr, "could not load %s\n", argv[1]);
+        return 1;
+    }
+    // The hierarchy is built before any thread starts; after that the map is only read.
+    if (mode == SSMAP_ROUTE_HIERARCHY && !ssmap_contract(m, NULL)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    struct job job = { m, mode, NULL, count, 0, NULL, false };
+    int *pairs = malloc(sizeof(int) * 2 * count);
+    job.minutes = malloc(sizeof(double) * count);
+    if (pairs == NULL || job.minutes == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < 2 * count; i++) {
+        double lat, lon;
+        do {
+            pairs[i] = next_random() % ssmap_num_nodes(m);
+        } while (!ssmap_node_position(m, pairs[i], &lat, &lon));
+    }
+    job.pairs = pairs;
+
+    printf("%s, %d %s routes\n", argv[1], count, modes[mode]);
+    double single = 0;
+    for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        double seconds = run(&job, threads);
+        if (seconds < 0) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        if (threads == 1) {
+            single = seconds;
+        }
+
+        double checksum = 0;
+        for (int i = 0; i < count; i++) {
+            checksum += job.minutes[i];
+        }
+        printf("%3d threads %9.0f routes/s  speedup %5.2f  checksum %.3f\n",
+               threads, count / seconds, single / seconds, checksum);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    free(pairs);
+    free(job.minutes);
+    ssmap_destroy(m);
+    return 0;
+}
@@ -0,0 +1,6 @@
+heap.o: heap.c heap.h
+main.o: main.c streets.h serve.h
+serve.o: serve.c serve.h streets.h
+streets.o: streets.c streets.h heap.h
+streets.pic.o: streets.c streets.h heap.h
+heap.pic.o: heap.c heap.h
@@ -0,0 +1,592 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "heap.h"
+
+// Size of a cache line, which the key and id arrays of a min_heap are aligned to.
+#define CACHE_LINE 64
+
+// The arrays of a min_heap are shifted by this many slots, so that the children of element i,
+// which start at element MIN_HEAP_ARITY * i + 1, start at a multiple of MIN_HEAP_ARITY slots
+// from the aligned start of the allocation.
+#define HEAP_SHIFT (MIN_HEAP_ARITY - 1)
+
+/**
+ * Allocates an array for a min_heap, aligned so that sibling groups do not straddle cache lines.
+ *
+ * @param count The number of elements the array must hold.
+ * @param size The size of each element, in bytes.
+ * @return A pointer to element 0 of the array, HEAP_SHIFT slots past the aligned start of the
+ *         allocation, or NULL if memory runs out. Free it with free_heap_array.
+ */
+static void *alloc_heap_array(int count, size_t size) {
+    size_t bytes = (count + HEAP_SHIFT) * size;
+    void *base;
+    if (posix_memalign(&base, CACHE_LINE, bytes > 0 ? bytes : 1) != 0) {
+        return NULL;
+    }
+    return (char *)base + HEAP_SHIFT * size;
+}
+
+/**
+ * Frees an array allocated by alloc_heap_array.
+ *
+ * @param array Pointer to element 0 of the array, or NULL.
+ * @param size The size of each element, in bytes.
+ */
+static void free_heap_array(void *array, size_t size) {
+    if (array != NULL) {
+        free((char *)array - HEAP_SHIFT * size);
+    }
+}
+
+/**
+ * Creates a new min_heap with a specified capacity.
+ *
+ * @param capacity The maximum number of elements the heap can hold. Node ids stored in the
+ *        heap must lie in [0, capacity).
+ * @return A pointer to the newly created min_heap structure.
+ *
+ * This function dynamically allocates memory for a min_heap structure, its key and id arrays
+ * and the node_id -> slot position index, initializing the size to 0 and marking every node as
+ * absent from the heap. The key array is aligned so that the MIN_HEAP_ARITY keys of the
+ * children of any element lie in a single cache line; with 8-byte keys and an arity of 8 they
+ * fill it exactly. The function returns a pointer to the allocated min_heap. If memory
+ * allocation fails at any step, the function will return NULL to indicate failure.
+ */
+min_heap* create_min_heap(int capacity) {
+    // Allocate memory for the min_heap structure itself.
+    min_heap *heap = malloc(sizeof(min_heap));
+    if (heap == NULL) {
+        return NULL;
+    }
+    // Allocate the keys and ids, and the position index, one slot per possible node_id. The key
+    // array has MIN_HEAP_ARITY - 1 spare slots, so that the last element's sibling group is complete.
+    heap->keys = alloc_heap_array(capacity + MIN_HEAP_ARITY - 1, sizeof(double));
+    heap->ids = alloc_heap_array(capacity, sizeof(int));
+    heap->position = malloc(sizeof(int) * capacity);
+    if (heap->keys == NULL || heap->ids == NULL || heap->position == NULL) {
+        free_min_heap(heap);
+        return NULL;
+    }
+    // No node is in the heap yet, and every key slot is past its end.
+    for (int i = 0; i < capacity; i++) {
+        heap->position[i] = -1;
+    }
+    for (int i = 0; i < capacity + MIN_HEAP_ARITY - 1; i++) {
+        heap->keys[i] = INFINITY;
+    }
+    // Initialize the size of the heap to 0, indicating it's currently empty.
+    heap->size = 0;
+    // Set the capacity of the heap to the specified value.
+    heap->capacity = capacity;
+    // Return a pointer to the successfully created min_heap structure.
+    return heap;
+}
+
+/**
+ * Moves an element up the min_heap until its parent's key is no larger than its own.
+ *
+ * @param min_heap Pointer to the min_heap structure.
+ * @param i Index of the element to move.
+ *
+ * Rather than swapping the element with each parent in turn, the parents are moved down into
+ * the hole it leaves, and the element is written once at its final position.
+ */
+static void sift_up(min_heap *min_heap, int i) {
+    double key = min_heap->keys[i];
+    int id = min_heap->ids[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / MIN_HEAP_ARITY;
+        if (min_heap->keys[parent] <= key) {
+            break;
+        }
+        min_heap->keys[i] = min_heap->keys[parent];
+        min_heap->ids[i] = min_heap->ids[parent];
+        min_heap->position[min_heap->ids[i]] = i;
+        i = parent;
+    }
+
+    min_heap->keys[i] = key;
+    min_heap->ids[i] = id;
+    min_heap->position[id] = i;
+}
+
+/**
+ * Restores the min-heap property below an element, moving it down the heap as far as needed.
+ *
+ * @param min_heap Pointer to the min_heap structure.
+ * @param idx Index of the element to move.
+ *
+ * At each step the function scans the keys of the element's children, which sit together in one
+ * cache line, for the smallest. If that child's key is smaller than the element's, the child
+ * moves up into the element's place and the scan continues from the child's position. The
+ * element itself is only written once it has settled. The loop is iterative, so the stack depth
+ * does not grow with the size of the heap.
+ */
+void min_heapify(min_heap *min_heap, int idx) {
+    double key = min_heap->keys[idx];
+    int id = min_heap->ids[idx];
+
+    while (true) {
+        int first = MIN_HEAP_ARITY * idx + 1;
+        if (first >= min_heap->size) {
+            break;
+        }
+
+        // Find the smallest child. Slots past the end of the heap hold infinite keys, so all
+        // MIN_HEAP_ARITY slots can be compared without checking which children exist.
+        int smallest = first;
+        for (int c = first + 1; c < first + MIN_HEAP_ARITY; c++) {
+            if (min_heap->keys[c] < min_heap->keys[smallest]) {
+                smallest = c;
+            }
+        }
+
+        // Stop once the element is no larger than all of its children.
+        if (min_heap->keys[smallest] >= key) {
+            break;
+        }
+
+        // Otherwise move the smaller child up and continue from there.
+        min_heap->keys[idx] = min_heap->keys[smallest];
+        min_heap->ids[idx] = min_heap->ids[smallest];
+        min_heap->position[min_heap->ids[idx]] = idx;
+        idx = smallest;
+    }
+
+    min_heap->keys[idx] = key;
+    min_heap->ids[idx] = id;
+    min_heap->position[id] = idx;
+}
+
+/**
+ * Extracts and returns the minimum element from the min_heap.
+ *
+ * @param min_heap Pointer to the min_heap structure from which to extract the minimum element.
+ * @return The heap_node representing the minimum element in the heap. If the heap is empty,
+ *         returns a heap_node with an ID of -1 and a distance of 0 as an indication of failure.
+ *
+ * This function removes the root of the min_heap, which is the minimum element due to the
+ * min-heap property, and returns it. To maintain the min-heap property after removal,
+ * it places the last element of the heap at the root position and then applies the
+ * min_heapify function to restructure the heap. This ensures that the structure remains
+ * a valid min-heap after the minimum element's extraction.
+ */
+heap_node extract_min(min_heap *min_heap) {
+    // Check if the heap is empty; if so, return a default heap_node indicating failure.
+    if (min_heap->size == 0) {
+        return (heap_node){-1, 0}; // Use -1 as an invalid node_id and 0 as the distance.
+    }
+
+    // Store the root of the heap (the minimum element) to return it later.
+    heap_node root = { min_heap->ids[0], min_heap->keys[0] };
+
+    // The extracted node is no longer in the heap.
+    min_heap->position[root.node_id] = -1;
+
+    // Decrease the heap's size since the minimum element is being removed.
+    min_heap->size--;
+
+    // Move the last element in the heap to the root position and reapply the min-heap property.
+    // The slot it leaves is past the end of the heap and gets an infinite key.
+    double key = min_heap->keys[min_heap->size];
+    min_heap->keys[min_heap->size] = INFINITY;
+    if (min_heap->size > 0) {
+        min_heap->keys[0] = key;
+        min_heap->ids[0] = min_heap->ids[min_heap->size];
+        min_heapify(min_heap, 0);
+    }
+
+    // Return the originally stored root, which is the minimum element.
+    return root;
+
+}
+
+/**
+ * Returns the smallest key in the min_heap without removing it.
+ *
+ * @param min_heap Pointer to the min_heap structure, which must not be empty.
+ * @return The key of the root element.
+ */
+double min_heap_min_key(const min_heap *min_heap) {
+    return min_heap->keys[0];
+}
+
+/**
+ * Decreases the distance value for a specified node in the min_heap and restructures
+ * the heap if necessary to maintain the min-heap property.
+ *
+ * @param min_heap Pointer to the min_heap structure.
+ * @param node_id The identifier of the node for which the distance value is to be decreased.
+ * @param distance The new distance value for the node, which is assumed to be less than
+ *        the node's current distance value.
+ *
+ * This function looks up the slot of the node with the given node_id in the position index
+ * and updates the node's distance to the new, lower value. To maintain the min-heap property
+ * (where the parent node's distance is always less than or equal to its children's distances),
+ * the function then moves the updated node up the heap with sift_up. Both steps together take
+ * O(log N) time. Nothing happens if the node is not in the heap.
+ */
+void decrease_key(min_heap *min_heap, int node_id, double distance) {
+    // Find the slot currently holding the node.
+    int i = min_heap->position[node_id];
+    if (i < 0) {
+        return;
+    }
+
+    // Update the node's distance to the new, decreased value.
+    min_heap->keys[i] = distance;
+
+    // Move the node up the heap to its correct position to maintain the min-heap property.
+    sift_up(min_heap, i);
+
+}
+
+/**
+ * Checks whether a node is present in the min_heap.
+ *
+ * @param min_heap Pointer to the min_heap structure to be searched.
+ * @param node_id The identifier of the node to search for within the min_heap.
+ * @return A boolean value indicating whether the node is found in the min_heap.
+ *         Returns true if the node is found; otherwise, returns false.
+ *
+ * This function consults the position index, so the test takes constant time. It is useful
+ * for determining whether to insert a new node into the min_heap or to update an existing
+ * node's distance value using the decrease_key function.
+ */
+bool is_in_min_heap(const min_heap *min_heap, int node_id) {
+    return min_heap->position[node_id] >= 0;
+
+}
+
+/**
+ * Inserts a new node into the min_heap with a given distance.
+ *
+ * @param min_heap Pointer to the min_heap structure where the new node will be inserted.
+ * @param node_id The identifier of the node to be inserted.
+ * @param distance The distance value associated with the node, used as the key for heap insertion.
+ *
+ * This function inserts a new node into the min_heap while maintaining the min-heap property,
+ * which requires that every parent node's distance is less than or equal to the distances of its children.
+ * If the heap is already at full capacity, the function will not insert the new node. After insertion,
+ * the function ensures the min-heap property is maintained by moving the newly inserted node up
+ * past any parents with larger keys.
+ */
+void insert_min_heap(min_heap *min_heap, int node_id, double distance) {
+    // Check if the heap has reached its maximum capacity.
+    if (min_heap->size == min_heap->capacity) {
+        // If the heap is full, do not insert the new node and return early.
+        return;
+    }
+
+    // Place the new node at the end of the heap and move it up to its correct position.
+    int i = min_heap->size++;
+    min_heap->keys[i] = distance;
+    min_heap->ids[i] = node_id;
+    sift_up(min_heap, i);
+
+}
+
+/**
+ * Frees the memory allocated for a min_heap structure.
+ *
+ * @param min_heap Pointer to the min_heap structure to be freed, or NULL.
+ *
+ * This function ensures that all memory allocated for the min_heap, including its
+ * key and id arrays and position index, is properly freed. It's crucial to call this function to
+ * avoid memory leaks once the min_heap is no longer needed.
+ */
+void free_min_heap(min_heap *min_heap) {
+    if (min_heap != NULL) {
+        free_heap_array(min_heap->keys, sizeof(double));
+        free_heap_array(min_heap->ids, sizeof(int));
+        free(min_heap->position);
+        free(min_heap);
+    }
+}
+
+/**
+ * Removes all elements from a min_heap so that it can be reused.
+ *
+ * @param min_heap Pointer to the min_heap structure to be emptied.
+ *
+ * Only the slots of the elements still in the heap are reset in the position index, so this
+ * takes time proportional to the current size of the heap rather than to its capacity.
+ */
+void clear_min_heap(min_heap *min_heap) {
+    for (int i = 0; i < min_heap->size; i++) {
+        min_heap->position[min_heap->ids[i]] = -1;
+        min_heap->keys[i] = INFINITY;
+    }
+    min_heap->size = 0;
+}
+
+/**
+ * Maps a non-negative key to an integer with the same order.
+ *
+ * @param key A non-negative, non-NaN double.
+ * @return The bit pattern of the key.
+ *
+ * IEEE 754 doubles are stored as sign, exponent and mantissa, in that order, so for
+ * non-negative values comparing the bit patterns as unsigned integers gives the same result as
+ * comparing the values. This lets the radix heap work on exact keys without quantising them.
+ */
+static inline uint64_t radix_key(double key) {
+    uint64_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return bits;
+}
+
+/**
+ * Finds the bucket of the radix heap that a key belongs in.
+ *
+ * @param key The key, as returned by radix_key.
+ * @param last The most recently extracted key.
+ * @return 0 if the key equals last, otherwise one more than the index of the highest bit in
+ *         which the two differ.
+ */
+static inline int radix_bucket(uint64_t key, uint64_t last) {
+    return key == last ? 0 : 64 - __builtin_clzll(key ^ last);
+}
+
+/**
+ * Frees the memory allocated for a radix_heap structure.
+ *
+ * @param heap Pointer to the radix_heap structure to be freed, or NULL.
+ */
+void free_radix_heap(radix_heap *heap) {
+    if (heap != NULL) {
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            free(heap->buckets[b].entries);
+        }
+        free(heap->keys);
+        free(heap);
+    }
+}
+
+/**
+ * Creates a new radix_heap for node ids in [0, capacity).
+ *
+ * @param capacity The number of node ids the heap can hold.
+ * @return A pointer to the newly created radix_heap structure, or NULL if memory runs out.
+ *
+ * The buckets start out empty and grow as entries are added. Clearing the heap keeps their
+ * storage, so a heap that is reused for many queries soon stops allocating altogether.
+ */
+radix_heap* create_radix_heap(int capacity) {
+    radix_heap *heap = calloc(1, sizeof(radix_heap));
+    if (heap == NULL) {
+        return NULL;
+    }
+    heap->keys = malloc(sizeof(uint64_t) * capacity);
+    if (heap->keys == NULL) {
+        free(heap);
+        return NULL;
+    }
+    // No node is in the heap yet.
+    for (int i = 0; i < capacity; i++) {
+        heap->keys[i] = RADIX_ABSENT;
+    }
+    heap->capacity = capacity;
+    return heap;
+}
+
+/**
+ * Makes room for more entries in a bucket of a radix_heap.
+ *
+ * @param bucket Pointer to the bucket.
+ * @param extra The number of entries that will be appended.
+ * @return true upon success, false if the bucket could not grow.
+ */
+static bool radix_reserve(radix_bucket_list *bucket, int extra) {
+    if (bucket->size + extra <= bucket->capacity) {
+        return true;
+    }
+
+    int capacity = bucket->capacity > 0 ? bucket->capacity : 64;
+    while (capacity < bucket->size + extra) {
+        capacity *= 2;
+    }
+    radix_entry *entries = realloc(bucket->entries, capacity * sizeof(radix_entry));
+    if (entries == NULL) {
+        return false;
+    }
+    bucket->entries = entries;
+    bucket->capacity = capacity;
+    return true;
+}
+
+/**
+ * Appends an entry to the bucket its key belongs in.
+ *
+ * @param heap Pointer to the radix_heap.
+ * @param b The bucket, as returned by radix_bucket for the entry's key.
+ * @param entry The entry to append.
+ * @return true upon success, false if the bucket could not grow.
+ */
+static inline bool radix_append(radix_heap *heap, int b, radix_entry entry) {
+    radix_bucket_list *bucket = &heap->buckets[b];
+    if (bucket->size == bucket->capacity && !radix_reserve(bucket, 1)) {
+        return false;
+    }
+    bucket->entries[bucket->size++] = entry;
+    if (b > 0) {
+        heap->occupied |= (uint64_t)1 << (b - 1);
+    }
+    return true;
+}
+
+/**
+ * Gives up on the current contents of a radix_heap after running out of memory.
+ *
+ * @param heap Pointer to the radix_heap.
+ *
+ * The heap reports itself empty, so that the search using it stops, and sets its failed flag so
+ * that the search's result can be discarded. clear_radix_heap makes it usable again.
+ */
+static void radix_fail(radix_heap *heap) {
+    heap->failed = true;
+    heap->size = 0;
+}
+
+/**
+ * Inserts a node into the radix_heap, or lowers its key if it is already there.
+ *
+ * @param heap Pointer to the radix_heap.
+ * @param node_id The node to insert or update.
+ * @param distance The node's new key, which must not be less than the last key extracted.
+ *
+ * Lowering a key adds a new entry and leaves the old one behind; an entry only counts while its
+ * key is the node's current key, and stale ones are dropped when their bucket is next visited.
+ * The heap is monotone: keys below the last extracted one would belong in no bucket. Dijkstra's
+ * algorithm never produces such keys, and A* with a consistent heuristic only does by rounding
+ * errors, so such a key is raised to the last extracted one. That moves the node by at most an
+ * ulp in the extraction order.
+ */
+void radix_heap_push(radix_heap *heap, int node_id, double distance) {
+    uint64_t key = radix_key(distance);
+    if (key < heap->last) {
+        key = heap->last;
+    }
+    if (heap->failed || key == heap->keys[node_id]) {
+        return;
+    }
+
+    if (!radix_append(heap, radix_bucket(key, heap->last), (radix_entry){node_id, key})) {
+        radix_fail(heap);
+        return;
+    }
+
+    if (heap->keys[node_id] == RADIX_ABSENT) {
+        heap->size++;
+    }
+    heap->keys[node_id] = key;
+}
+
+/**
+ * Makes sure that the top of bucket 0 of the radix_heap holds a minimum element.
+ *
+ * @param heap Pointer to the radix_heap, which must not be empty.
+ * @return true upon success, false if the heap ran out of memory and failed.
+ *
+ * Stale entries are popped off bucket 0. If it runs empty, the lowest non-empty bucket is
+ * scanned for its smallest current key, which becomes the new last key, and every current
+ * entry in that bucket is moved to the bucket it now belongs in. All of them land in lower
+ * buckets, since they agree with the new last key on every bit above the bucket's, so an entry
+ * moves down at most 64 times over its life in the heap. If a bucket cannot grow on the way,
+ * the heap fails; entries may then sit in two buckets at once, which only clear_radix_heap
+ * has to cope with.
+ */
+static bool radix_refill(radix_heap *heap) {
+    radix_bucket_list *zero = &heap->buckets[0];
+
+    while (true) {
+        while (zero->size > 0 && heap->keys[zero->entries[zero->size - 1].node_id] != heap->last) {
+            zero->size--;
+        }
+        if (zero->size > 0) {
+            return true;
+        }
+
+        int b = __builtin_ctzll(heap->occupied) + 1;
+        radix_bucket_list *bucket = &heap->buckets[b];
+        uint64_t min = RADIX_ABSENT;
+        for (int i = 0; i < bucket->size; i++) {
+            radix_entry e = bucket->entries[i];
+            if (heap->keys[e.node_id] == e.key && e.key < min) {
+                min = e.key;
+            }
+        }
+
+        heap->last = min;
+        for (int i = 0; i < bucket->size; i++) {
+            radix_entry e = bucket->entries[i];
+            if (heap->keys[e.node_id] == e.key && !radix_append(heap, radix_bucket(e.key, min), e)) {
+                radix_fail(heap);
+                return false;
+            }
+        }
+        bucket->size = 0;
+        heap->occupied &= ~((uint64_t)1 << (b - 1));
+    }
+}
+
+/**
+ * Returns the smallest key in the radix_heap without removing it.
+ *
+ * @param heap Pointer to the radix_heap, which must not be empty.
+ * @return The smallest key, or infinity if the heap ran out of memory.
+ */
+double radix_heap_min_key(radix_heap *heap) {
+    if (!radix_refill(heap)) {
+        return INFINITY;
+    }
+    double key;
+    memcpy(&key, &heap->last, sizeof(key));
+    return key;
+}
+
+/**
+ * Removes an element with the smallest key from the radix_heap.
+ *
+ * @param heap Pointer to the radix_heap, which must not be empty.
+ * @return The node id of the removed element, or -1 if the heap ran out of memory.
+ */
+int radix_heap_extract_min(radix_heap *heap) {
+    if (!radix_refill(heap)) {
+        return -1;
+    }
+    radix_bucket_list *zero = &heap->buckets[0];
+    int node_id = zero->entries[--zero->size].node_id;
+    heap->keys[node_id] = RADIX_ABSENT;
+    heap->size--;
+    return node_id;
+}
+
+/**
+ * Removes all elements from a radix_heap so that it can be reused.
+ *
+ * @param heap Pointer to the radix_heap to be emptied.
+ *
+ * Like clear_min_heap, this takes time proportional to the number of entries still in the
+ * heap, stale ones included. The buckets keep their storage, and the last extracted key is
+ * reset so that the next use can start from any key.
+ */
+void clear_radix_heap(radix_heap *heap) {
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+        radix_bucket_list *bucket = &heap->buckets[b];
+        for (int i = 0; i < bucket->size; i++) {
+            heap->keys[bucket->entries[i].node_id] = RADIX_ABSENT;
+        }
+        bucket->size = 0;
+    }
+    heap->occupied = 0;
+    heap->last = 0;
+    heap->size = 0;
+    heap->failed = false;
+}
+
@@ -0,0 +1,155 @@
+#ifndef _HEAP_H_
+#define _HEAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Number of children of every element of a min_heap: 2, 4 or 8. The keys of
+ * an element's children are stored next to each other, aligned so that they
+ * share one cache line. Override with -DMIN_HEAP_ARITY=N.
+ */
+#ifndef MIN_HEAP_ARITY
+#define MIN_HEAP_ARITY 4
+#endif
+
+#if MIN_HEAP_ARITY != 2 && MIN_HEAP_ARITY != 4 && MIN_HEAP_ARITY != 8
+#error MIN_HEAP_ARITY must be 2, 4 or 8
+#endif
+
+// Used within the min_heap to associate a node with its current shortest distance from the start node.
+typedef struct {
+  int node_id; // Identifier for the node this entry corresponds to.
+  double distance; // Current shortest distance from the start node to this node.
+} heap_node;
+
+// A d-ary min-heap (priority queue) structure used to efficiently select the next node to process
+// based on distance. Keys and node ids are kept in separate arrays, so that comparing the
+// children of an element only reads keys, and aligned so that those keys share a cache line.
+typedef struct {
+  double *keys; // Key of each element, in heap order. The children of element i are elements MIN_HEAP_ARITY * i + 1 and up.
+  int *ids; // Node id of each element, in the same order as 'keys'.
+  int *position; // Maps a node_id to its index in 'keys' and 'ids', or -1 if the node is not in the heap.
+  int size; // Current number of elements in the heap.
+  int capacity; // Maximum number of elements the heap can contain.
+} min_heap;
+
+// Number of buckets in a radix_heap: one for keys equal to the last extracted key, and one for
+// each bit position in which a 64-bit key can first differ from it.
+#define RADIX_BUCKETS 65
+
+// Marks a node that is not in a radix_heap. No non-negative double has this bit pattern.
+#define RADIX_ABSENT UINT64_MAX
+
+// An entry of a radix_heap bucket: a node and the key it had when the entry was added.
+typedef struct {
+  int node_id; // The node.
+  uint64_t key; // The node's key, as returned by radix_key.
+} radix_entry;
+
+// A growable array of radix_heap entries.
+typedef struct {
+  radix_entry *entries; // The entries.
+  int size; // Number of entries in use.
+  int capacity; // Number of entries allocated.
+} radix_bucket_list;
+
+// A radix heap: a monotone priority queue, in which no key inserted may be smaller than the
+// last key extracted. Keys are kept in buckets by the highest bit in which they differ from the
+// last extracted key, so the minimum is found without comparing most keys.
+typedef struct {
+  radix_bucket_list buckets[RADIX_BUCKETS]; // Bucket 0 holds keys equal to 'last'; bucket b > 0 those first differing from it in bit b - 1.
+  uint64_t occupied; // Bit b - 1 is set if bucket b > 0 may hold entries.
+  uint64_t *keys; // Current key of each node, or RADIX_ABSENT if the node is not in the heap.
+  uint64_t last; // The last key extracted.
+  int size; // Current number of nodes in the heap.
+  int capacity; // Number of node ids the heap can hold.
+  bool failed; // A bucket could not grow. The heap then acts empty until it is cleared.
+} radix_heap;
+
+/**
+ * Create an empty min_heap for node ids in [0, capacity).
+ *
+ * @param capacity The maximum number of elements, and the bound on node ids.
+ * @return A heap-allocated min_heap, or NULL if malloc fails.
+ */
+min_heap* create_min_heap(int capacity);
+
+/**
+ * Insert a node that is not yet in the heap. Nothing happens if the heap is full.
+ */
+void insert_min_heap(min_heap *min_heap, int node_id, double distance);
+
+/**
+ * Lower the key of a node in the heap. Nothing happens if the node is not in it.
+ */
+void decrease_key(min_heap *min_heap, int node_id, double distance);
+
+/**
+ * Remove and return an element with the smallest key, or {-1, 0} if the heap is empty.
+ */
+heap_node extract_min(min_heap *min_heap);
+
+/**
+ * Return the smallest key in the heap, which must not be empty.
+ */
+double min_heap_min_key(const min_heap *min_heap);
+
+/**
+ * Whether a node is in the heap.
+ */
+bool is_in_min_heap(const min_heap *min_heap, int node_id);
+
+/**
+ * Restore the heap order below an element whose key has grown.
+ */
+void min_heapify(min_heap *min_heap, int idx);
+
+/**
+ * Remove all elements, in time proportional to their number.
+ */
+void clear_min_heap(min_heap *min_heap);
+
+/**
+ * Free a min_heap, or do nothing if it is NULL.
+ */
+void free_min_heap(min_heap *min_heap);
+
+/**
+ * Create an empty radix_heap for node ids in [0, capacity).
+ *
+ * @param capacity The bound on node ids.
+ * @return A heap-allocated radix_heap, or NULL if malloc fails.
+ */
+radix_heap* create_radix_heap(int capacity);
+
+/**
+ * Insert a node, or lower its key if it is already in the heap. Keys below the
+ * last one extracted are raised to it.
+ */
+void radix_heap_push(radix_heap *heap, int node_id, double distance);
+
+/**
+ * Return the smallest key in the heap, which must not be empty, or infinity if
+ * the heap ran out of memory.
+ */
+double radix_heap_min_key(radix_heap *heap);
+
+/**
+ * Remove an element with the smallest key and return its node id, or -1 if the
+ * heap ran out of memory. The heap must not be empty.
+ */
+int radix_heap_extract_min(radix_heap *heap);
+
+/**
+ * Remove all elements and reset the failed flag, in time proportional to the
+ * number of entries.
+ */
+void clear_radix_heap(radix_heap *heap);
+
+/**
+ * Free a radix_heap, or do nothing if it is NULL.
+ */
+void free_radix_heap(radix_heap *heap);
+
+#endif /* _HEAP_H_ */
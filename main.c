@@ -3,107 +3,461 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "streets.h"
+#include "serve.h"
 
-// use for reading from file and stdin
-#define BUFSIZE 32768
-char buffer[BUFSIZE];
+// longest command line, including its newline
+#define BUFSIZE (1 << 20)
+
+// stdio buffer size for queries and results in batch mode
+#define BATCH_BUFSIZE (1 << 22)
+
+// fewest records worth handing to a thread of their own when loading a map
+#define LOAD_RECORDS_PER_THREAD 4096
 
 #define RET_OK(expr, expected, label) do { \
     if ((expr) != (expected)) goto label; \
 } while(0)
 
+static void
+remove_newline(char * string)
+{
+    char * newline = strchr(string, '\n');
+    if (newline) {
+        *newline = '\0';
+    }
+}
+
+// A cursor over the text of a map file that has been read into memory.
+struct scanner {
+    char * pos;     // next character to read
+    char * end;     // end of the text, where a '\0' is stored
+};
+
+static void
+skip_space(struct scanner * s)
+{
+    while (s->pos < s->end && isspace((unsigned char)*s->pos)) {
+        s->pos++;
+    }
+}
+
+// match a literal word after optional whitespace, like a fscanf directive
+static bool
+scan_word(struct scanner * s, const char * word)
+{
+    size_t len = strlen(word);
+
+    skip_space(s);
+    if ((size_t)(s->end - s->pos) < len || memcmp(s->pos, word, len) != 0) {
+        return false;
+    }
+    s->pos += len;
+    return true;
+}
+
+static bool
+scan_int(struct scanner * s, int * value)
+{
+    skip_space(s);
+
+    char * p = s->pos;
+    bool negative = false;
+    long long result = 0;
+
+    if (p < s->end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    if (p == s->end || !isdigit((unsigned char)*p)) {
+        return false;
+    }
+    while (p < s->end && isdigit((unsigned char)*p)) {
+        result = result * 10 + (*p++ - '0');
+        if (result > (long long)INT_MAX + 1) {
+            return false;
+        }
+    }
+    if (negative) {
+        result = -result;
+    }
+    if (result > INT_MAX) {
+        return false;
+    }
+
+    *value = (int)result;
+    s->pos = p;
+    return true;
+}
+
 static bool
-load_int_array(int size, int arr[size], FILE * f)
+scan_double(struct scanner * s, double * value)
 {
-    for (int i = 0; i < size; i++) {
-        if (fscanf(f, "%d", arr+i) != 1) {
+    // powers of ten that are exactly representable as doubles
+    static const double exact_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    skip_space(s);
+
+    char * p = s->pos;
+    bool negative = false;
+    unsigned long long mantissa = 0;
+    int digits = 0, decimals = 0;
+
+    if (p < s->end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    while (p < s->end && isdigit((unsigned char)*p) && digits < 19) {
+        mantissa = mantissa * 10 + (*p++ - '0');
+        digits++;
+    }
+    if (p < s->end && *p == '.') {
+        p++;
+        while (p < s->end && isdigit((unsigned char)*p) && digits < 19) {
+            mantissa = mantissa * 10 + (*p++ - '0');
+            digits++;
+            decimals++;
+        }
+    }
+
+    // Plain decimals whose digits fit a double exactly are correctly rounded by a single
+    // division, which gives the same result as strtod. Anything else (more digits, exponents,
+    // inf, nan) is left to strtod, which stops at the '\0' at the end of the text at the latest.
+    bool exact = digits > 0 && mantissa <= (1ull << 53) && decimals <= 22 &&
+                 (p == s->end || (!isdigit((unsigned char)*p) && *p != 'e' && *p != 'E'));
+    if (!exact) {
+        char * endptr;
+        *value = strtod(s->pos, &endptr);
+        if (endptr == s->pos) {
             return false;
         }
+        s->pos = endptr;
+        return true;
     }
-    fscanf(f, "\n");
+
+    *value = (negative ? -(double)mantissa : (double)mantissa) / exact_pow10[decimals];
+    s->pos = p;
     return true;
 }
 
-static void
-remove_newline(char * string)
+// skip over an integer whose value is not needed, like a %*d conversion
+static bool
+skip_int(struct scanner * s)
 {
-    char * newline = strchr(string, '\n');
-    if (newline) {
+    skip_space(s);
+
+    char * p = s->pos;
+    if (p < s->end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p == s->end || !isdigit((unsigned char)*p)) {
+        return false;
+    }
+    while (p < s->end && isdigit((unsigned char)*p)) {
+        p++;
+    }
+    s->pos = p;
+    return true;
+}
+
+// read a non-whitespace token of at most max_len characters
+static bool
+scan_token(struct scanner * s, char * token, size_t max_len)
+{
+    skip_space(s);
+
+    size_t len = 0;
+    while (s->pos + len < s->end && !isspace((unsigned char)s->pos[len])) {
+        len++;
+    }
+    if (len == 0 || len > max_len) {
+        return false;
+    }
+    memcpy(token, s->pos, len);
+    token[len] = '\0';
+    s->pos += len;
+    return true;
+}
+
+// return the rest of the current line, terminating it in place
+static char *
+scan_line(struct scanner * s)
+{
+    char * line = s->pos;
+    char * newline = memchr(s->pos, '\n', s->end - s->pos);
+
+    if (newline == NULL) {
+        s->pos = s->end;
+    }
+    else {
         *newline = '\0';
+        s->pos = newline + 1;
     }
+    return line;
 }
 
-static struct ssmap * 
-load_map(const char * filename)
+// read count ids, each in [0, limit), into a scratch array that grows as needed
+static bool
+scan_ids(struct scanner * s, int count, int limit, int ** ids, int * capacity)
 {
-    FILE * f = fopen(filename, "rt");
-    struct ssmap * map = NULL;
-    int nr_nodes, nr_ways;
+    if (count > *capacity) {
+        int * grown = realloc(*ids, count * sizeof(int));
+        if (grown == NULL) {
+            return false;
+        }
+        *ids = grown;
+        *capacity = count;
+    }
 
-    if (f == NULL) {
-        fprintf(stderr, "error: could not open %s\n", filename);
+    for (int i = 0; i < count; i++) {
+        if (!scan_int(s, *ids + i) || (*ids)[i] < 0 || (*ids)[i] >= limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static char *
+read_file(const char * filename, size_t * size)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    char * text = NULL;
+
+    if (fd < 0) {
         return NULL;
     }
 
-    if (fgets(buffer, BUFSIZE, f) == NULL) {
-        goto done;
+    if (fstat(fd, &st) == 0 && (text = malloc(st.st_size + 1)) != NULL) {
+        size_t done = 0;
+        while (done < (size_t)st.st_size) {
+            ssize_t n = read(fd, text + done, st.st_size - done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        text[done] = '\0';
+        *size = done;
     }
 
-    RET_OK(strcmp(buffer, "Simple Street Map\n"), 0, invalid);
-    RET_OK(fscanf(f, "%d ways\n", &nr_ways), 1, invalid);
-    RET_OK(fscanf(f, "%d nodes\n", &nr_nodes), 1, invalid);
+    close(fd);
+    return text;
+}
 
-    map = ssmap_create(nr_nodes, nr_ways);
-    if (map == NULL) {
-        fprintf(stderr, "error: could not create ssmap\n");
-        goto done;
+static bool
+parse_way(struct scanner * s, struct ssmap * map, int ** ids, int * capacity)
+{
+    int id, num_nodes;
+    double maxspeed;
+    char which_way[8];
+
+    /* note: we are intentionally not loading the OSM id */
+    if (!(scan_word(s, "way") && scan_int(s, &id) && skip_int(s))) {
+        return false;
+    }
+    if (id < 0 || id >= ssmap_num_ways(map)) {
+        return false;
+    }
+    skip_space(s);
+    char * name = scan_line(s);
+    if (!(scan_double(s, &maxspeed) && scan_token(s, which_way, 7) && scan_int(s, &num_nodes))) {
+        return false;
     }
 
-    for (int i = 0; i < nr_ways; i++) {
-        int id, num_nodes;
-        float maxspeed;
-        char which_way[8];
+    bool oneway = strcmp(which_way, "oneway") == 0;
+
+    return num_nodes > 0 &&
+           scan_ids(s, num_nodes, ssmap_num_nodes(map), ids, capacity) &&
+           ssmap_add_way(map, id, name, maxspeed, oneway, num_nodes, *ids) != NULL;
+}
+
+static bool
+parse_node(struct scanner * s, struct ssmap * map, int ** ids, int * capacity)
+{
+    int id, num_ways;
+    double lat, lon;
+
+    /* note: we are intentionally not loading the OSM id */
+    if (!(scan_word(s, "node") && scan_int(s, &id) && skip_int(s) &&
+          scan_double(s, &lat) && scan_double(s, &lon) && scan_int(s, &num_ways))) {
+        return false;
+    }
+    if (id < 0 || id >= ssmap_num_nodes(map)) {
+        return false;
+    }
 
-        /* note: we are intentionally not loading the OSM id */
-        RET_OK(fscanf(f, "way %d %*d ", &id), 1, cleanup);
-        RET_OK(fgets(buffer, BUFSIZE, f), buffer, cleanup);
-        RET_OK(fscanf(f, " %f %7s %d\n", &maxspeed, which_way, &num_nodes), 3, cleanup);
+    return num_ways > 0 &&
+           scan_ids(s, num_ways, ssmap_num_ways(map), ids, capacity) &&
+           ssmap_add_node(map, id, lat, lon, num_ways, *ids) != NULL;
+}
 
-        remove_newline(buffer);
-        bool oneway = strcmp(which_way, "oneway") == 0;
-        struct way * way = NULL;
+// Find the start of the first count records that begin with word, looking at the first
+// non-blank character of each line from pos onwards. Returns the start of the line after the
+// last record, or NULL if there are fewer than count records.
+static char *
+find_records(char * pos, char * end, const char * word, char ** records, int count)
+{
+    size_t len = strlen(word);
+    int found = 0;
 
-        if (num_nodes > 0) {
-            int node_ids[num_nodes];
-            RET_OK(load_int_array(num_nodes, node_ids, f), true, cleanup);
-            way = ssmap_add_way(map, id, buffer, maxspeed, oneway, num_nodes, node_ids);
+    while (found < count && pos < end) {
+        while (pos < end && isspace((unsigned char)*pos)) {
+            pos++;
         }
+        if ((size_t)(end - pos) > len && memcmp(pos, word, len) == 0 &&
+            isspace((unsigned char)pos[len])) {
+            records[found++] = pos;
+        }
+
+        char * newline = memchr(pos, '\n', end - pos);
+        pos = newline == NULL ? end : newline + 1;
+    }
 
-        if (way == NULL) {
-            goto cleanup;
+    return found == count ? pos : NULL;
+}
+
+// Records that have no other records between them, parsed by one thread.
+struct load_chunk {
+    struct ssmap * map;
+    bool (*parse)(struct scanner * s, struct ssmap * map, int ** ids, int * capacity);
+    char ** records;    // start of each record in the chunk
+    int count;          // number of records in the chunk
+    char * next;        // start of the record after the chunk, or NULL if there is none
+    char * end;         // end of the file text
+    bool ok;
+};
+
+static void *
+parse_chunk(void * arg)
+{
+    struct load_chunk * chunk = arg;
+    int * ids = NULL;
+    int capacity = 0;
+
+    chunk->ok = true;
+    for (int i = 0; i < chunk->count && chunk->ok; i++) {
+        struct scanner s = { chunk->records[i], chunk->end };
+        char * next = i + 1 < chunk->count ? chunk->records[i + 1] : chunk->next;
+
+        chunk->ok = chunk->parse(&s, chunk->map, &ids, &capacity);
+
+        // a record has to end where the pre-scan found the next one, otherwise the file is not
+        // laid out one record per line and the chunks would not have parsed the same records
+        // as a single pass from the start of the file
+        if (chunk->ok && next != NULL) {
+            skip_space(&s);
+            chunk->ok = s.pos == next;
         }
     }
 
-    for (int i = 0; i < nr_nodes; i++) {
-        int id, num_ways;
-        double lat, lon;
+    free(ids);
+    return NULL;
+}
+
+// parse count records on up to num_threads threads, each one taking a contiguous run of them
+static bool
+parse_records(struct load_chunk * proto, char ** records, int count, int num_threads)
+{
+    if (num_threads > count / LOAD_RECORDS_PER_THREAD) {
+        num_threads = count / LOAD_RECORDS_PER_THREAD;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    struct load_chunk * chunks = malloc(num_threads * sizeof(struct load_chunk));
+    pthread_t * threads = malloc(num_threads * sizeof(pthread_t));
+    bool * started = malloc(num_threads * sizeof(bool));
+    bool ok = chunks != NULL && threads != NULL && started != NULL;
+
+    if (!ok) {
+        num_threads = 0;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        int first = (long long)count * i / num_threads;
+        int last = (long long)count * (i + 1) / num_threads;
+
+        chunks[i] = *proto;
+        chunks[i].records = records + first;
+        chunks[i].count = last - first;
+        chunks[i].next = last < count ? records[last] : proto->next;
+        started[i] = i > 0 && pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) == 0;
+    }
 
-        /* note: we are intentionally not loading the OSM id */
-        RET_OK(fscanf(f, "node %d %*d %lf %lf %d\n", &id, &lat, &lon, &num_ways), 4, cleanup);
-        struct node * node = NULL;
-        
-        if (num_ways > 0) {
-            int way_ids[num_ways];
-            RET_OK(load_int_array(num_ways, way_ids, f), true, cleanup);
-            node = ssmap_add_node(map, id, lat, lon, num_ways, way_ids);
+    // the calling thread takes the first chunk, and any chunk whose thread failed to start
+    for (int i = 0; i < num_threads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
         }
-         
-        if (node == NULL) {
-            goto cleanup;
+        else {
+            parse_chunk(&chunks[i]);
         }
+        ok = ok && chunks[i].ok;
     }
 
+    free(chunks);
+    free(threads);
+    free(started);
+    return ok;
+}
+
+static struct ssmap * 
+load_map(const char * filename, int num_threads)
+{
+    size_t size;
+    char * text = read_file(filename, &size);
+    struct ssmap * map = NULL;
+    char ** records = NULL;
+    int nr_nodes, nr_ways;
+
+    if (text == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename);
+        return NULL;
+    }
+
+    struct scanner s = { text, text + size };
+
+    if (size == 0) {
+        goto done;
+    }
+
+    RET_OK(strcmp(scan_line(&s), "Simple Street Map"), 0, invalid);
+    RET_OK(scan_int(&s, &nr_ways) && scan_word(&s, "ways"), true, invalid);
+    RET_OK(scan_int(&s, &nr_nodes) && scan_word(&s, "nodes"), true, invalid);
+
+    map = ssmap_create(nr_nodes, nr_ways);
+    if (map == NULL) {
+        fprintf(stderr, "error: could not create ssmap\n");
+        goto done;
+    }
+
+    // All ways come before all nodes, and the records within each block only depend on the map
+    // slots of the other block, so each block can be split between threads. Ways are parsed
+    // first since nodes point to them.
+    records = malloc((nr_ways + nr_nodes) * sizeof(char *));
+    RET_OK(records != NULL, true, cleanup);
+
+    char ** way_records = records;
+    char ** node_records = records + nr_ways;
+    char * nodes_start = find_records(s.pos, s.end, "way", way_records, nr_ways);
+    RET_OK(nodes_start != NULL, true, cleanup);
+    RET_OK(find_records(nodes_start, s.end, "node", node_records, nr_nodes) != NULL, true, cleanup);
+
+    struct load_chunk ways = { map, parse_way, NULL, 0, node_records[0], s.end, false };
+    struct load_chunk nodes = { map, parse_node, NULL, 0, NULL, s.end, false };
+
+    RET_OK(parse_records(&ways, way_records, nr_ways, num_threads), true, cleanup);
+    RET_OK(parse_records(&nodes, node_records, nr_nodes, num_threads), true, cleanup);
+
     // custom initialization after all nodes and ways have been added
     if (!ssmap_initialize(map)) {
         goto cleanup;
@@ -113,15 +467,66 @@ load_map(const char * filename)
     goto done;
 cleanup:
     ssmap_destroy(map);
+    map = NULL;
 invalid:
     fprintf(stderr, "error: %s has invalid file format\n", filename);
 done:
-    fclose(f);
+    free(records);
+    free(text);
+    return map;
+}
+
+static struct ssmap *
+load_snapshot(const char * filename)
+{
+    struct ssmap * map = ssmap_load_snapshot(filename);
+
+    if (map == NULL) {
+        fprintf(stderr, "error: %s has invalid file format\n", filename);
+        return NULL;
+    }
+
+    printf("%s successfully loaded. %d nodes, %d ways.\n", filename,
+           ssmap_num_nodes(map), ssmap_num_ways(map));
     return map;
 }
 
 static bool
-get_integer_argument(char * line, int * iptr)
+is_snapshot(const char * filename)
+{
+    char magic[sizeof(SSMAP_SNAPSHOT_MAGIC) - 1];
+    FILE * f = fopen(filename, "rb");
+    bool result = false;
+
+    if (f != NULL) {
+        result = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                 memcmp(magic, SSMAP_SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+        fclose(f);
+    }
+    return result;
+}
+
+static int
+compile_map(const char * input, const char * output, int num_threads)
+{
+    struct ssmap * map = load_map(input, num_threads);
+    if (map == NULL) {
+        return 1;
+    }
+
+    bool ok = ssmap_save(map, output);
+    ssmap_destroy(map);
+    if (!ok) {
+        fprintf(stderr, "error: could not write %s\n", output);
+        return 1;
+    }
+
+    printf("%s successfully written.\n", output);
+    return 0;
+}
+
+static bool
+get_integer_argument(char * line, int * iptr, FILE * out)
 {
     remove_newline(line);
 
@@ -129,12 +534,12 @@ get_integer_argument(char * line, int * iptr)
         return true;
     }
 
-    printf("error: '%s' is not an integer.\n", line);
+    fprintf(out, "error: '%s' is not an integer.\n", line);
     return false;
 }
 
 static void
-handle_find(char * line, struct ssmap * map)
+handle_find(char * line, const struct ssmap * map, FILE * out)
 {
     char * command = strtok_r(line, " \t\r\n\v\f", &line);
     char * first = strtok_r(line, " \t\r\n\v\f", &line);
@@ -146,7 +551,7 @@ handle_find(char * line, struct ssmap * map)
     }
     else if (strcmp(command, "node") == 0) {
         if (first == NULL || third != NULL) {
-            printf("error: invalid number of arguments.\n");
+            fprintf(out, "error: invalid number of arguments.\n");
         }
         else {
             ssmap_find_node_by_names(map, first, second);
@@ -155,7 +560,7 @@ handle_find(char * line, struct ssmap * map)
     }
     else if (strcmp(command, "way") == 0) {
         if (first == NULL || second != NULL) {
-            printf("error: invalid number of arguments.\n");
+            fprintf(out, "error: invalid number of arguments.\n");
         }
         else {
             ssmap_find_way_by_name(map, first);
@@ -163,14 +568,14 @@ handle_find(char * line, struct ssmap * map)
         }    
     }
     else {
-        printf("error: first argument must be either node or way.\n");
+        fprintf(out, "error: first argument must be either node or way.\n");
     }
 
-    printf("usage: find way keyword | find node keyword [keyword]\n");
+    fprintf(out, "usage: find way keyword | find node keyword [keyword]\n");
 }
 
 static bool
-handle_path_travel_time(char * line, struct ssmap * map)
+handle_path_travel_time(char * line, const struct ssmap * map, FILE * out)
 {
     int capacity = 1;
     int n = 0;
@@ -182,8 +587,15 @@ handle_path_travel_time(char * line, struct ssmap * map)
         }
     }
 
-    int node_ids[capacity];
-    while(true) {
+    // on the heap, as a long path may not fit on the stack of a server worker
+    int * node_ids = malloc(capacity * sizeof(int));
+    if (node_ids == NULL) {
+        fprintf(out, "error: out of memory.\n");
+        return true;
+    }
+
+    bool valid = true;
+    while(valid) {
         char * token = strtok_r(line, " \t\r\n\v\f", &line);
         char * endptr;
 
@@ -192,54 +604,130 @@ handle_path_travel_time(char * line, struct ssmap * map)
 
         node_ids[n++] = strtol(token, &endptr, 10);
         if (endptr && *endptr != '\0') {
-            printf("error: %s is not an integer.\n", token);
-            return false;
+            fprintf(out, "error: %s is not an integer.\n", token);
+            valid = false;
         }
     }
 
-    if (n < 2) {
-        printf("error: must specify at least two nodes.\n");
-        return false;
+    if (valid && n < 2) {
+        fprintf(out, "error: must specify at least two nodes.\n");
+        valid = false;
     }
 
-    double result = ssmap_path_travel_time(map, n, node_ids);
-    if (result >= 0.) {
-        printf("%.4f minutes\n", result);
+    if (valid) {
+        double result = ssmap_path_travel_time(map, n, node_ids);
+        if (result >= 0.) {
+            fprintf(out, "%.4f minutes\n", result);
+        }
     }
-    
-    return true;
+
+    free(node_ids);
+    return valid;
+}
+
+static bool
+get_position_argument(const char * arg, double * lat, double * lon, FILE * out)
+{
+    char * endptr;
+
+    // "@lat,lon", with the latitude and longitude in degrees
+    if (arg[0] == '@') {
+        *lat = strtod(arg + 1, &endptr);
+        if (endptr != arg + 1 && *endptr == ',' && *lat >= -90. && *lat <= 90.) {
+            const char * rest = endptr + 1;
+            *lon = strtod(rest, &endptr);
+            if (endptr != rest && *endptr == '\0' && *lon >= -180. && *lon <= 180.) {
+                return true;
+            }
+        }
+    }
+
+    fprintf(out, "error: %s is not a position of the form @lat,lon.\n", arg);
+    return false;
 }
 
 static bool
-handle_path_create(char * line, struct ssmap * map)
+handle_path_create(char * line, const struct ssmap * map, struct ssmap_query_ctx * ctx, FILE * out)
 {
-    char * start = strtok_r(line, " \t\r\n\v\f", &line);
-    char * finish = strtok_r(line, " \t\r\n\v\f", &line);
+    enum ssmap_route_mode mode = SSMAP_ROUTE_DIJKSTRA;
+    char * start = NULL;
+    char * finish = NULL;
+    char * token;
     char * endptr;
 
+    while ((token = strtok_r(line, " \t\r\n\v\f", &line)) != NULL) {
+        if (strcmp(token, "--astar") == 0) {
+            mode = SSMAP_ROUTE_ASTAR;
+        }
+        else if (strcmp(token, "--bidir") == 0) {
+            mode = SSMAP_ROUTE_BIDIRECTIONAL;
+        }
+        else if (strcmp(token, "--ch") == 0) {
+            mode = SSMAP_ROUTE_HIERARCHY;
+        }
+        else if (strncmp(token, "--", 2) == 0) {
+            fprintf(out, "error: unknown option %s.\n", token);
+            return false;
+        }
+        else if (start == NULL) {
+            start = token;
+        }
+        else if (finish == NULL) {
+            finish = token;
+        }
+    }
+
     if (start == NULL || finish == NULL) {
-        printf("error: must specify start node and finish node.\n");
+        fprintf(out, "error: must specify start node and finish node.\n");
         return false;
     }
 
+    if (start[0] == '@' || finish[0] == '@') {
+        double from_lat, from_lon, to_lat, to_lon;
+        if (!get_position_argument(start, &from_lat, &from_lon, out) ||
+            !get_position_argument(finish, &to_lat, &to_lon, out)) {
+            return false;
+        }
+        ssmap_path_create_between(map, ctx, from_lat, from_lon, to_lat, to_lon);
+        return true;
+    }
+
     int start_id = strtol(start, &endptr, 10);
     if (endptr && *endptr != '\0') {
-        printf("error: %s is not an integer.\n", start);
+        fprintf(out, "error: %s is not an integer.\n", start);
         return false;
     }
 
     int end_id = strtol(finish, &endptr, 10);
     if (endptr && *endptr != '\0') {
-        printf("error: %s is not an integer.\n", finish);
+        fprintf(out, "error: %s is not an integer.\n", finish);
         return false;
     }
 
-    ssmap_path_create(map, start_id, end_id);
+    ssmap_path_create_with(map, ctx, start_id, end_id, mode);
     return true;
 }
 
 static void
-handle_path(char * line, struct ssmap * map)
+handle_edge(char * line, const struct ssmap * map, FILE * out)
+{
+    char * from = strtok_r(line, " \t\r\n\v\f", &line);
+    char * to = strtok_r(line, " \t\r\n\v\f", &line);
+    int from_id, to_id;
+
+    if (from == NULL || to == NULL || strtok_r(line, " \t\r\n\v\f", &line) != NULL) {
+        fprintf(out, "error: invalid number of arguments.\n");
+        fprintf(out, "usage: edge from to\n");
+        return;
+    }
+
+    if (get_integer_argument(from, &from_id, out) && get_integer_argument(to, &to_id, out)) {
+        ssmap_print_edge(map, from_id, to_id);
+    }
+}
+
+static void
+handle_path(char * line, const struct ssmap * map, struct ssmap_query_ctx * ctx, FILE * out)
 {
     char * command = strtok_r(line, " \t\r\n\v\f", &line);
 
@@ -247,73 +735,497 @@ handle_path(char * line, struct ssmap * map)
         /* fall through */
     }
     else if (strcmp(command, "time") == 0) {
-        if (handle_path_travel_time(line, map))
+        if (handle_path_travel_time(line, map, out))
             return;
     }
     else if (strcmp(command, "create") == 0) {
-        if (handle_path_create(line, map))
+        if (handle_path_create(line, map, ctx, out))
             return;
     }
     else {
-        printf("error: first argument must be either time or create.\n");
+        fprintf(out, "error: first argument must be either time or create.\n");
     }
 
-    printf("usage: path create start finish | path time node1 node2 [nodes...]\n");
+    fprintf(out, "usage: path create [--astar | --bidir | --ch] start finish | path create @lat,lon @lat,lon | path time node1 node2 [nodes...]\n");
 }
 
-int 
-main(int argc, const char * argv[])
+// explain why a matrix or isochrone call failed: the first of ids that is not a node, or memory
+static void
+print_error(int error, const struct ssmap * map, const int * ids, int count, FILE * out)
 {
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s FILE\n", argv[0]);
-        return 0;
+    double lat, lon;
+
+    if (error == SSMAP_ERROR_NO_MEMORY) {
+        fprintf(out, "error: out of memory.\n");
+        return;
     }
+    for (int i = 0; i < count; i++) {
+        if (!ssmap_node_position(map, ids[i], &lat, &lon)) {
+            fprintf(out, "error: node %d does not exist.\n", ids[i]);
+            return;
+        }
+    }
+}
 
-    struct ssmap * map = load_map(argv[1]);
-    if (map == NULL) {     
-        return 1;
+static bool
+run_matrix(char * line, const struct ssmap * map, int num_threads, FILE * out)
+{
+    int capacity = 1;
+    int n = 0;
+    int num_sources = -1;
+
+    // use number of space characters to determine approximate array size
+    for (int i = 0; line[i] != '\0'; i++) {
+        if (isspace((int)line[i])) {
+            capacity++;
+        }
+    }
+
+    // on the heap, as a long list may not fit on the stack of a server worker
+    int * node_ids = malloc(capacity * sizeof(int));
+    if (node_ids == NULL) {
+        fprintf(out, "error: out of memory.\n");
+        return true;
     }
 
     while(true) {
-        printf(">> ");
-        fflush(stdout);
-        char * ptr = fgets(buffer, BUFSIZE, stdin);
-        if (ptr == NULL) {
+        char * token = strtok_r(line, " \t\r\n\v\f", &line);
+        char * endptr;
+
+        if (token == NULL)
             break;
+
+        if (strcmp(token, "--") == 0 && num_sources < 0) {
+            num_sources = n;
+            continue;
         }
 
-        char * command = strtok_r(buffer, " \t\r\n\v\f", &ptr);
+        node_ids[n++] = strtol(token, &endptr, 10);
+        if (endptr && *endptr != '\0') {
+            fprintf(out, "error: %s is not an integer.\n", token);
+            free(node_ids);
+            return false;
+        }
+    }
+
+    int num_targets = n - num_sources;
+    if (num_sources < 1 || num_targets < 1) {
+        fprintf(out, "error: must specify at least one source and one destination.\n");
+        free(node_ids);
+        return false;
+    }
 
-        if (command == NULL) {
-            /* fall through */
+    double * times = malloc((size_t)num_sources * num_targets * sizeof(double));
+    if (times == NULL) {
+        fprintf(out, "error: matrix too large.\n");
+        free(node_ids);
+        return true;
+    }
+
+    int error = ssmap_matrix(map, num_sources, node_ids, num_targets, node_ids + num_sources, times, num_threads);
+    if (error < 0) {
+        print_error(error, map, node_ids, n, out);
+    }
+    else {
+        // one row per source, unreachable destinations shown as -
+        for (int i = 0; i < num_sources; i++) {
+            for (int j = 0; j < num_targets; j++) {
+                double t = times[(size_t)i * num_targets + j];
+                if (t < 0.) {
+                    fprintf(out, j > 0 ? " -" : "-");
+                }
+                else {
+                    fprintf(out, j > 0 ? " %.4f" : "%.4f", t);
+                }
+            }
+            fprintf(out, "\n");
         }
-        else if (strcmp(command, "quit") == 0) {
-            break;
+    }
+
+    free(times);
+    free(node_ids);
+    return true;
+}
+
+static void
+handle_matrix(char * line, const struct ssmap * map, int num_threads, FILE * out)
+{
+    if (!run_matrix(line, map, num_threads, out)) {
+        fprintf(out, "usage: matrix src [src...] -- dst [dst...]\n");
+    }
+}
+
+static bool
+run_isochrone(char * line, const struct ssmap * map, struct ssmap_query_ctx * ctx, FILE * out)
+{
+    bool hull = false;
+    char * start = NULL;
+    char * budget = NULL;
+    char * token;
+    char * endptr;
+
+    while ((token = strtok_r(line, " \t\r\n\v\f", &line)) != NULL) {
+        if (strcmp(token, "--hull") == 0) {
+            hull = true;
         }
-        else if (strcmp(command, "node") == 0) {
-            int id;
-            if (get_integer_argument(ptr, &id)) {
-                ssmap_print_node(map, id);
-            }
+        else if (strncmp(token, "--", 2) == 0) {
+            fprintf(out, "error: unknown option %s.\n", token);
+            return false;
         }
-        else if (strcmp(command, "way") == 0) {
-            int id;
-            if (get_integer_argument(ptr, &id)) {
-                ssmap_print_way(map, id);
-            }
+        else if (start == NULL) {
+            start = token;
         }
-        else if (strcmp(command, "find") == 0) {
-            handle_find(ptr, map);
+        else if (budget == NULL) {
+            budget = token;
         }
-        else if (strcmp(command, "path") == 0) {
-            handle_path(ptr, map);
+        else {
+            fprintf(out, "error: invalid number of arguments.\n");
+            return false;
+        }
+    }
+
+    if (start == NULL || budget == NULL) {
+        fprintf(out, "error: must specify start node and minutes.\n");
+        return false;
+    }
+
+    int start_id = strtol(start, &endptr, 10);
+    if (endptr && *endptr != '\0') {
+        fprintf(out, "error: %s is not an integer.\n", start);
+        return false;
+    }
+
+    double minutes = strtod(budget, &endptr);
+    if ((endptr && *endptr != '\0') || !(minutes >= 0.)) {
+        fprintf(out, "error: %s is not a number of minutes.\n", budget);
+        return false;
+    }
+
+    struct ssmap_arrival * arrivals;
+    int count = ssmap_isochrone(map, ctx, start_id, minutes, &arrivals);
+    if (count < 0) {
+        print_error(count, map, &start_id, 1, out);
+        return true;
+    }
+
+    if (!hull) {
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "%d %.4f\n", arrivals[i].node_id, arrivals[i].minutes);
+        }
+        free(arrivals);
+        return true;
+    }
+
+    // the hull corners, counterclockwise, one "id lat lon" line each
+    int * ids = malloc(2 * count * sizeof(int));
+    if (ids != NULL) {
+        for (int i = 0; i < count; i++) {
+            ids[i] = arrivals[i].node_id;
+        }
+        int corners = ssmap_convex_hull(map, count, ids, ids + count);
+        for (int i = 0; i < corners; i++) {
+            double lat, lon;
+            ssmap_node_position(map, ids[count + i], &lat, &lon);
+            fprintf(out, "%d %.7f %.7f\n", ids[count + i], lat, lon);
+        }
+    }
+    free(ids);
+    free(arrivals);
+    return true;
+}
+
+static void
+handle_isochrone(char * line, const struct ssmap * map, struct ssmap_query_ctx * ctx, FILE * out)
+{
+    if (!run_isochrone(line, map, ctx, out)) {
+        fprintf(out, "usage: isochrone [--hull] node minutes\n");
+    }
+}
+
+static bool
+run_nearest(char * line, const struct ssmap * map, FILE * out)
+{
+    char * lat_arg = strtok_r(line, " \t\r\n\v\f", &line);
+    char * lon_arg = strtok_r(line, " \t\r\n\v\f", &line);
+    char * k_arg = strtok_r(line, " \t\r\n\v\f", &line);
+    char * endptr;
+    int k = 1;
+
+    if (lat_arg == NULL || lon_arg == NULL || strtok_r(line, " \t\r\n\v\f", &line) != NULL) {
+        fprintf(out, "error: invalid number of arguments.\n");
+        return false;
+    }
+
+    double lat = strtod(lat_arg, &endptr);
+    if (*endptr != '\0' || !(lat >= -90. && lat <= 90.)) {
+        fprintf(out, "error: %s is not a latitude.\n", lat_arg);
+        return false;
+    }
+
+    double lon = strtod(lon_arg, &endptr);
+    if (*endptr != '\0' || !(lon >= -180. && lon <= 180.)) {
+        fprintf(out, "error: %s is not a longitude.\n", lon_arg);
+        return false;
+    }
+
+    if (k_arg != NULL) {
+        k = strtol(k_arg, &endptr, 10);
+        if (*endptr != '\0' || k < 1) {
+            fprintf(out, "error: %s is not a positive integer.\n", k_arg);
+            return false;
+        }
+    }
+
+    int * node_ids = malloc(k * sizeof(int));
+    double * metres = malloc(k * sizeof(double));
+    int count = node_ids != NULL && metres != NULL ? ssmap_nearest_nodes(map, lat, lon, k, node_ids, metres) : -1;
+
+    // one "id metres" line per node, nearest first
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%d %.2f\n", node_ids[i], metres[i]);
+    }
+    free(node_ids);
+    free(metres);
+    return true;
+}
+
+static void
+handle_nearest(char * line, const struct ssmap * map, FILE * out)
+{
+    if (!run_nearest(line, map, out)) {
+        fprintf(out, "usage: nearest lat lon [k]\n");
+    }
+}
+
+// runs one command line, writing its output to out; returns false if the line was empty or quit
+static bool
+handle_command(char * line, const struct ssmap * map, struct ssmap_query_ctx * ctx, int num_threads,
+               FILE * out, bool * quit)
+{
+    char * ptr;
+    char * command = strtok_r(line, " \t\r\n\v\f", &ptr);
+
+    if (command == NULL) {
+        return false;
+    }
+    else if (strcmp(command, "quit") == 0) {
+        *quit = true;
+        return false;
+    }
+    else if (strcmp(command, "node") == 0) {
+        int id;
+        if (get_integer_argument(ptr, &id, out)) {
+            ssmap_print_node(map, id);
+        }
+    }
+    else if (strcmp(command, "way") == 0) {
+        int id;
+        if (get_integer_argument(ptr, &id, out)) {
+            ssmap_print_way(map, id);
+        }
+    }
+    else if (strcmp(command, "edge") == 0) {
+        handle_edge(ptr, map, out);
+    }
+    else if (strcmp(command, "find") == 0) {
+        handle_find(ptr, map, out);
+    }
+    else if (strcmp(command, "path") == 0) {
+        handle_path(ptr, map, ctx, out);
+    }
+    else if (strcmp(command, "matrix") == 0) {
+        handle_matrix(ptr, map, num_threads, out);
+    }
+    else if (strcmp(command, "isochrone") == 0) {
+        handle_isochrone(ptr, map, ctx, out);
+    }
+    else if (strcmp(command, "nearest") == 0) {
+        handle_nearest(ptr, map, out);
+    }
+    else {
+        fprintf(out, "error: unknown command %s. Available commands are:\n"
+                     "\tnode, way, edge, find, path, matrix, isochrone, nearest, quit\n", command);
+    }
+    return true;
+}
+
+// request handler of --serve; the pool already runs a request per worker, so matrix uses one thread
+static bool
+serve_request(char * line, struct ssmap_query_ctx * ctx, FILE * out, void * map)
+{
+    bool quit = false;
+    handle_command(line, map, ctx, 1, out, &quit);
+    return !quit;
+}
+
+static double
+elapsed_ms(const struct timespec * since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static bool
+build_hierarchy(struct ssmap * map)
+{
+    struct timespec start;
+    int shortcuts;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!ssmap_contract(map, &shortcuts)) {
+        fprintf(stderr, "error: could not build contraction hierarchy\n");
+        return false;
+    }
+
+    printf("contraction hierarchy built in %.1f ms, %d shortcuts.\n", elapsed_ms(&start), shortcuts);
+    return true;
+}
+
+int 
+main(int argc, const char * argv[])
+{
+    const char * filename = NULL;
+    const char * queries = NULL;
+    const char * address = NULL;
+    bool batch = false;
+    bool contract = false;
+    enum ssmap_queue queue = SSMAP_QUEUE_BINARY_HEAP;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool usage = false;
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    for (int i = 1; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = strtol(argv[++i], NULL, 10);
+            usage = num_threads < 1;
+        }
+        else if (strcmp(argv[i], "--compile") == 0 && i + 3 == argc && filename == NULL && !contract) {
+            return compile_map(argv[i + 1], argv[i + 2], num_threads);
+        }
+        else if (strcmp(argv[i], "--ch") == 0) {
+            contract = true;
+        }
+        else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            queries = argv[++i];
+            batch = true;
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            address = argv[++i];
+        }
+        else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "radix") == 0) {
+                queue = SSMAP_QUEUE_RADIX_HEAP;
+            }
+            else {
+                usage = strcmp(argv[i], "binary") != 0;
+            }
+        }
+        else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
         }
         else {
-            printf("error: unknown command %s. Available commands are:\n"
-                   "\tnode, way, find, path, quit\n", command);
+            usage = true;
         }
     }
+
+    if (filename == NULL || usage || (address != NULL && batch)) {
+        fprintf(stderr, "usage: %s [--threads N] [--ch] [--queue binary|radix] [--batch | -f QUERIES] FILE\n"
+                        "       %s [--threads N] [--ch] [--queue binary|radix] --serve unix:PATH|tcp:HOST:PORT FILE\n"
+                        "       %s [--threads N] --compile FILE SNAPSHOT\n", argv[0], argv[0], argv[0]);
+        return 0;
+    }
+
+    // in batch mode, queries are read and results written in large blocks, with no prompt and
+    // no flush after every command; both buffers must be set before the streams are first used
+    FILE * input = stdin;
+    if (queries != NULL && (input = fopen(queries, "r")) == NULL) {
+        fprintf(stderr, "error: could not open %s\n", queries);
+        return 1;
+    }
+    if (batch) {
+        setvbuf(input, NULL, _IOFBF, BATCH_BUFSIZE);
+        setvbuf(stdout, NULL, _IOFBF, BATCH_BUFSIZE);
+    }
+
+    // the command line being handled; the only state the loop keeps besides the workspace
+    char * buffer = malloc(BUFSIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+
+    struct ssmap * map = is_snapshot(filename) ? load_snapshot(filename)
+                                               : load_map(filename, num_threads);
+    if (map == NULL) {     
+        free(buffer);
+        return 1;
+    }
+
+    if (contract && !build_hierarchy(map)) {
+        ssmap_destroy(map);
+        free(buffer);
+        return 1;
+    }
+
+    // with --threads workers, each with a workspace of its own
+    if (address != NULL) {
+        int status = serve(address, map, queue, num_threads, serve_request, map);
+        ssmap_destroy(map);
+        free(buffer);
+        return status;
+    }
+
+    // one workspace for all queries; path create falls back to a temporary one if this fails
+    struct ssmap_query_ctx * ctx = ssmap_query_ctx_create(map);
+    if (ctx != NULL && !ssmap_query_ctx_set_queue(ctx, queue)) {
+        ssmap_query_ctx_destroy(ctx);
+        ctx = NULL;
+    }
+
+    struct timespec start;
+    long num_queries = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(true) {
+        if (!batch) {
+            printf(">> ");
+            fflush(stdout);
+        }
+        char * ptr = fgets(buffer, BUFSIZE, input);
+        if (ptr == NULL) {
+            break;
+        }
+
+        bool quit = false;
+        if (handle_command(buffer, map, ctx, num_threads, stdout, &quit)) {
+            num_queries++;
+        }
+        if (quit) {
+            break;
+        }
+    }
+
+    if (batch) {
+        // the time to write out the last results counts towards the throughput
+        fflush(stdout);
+        double ms = elapsed_ms(&start);
+        fprintf(stderr, "%ld queries in %.1f ms, %.0f queries/s\n",
+                num_queries, ms, ms > 0 ? num_queries * 1e3 / ms : 0.);
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
     
+    ssmap_query_ctx_destroy(ctx);
     ssmap_destroy(map);
+    free(buffer);
     return 0;
 }
\ No newline at end of file
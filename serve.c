@@ -0,0 +1,733 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "serve.h"
+
+// longest request line, like the REPL's
+#define SERVE_MAX_LINE (1 << 20)
+
+// a connection is not read while this much of its input waits to be handled, and its next
+// request waits while this much output is unsent, so no client makes the server buffer without bound
+#define SERVE_MAX_PENDING (1 << 22)
+
+// epoll events taken per wait
+#define SERVE_MAX_EVENTS 64
+
+// seconds between latency reports
+#define SERVE_REPORT_INTERVAL 10
+
+// latencies are counted in 32 buckets per power of two of nanoseconds, i.e. within about 3%
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+struct latency_histogram {
+    long count;
+    long buckets[LATENCY_BUCKETS];
+};
+
+struct connection {
+    int fd; // the socket, or -1 once closed
+    uint32_t events; // the epoll events the socket is registered for
+    bool registered; // the socket is in the epoll set; it leaves it when the client goes mid-request
+    char * in; // received bytes; those from in_pos on are not yet handled
+    size_t in_pos, in_len, in_cap;
+    char * out; // response bytes; those from out_pos on are not yet sent
+    size_t out_pos, out_len, out_cap;
+    bool eof; // the client will send nothing more
+    bool closing; // close once the output is sent, after quit or an error
+    bool busy; // a request is with the workers; only they touch the fields below until it returns
+    char * request; // the request line
+    struct timespec queued; // when the request was handed to the workers
+    char * response; // the response, from open_memstream
+    size_t response_len;
+    bool keep_open; // the handler's verdict
+    struct connection * next; // in the queue of requests, or the list of finished ones
+    struct connection * prev_open, * next_open; // in the list of open connections
+};
+
+struct server {
+    const struct ssmap * map;
+    enum ssmap_queue queue;
+    serve_handler handler;
+    void * arg;
+    int listen_fd;
+    int wake_fd; // eventfd the workers signal finished requests on
+    int signal_fd; // signalfd of SIGINT and SIGTERM
+    int epoll_fd;
+    struct connection * open; // every open connection
+    struct connection * closed; // connections closed during this round of events, freed after it
+    pthread_mutex_t lock; // guards the fields below
+    pthread_cond_t ready; // signalled when a request is queued or the server stops
+    struct connection * queue_head, ** queue_tail; // requests waiting for a worker
+    struct connection * finished; // requests the workers are done with
+    bool stopping;
+};
+
+static double
+seconds_between(const struct timespec * a, const struct timespec * b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static void
+record_latency(struct latency_histogram * h, double seconds)
+{
+    uint64_t ns = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+    int bucket = ns;
+    if (ns >= LATENCY_SUB_BUCKETS) {
+        int e = 63 - __builtin_clzll(ns);
+        bucket = (e - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS +
+                 (int)((ns >> (e - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+    }
+    h->buckets[bucket]++;
+    h->count++;
+}
+
+// the latency below which a fraction q of the requests completed, in milliseconds
+static double
+latency_percentile(const struct latency_histogram * h, double q)
+{
+    long rank = (long)(q * h->count + 0.999999);
+    long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0) {
+            if (i < 2 * LATENCY_SUB_BUCKETS) {
+                return i / 1e6;
+            }
+            // the middle of the bucket
+            int e = i / LATENCY_SUB_BUCKETS - 1 + LATENCY_SUB_BITS;
+            uint64_t low = (uint64_t)(LATENCY_SUB_BUCKETS + i % LATENCY_SUB_BUCKETS) << (e - LATENCY_SUB_BITS);
+            return (low + ((uint64_t)1 << (e - LATENCY_SUB_BITS)) / 2) / 1e6;
+        }
+    }
+    return 0.;
+}
+
+static void
+report_latency(const struct latency_histogram * h, const char * period)
+{
+    fprintf(stderr, "%ld requests %s, latency p50 %.3f ms, p99 %.3f ms\n",
+            h->count, period, latency_percentile(h, .50), latency_percentile(h, .99));
+}
+
+static void *
+worker(void * arg)
+{
+    struct server * server = arg;
+    struct ssmap_query_ctx * ctx = ssmap_query_ctx_create(server->map);
+    if (ctx != NULL && !ssmap_query_ctx_set_queue(ctx, server->queue)) {
+        ssmap_query_ctx_destroy(ctx);
+        ctx = NULL;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    while (true) {
+        while (server->queue_head == NULL && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->stopping) {
+            break;
+        }
+        struct connection * c = server->queue_head;
+        if ((server->queue_head = c->next) == NULL) {
+            server->queue_tail = &server->queue_head;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        // the response is collected in memory, then sent by the event loop; without a stream
+        // there is nowhere to write it, so the connection is closed instead
+        c->response = NULL;
+        c->response_len = 0;
+        c->keep_open = false;
+        FILE * out = open_memstream(&c->response, &c->response_len);
+        if (out != NULL) {
+            ssmap_set_output(out);
+            c->keep_open = server->handler(c->request, ctx, out, server->arg);
+            ssmap_set_output(NULL);
+            if (c->keep_open) {
+                fputs(".\n", out);
+            }
+            if (fclose(out) != 0) {
+                c->keep_open = false;
+            }
+        }
+
+        // the event loop is only woken for the first of a run of finished requests; it takes
+        // them all at once
+        pthread_mutex_lock(&server->lock);
+        c->next = server->finished;
+        server->finished = c;
+        if (c->next == NULL) {
+            uint64_t one = 1;
+            if (write(server->wake_fd, &one, sizeof(one)) < 0) {
+                perror("serve: eventfd");
+            }
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    ssmap_query_ctx_destroy(ctx);
+    return NULL;
+}
+
+static int
+listen_unix(const char * path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) == 0 || strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (bound < 0 && errno == EADDRINUSE) {
+        // a socket file nobody accepts on is left over from a server that did not shut down
+        // cleanly and is replaced; one that belongs to a running server is left alone
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool stale = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+                     errno == ECONNREFUSED;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (stale && unlink(path) == 0) {
+            bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        }
+        else {
+            errno = EADDRINUSE;
+        }
+    }
+    if (bound < 0 || listen(fd, SOMAXCONN) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static int
+listen_tcp(const char * host_port)
+{
+    // "host:port", with an IPv6 host in brackets
+    char host[256];
+    const char * colon = strrchr(host_port, ':');
+    if (colon == NULL || colon == host_port || (size_t)(colon - host_port) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, host_port, colon - host_port);
+    host[colon - host_port] = '\0';
+    char * name = host;
+    if (name[0] == '[' && name[strlen(name) - 1] == ']') {
+        name[strlen(name) - 1] = '\0';
+        name++;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                              .ai_flags = AI_PASSIVE | AI_NUMERICSERV };
+    struct addrinfo * addrs;
+    int status = getaddrinfo(name, colon + 1, &hints, &addrs);
+    if (status != 0) {
+        errno = status == EAI_SYSTEM ? errno : EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo * a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+            int saved = errno;
+            close(fd);
+            fd = -1;
+            errno = saved;
+        }
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+static bool
+watch(struct server * server, int fd, uint32_t events, void * ptr)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = ptr };
+    return epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void
+close_connection(struct server * server, struct connection * c)
+{
+    close(c->fd);
+    c->fd = -1;
+    if (c->prev_open != NULL) {
+        c->prev_open->next_open = c->next_open;
+    }
+    else {
+        server->open = c->next_open;
+    }
+    if (c->next_open != NULL) {
+        c->next_open->prev_open = c->prev_open;
+    }
+    // events for it may still be waiting in this round, so it is freed after the round
+    c->next = server->closed;
+    server->closed = c;
+}
+
+static void
+free_connection(struct connection * c)
+{
+    free(c->in);
+    free(c->out);
+    free(c->request);
+    free(c->response);
+    free(c);
+}
+
+static bool
+reserve(char ** buffer, size_t * cap, size_t needed)
+{
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap > 0 ? *cap : 4096;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    char * p = realloc(*buffer, new_cap);
+    if (p == NULL) {
+        return false;
+    }
+    *buffer = p;
+    *cap = new_cap;
+    return true;
+}
+
+static bool
+append_output(struct connection * c, const char * data, size_t length)
+{
+    if (c->out_pos > 0) {
+        memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+        c->out_len -= c->out_pos;
+        c->out_pos = 0;
+    }
+    if (!reserve(&c->out, &c->out_cap, c->out_len + length)) {
+        return false;
+    }
+    memcpy(c->out + c->out_len, data, length);
+    c->out_len += length;
+    return true;
+}
+
+// reads what the client has sent; returns false if the connection failed
+static bool
+receive_input(struct connection * c)
+{
+    while (!c->eof && c->in_len - c->in_pos < SERVE_MAX_PENDING) {
+        if (c->in_pos > 0) {
+            memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+            c->in_len -= c->in_pos;
+            c->in_pos = 0;
+        }
+        if (!reserve(&c->in, &c->in_cap, c->in_len + 4096)) {
+            return false;
+        }
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+        if (n > 0) {
+            c->in_len += n;
+        }
+        else if (n == 0) {
+            c->eof = true;
+        }
+        else if (errno != EINTR) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+    return true;
+}
+
+// sends what the socket takes; returns false if the connection failed
+static bool
+send_output(struct connection * c)
+{
+    while (c->out_pos < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+        if (n >= 0) {
+            c->out_pos += n;
+        }
+        else if (errno != EINTR) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+    c->out_pos = c->out_len = 0;
+    return true;
+}
+
+// hands the next complete request line of a connection to the workers, if there is one
+static void
+dispatch(struct server * server, struct connection * c)
+{
+    char * start = c->in + c->in_pos;
+    size_t available = c->in_len - c->in_pos;
+    char * newline = memchr(start, '\n', available);
+    size_t length = newline != NULL ? (size_t)(newline - start) + 1 : c->eof ? available : 0;
+
+    if (length > SERVE_MAX_LINE || (length == 0 && available >= SERVE_MAX_LINE)) {
+        static const char message[] = "error: request too long.\n";
+        append_output(c, message, sizeof(message) - 1);
+        c->closing = true;
+        return;
+    }
+    if (length == 0) {
+        return;
+    }
+
+    free(c->request);
+    if ((c->request = malloc(length + 1)) == NULL) {
+        c->closing = true;
+        return;
+    }
+    memcpy(c->request, start, length);
+    c->request[length] = '\0';
+    c->in_pos += length;
+
+    c->busy = true;
+    clock_gettime(CLOCK_MONOTONIC, &c->queued);
+    c->next = NULL;
+    pthread_mutex_lock(&server->lock);
+    *server->queue_tail = c;
+    server->queue_tail = &c->next;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+// registers the socket for the events the connection can make progress on
+static void
+update_events(struct server * server, struct connection * c)
+{
+    uint32_t events = 0;
+    if (!c->eof && !c->closing && c->in_len - c->in_pos < SERVE_MAX_PENDING) {
+        events |= EPOLLIN;
+    }
+    if (c->out_pos < c->out_len) {
+        events |= EPOLLOUT;
+    }
+    if (events != c->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = c };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+}
+
+// moves a connection on as far as it can go without blocking: sends its output, hands its next
+// request to the workers, and closes it when it is done
+static void
+service(struct server * server, struct connection * c)
+{
+    if (!c->registered) {
+        // the client went away while its request was with the workers
+        close_connection(server, c);
+        return;
+    }
+    if (!send_output(c)) {
+        c->closing = true;
+        c->out_pos = c->out_len = 0;
+    }
+    if (!c->busy && !c->closing && c->out_len - c->out_pos < SERVE_MAX_PENDING) {
+        dispatch(server, c);
+    }
+    if (!c->busy && c->out_pos == c->out_len && (c->closing || (c->eof && c->in_pos == c->in_len))) {
+        close_connection(server, c);
+        return;
+    }
+    update_events(server, c);
+}
+
+static void
+accept_connections(struct server * server)
+{
+    while (true) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("serve: accept");
+            }
+            return;
+        }
+
+        // responses are small and clients wait for them; fails harmlessly on Unix sockets
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        struct connection * c = calloc(1, sizeof(*c));
+        if (c == NULL || !watch(server, fd, EPOLLIN, c)) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        c->registered = true;
+        c->next_open = server->open;
+        if (server->open != NULL) {
+            server->open->prev_open = c;
+        }
+        server->open = c;
+    }
+}
+
+static void
+collect_finished(struct server * server, struct latency_histogram * interval,
+                 struct latency_histogram * total)
+{
+    uint64_t count;
+    if (read(server->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("serve: eventfd");
+    }
+
+    pthread_mutex_lock(&server->lock);
+    struct connection * c = server->finished;
+    server->finished = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (c != NULL) {
+        struct connection * next = c->next;
+        double seconds = seconds_between(&c->queued, &now);
+        record_latency(interval, seconds);
+        record_latency(total, seconds);
+
+        c->busy = false;
+        if (!c->keep_open || !append_output(c, c->response, c->response_len)) {
+            c->closing = true;
+        }
+        free(c->response);
+        c->response = NULL;
+        service(server, c);
+        c = next;
+    }
+}
+
+static void
+handle_event(struct server * server, struct connection * c, uint32_t events)
+{
+    if (c->fd < 0) {
+        return;
+    }
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        // the client is gone; nothing more can be sent to it
+        c->eof = c->closing = true;
+        c->out_pos = c->out_len = 0;
+    }
+    else if ((events & EPOLLIN) && !receive_input(c)) {
+        c->eof = c->closing = true;
+    }
+    if (c->busy) {
+        // until the request returns only the socket is looked after; once the client is gone it
+        // leaves the epoll set, which would otherwise report the hangup or error again and again
+        if (!c->closing && !send_output(c)) {
+            c->closing = true;
+            c->out_pos = c->out_len = 0;
+        }
+        if (c->closing) {
+            if (c->registered) {
+                epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+                c->registered = false;
+            }
+            return;
+        }
+        update_events(server, c);
+        return;
+    }
+    service(server, c);
+}
+
+int
+serve(const char * address, const struct ssmap * map, enum ssmap_queue queue,
+      int num_workers, serve_handler handler, void * arg)
+{
+    struct server server = {
+        .map = map, .queue = queue, .handler = handler, .arg = arg,
+        .listen_fd = -1, .wake_fd = -1, .signal_fd = -1, .epoll_fd = -1,
+        .queue_tail = &server.queue_head,
+    };
+    const char * unix_path = NULL;
+    int status = 1;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        unix_path = address + 5;
+        server.listen_fd = listen_unix(unix_path);
+    }
+    else if (strncmp(address, "tcp:", 4) == 0) {
+        server.listen_fd = listen_tcp(address + 4);
+    }
+    else {
+        fprintf(stderr, "error: %s is not of the form unix:PATH or tcp:HOST:PORT\n", address);
+        return 1;
+    }
+    if (server.listen_fd < 0) {
+        fprintf(stderr, "error: cannot listen on %s: %s\n", address, strerror(errno));
+        return 1;
+    }
+
+    // SIGINT and SIGTERM stop the server through the event loop; they are blocked before the
+    // workers start, so that no thread is interrupted by them
+    sigset_t signals, saved;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &saved);
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    pthread_t * workers = malloc(num_workers * sizeof(pthread_t));
+    struct latency_histogram * interval = calloc(1, sizeof(*interval));
+    struct latency_histogram * total = calloc(1, sizeof(*total));
+    int num_started = 0;
+
+    server.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (workers == NULL || interval == NULL || total == NULL || server.signal_fd < 0 ||
+        server.wake_fd < 0 || server.epoll_fd < 0 ||
+        !watch(&server, server.listen_fd, EPOLLIN, &server.listen_fd) ||
+        !watch(&server, server.wake_fd, EPOLLIN, &server.wake_fd) ||
+        !watch(&server, server.signal_fd, EPOLLIN, &server.signal_fd)) {
+        perror("serve");
+        goto done;
+    }
+
+    while (num_started < num_workers &&
+           pthread_create(&workers[num_started], NULL, worker, &server) == 0) {
+        num_started++;
+    }
+    if (num_started == 0) {
+        fprintf(stderr, "error: cannot start worker threads\n");
+        goto done;
+    }
+
+    fprintf(stderr, "serving %s with %d workers\n", address, num_started);
+
+    struct timespec last_report, now;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    bool running = true;
+    while (running) {
+        struct epoll_event events[SERVE_MAX_EVENTS];
+        int n = epoll_wait(server.epoll_fd, events, SERVE_MAX_EVENTS, 1000);
+        if (n < 0 && errno != EINTR) {
+            perror("serve: epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void * ptr = events[i].data.ptr;
+            if (ptr == &server.listen_fd) {
+                accept_connections(&server);
+            }
+            else if (ptr == &server.wake_fd) {
+                collect_finished(&server, interval, total);
+            }
+            else if (ptr == &server.signal_fd) {
+                // consumed here, so that it is not delivered once the signals are unblocked
+                struct signalfd_siginfo info;
+                if (read(server.signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    running = false;
+                }
+            }
+            else {
+                handle_event(&server, ptr, events[i].events);
+            }
+        }
+
+        while (server.closed != NULL) {
+            struct connection * c = server.closed;
+            server.closed = c->next;
+            free_connection(c);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (seconds_between(&last_report, &now) >= SERVE_REPORT_INTERVAL) {
+            if (interval->count > 0) {
+                char period[32];
+                snprintf(period, sizeof(period), "in the last %d s", SERVE_REPORT_INTERVAL);
+                report_latency(interval, period);
+                memset(interval, 0, sizeof(*interval));
+            }
+            last_report = now;
+        }
+    }
+
+    report_latency(total, "served");
+    status = 0;
+
+done:
+    // requests still queued or running are abandoned; the workers finish the one they are on
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    while (server.open != NULL) {
+        struct connection * c = server.open;
+        close_connection(&server, c);
+    }
+    while (server.closed != NULL) {
+        struct connection * c = server.closed;
+        server.closed = c->next;
+        free_connection(c);
+    }
+
+    if (unix_path != NULL) {
+        unlink(unix_path);
+    }
+    close(server.listen_fd);
+    if (server.epoll_fd >= 0) {
+        close(server.epoll_fd);
+    }
+    if (server.wake_fd >= 0) {
+        close(server.wake_fd);
+    }
+    if (server.signal_fd >= 0) {
+        close(server.signal_fd);
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+    free(workers);
+    free(interval);
+    free(total);
+    return status;
+}
@@ -0,0 +1,44 @@
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "streets.h"
+
+/**
+ * Handles one request line of a connection.
+ *
+ * @param line The request, ending with its newline unless it was the last
+ *             line the client sent.
+ * @param ctx The query workspace of the worker thread, or NULL.
+ * @param out The stream the response is written to. The print functions of
+ *            streets.h write to it as well.
+ * @param arg The argument passed to serve.
+ * @return false to close the connection instead of answering more requests.
+ */
+typedef bool (*serve_handler)(char * line, struct ssmap_query_ctx * ctx, FILE * out, void * arg);
+
+/**
+ * Answer line-protocol requests on a socket until SIGINT or SIGTERM.
+ *
+ * One thread accepts connections and moves bytes with epoll; num_workers
+ * threads, each with its own query workspace, run the handler on complete
+ * request lines. A client may send any number of requests without waiting
+ * (pipelining): the requests of one connection are handled one at a time,
+ * in order, and every response is followed by a line holding a single ".".
+ * The p50 and p99 latency of the requests, from the moment a line is handed
+ * to the pool until its response is ready, is reported on stderr every few
+ * seconds while requests come in, and for the whole run on shutdown.
+ *
+ * @param address "unix:PATH" for a Unix domain socket, or "tcp:HOST:PORT".
+ * @param map The map the requests query, which must not change meanwhile.
+ * @param queue The priority queue of the workers' query workspaces.
+ * @param num_workers The number of worker threads, at least 1.
+ * @param handler The function answering each request line.
+ * @param arg Passed on to the handler.
+ * @return 0 after shutting down, 1 if the server could not be started.
+ */
+int serve(const char * address, const struct ssmap * map, enum ssmap_queue queue,
+          int num_workers, serve_handler handler, void * arg);
+
+#endif /* _SERVE_H_ */
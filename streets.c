@@ -3,7 +3,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "streets.h"
+#include "heap.h"
 
 
 
@@ -27,318 +34,249 @@ struct way {
   int num_nodes; // Number of nodes in this way.
 };
 
-// Represents the entire map, consisting of nodes and ways.
-struct ssmap {
-  struct node **nodes; // Array of pointers to 'node' structures in the map.
-  struct way **ways; // Array of pointers to 'way' structures in the map.
-  int num_nodes; // Total number of nodes in the map.
-  int num_ways; // Total number of ways in the map.
+// A directed graph in compressed-sparse-row form. The edges of node u are the entries
+// [offsets[u], offsets[u + 1]) of the targets, way_ids and weights arrays.
+struct adjacency {
+  int *offsets; // num_nodes + 1 start offsets into the edge arrays.
+  int *targets; // Node at the other end of each edge.
+  int *way_ids; // Way that each edge belongs to.
+  double *weights; // Travel time along each edge, in minutes.
+  double *lengths; // Great-circle length of each edge, in metres.
+  int num_edges; // Total number of edges.
 };
 
-// Used within the min_heap to associate a node with its current shortest distance from the start node.
-typedef struct {
-  int node_id; // Identifier for the node this entry corresponds to.
-  double distance; // Current shortest distance from the start node to this node.
-} heap_node;
+// An edge of a contraction hierarchy. A shortcut remembers the two edges it replaces.
+struct ch_edge {
+  int from; // Node the edge starts at.
+  int to; // Node the edge ends at.
+  double weight; // Travel time along the edge, in minutes.
+  int children[2]; // For a shortcut, the edges to and from the contracted middle node; -1 for a road segment.
+};
 
-// A min-heap (priority queue) structure used to efficiently select the next node to process based on distance.
-typedef struct {
-  heap_node *elements; // Dynamic array of heap_node elements making up the heap.
-  int size; // Current number of elements in the heap.
-  int capacity; // Maximum number of elements the heap can contain.
-} min_heap;
+// A contraction hierarchy, built by ssmap_contract.
+struct hierarchy {
+  int *rank; // Position of every node in the contraction order.
+  struct ch_edge *edges; // Road segments and shortcuts.
+  int num_edges; // Number of entries in 'edges'.
+  int num_shortcuts; // Number of edges that are shortcuts.
+  struct adjacency up; // Per node, the edges leading to higher-ranked nodes; way_ids holds the edge ids.
+  struct adjacency down; // Per node, the edges coming from higher-ranked nodes; way_ids holds the edge ids.
+};
 
+// An inverted index from the trigrams of way names (every run of three consecutive bytes) to
+// the ways whose names contain them.
+struct name_index {
+  uint32_t *grams; // The distinct trigrams in ascending order, each packed into the low 24 bits.
+  int *offsets; // num_grams + 1 offsets into 'ways'; grams[g] occurs in ways[offsets[g] .. offsets[g + 1]).
+  int *ways; // The posting lists: way ids, ascending within each list.
+  int num_grams; // Number of distinct trigrams.
+};
 
-/**
- * Creates a new min_heap with a specified capacity.
- *
- * @param capacity The maximum number of elements the heap can hold.
- * @return A pointer to the newly created min_heap structure.
- *
- * This function dynamically allocates memory for a min_heap structure and its array of elements,
- * initializing the size to 0 and setting its capacity to the specified value. The function returns
- * a pointer to the allocated min_heap. If memory allocation fails at any step, the function will
- * return NULL to indicate failure.
- */
- min_heap* create_min_heap(int capacity) {
-     // Allocate memory for the min_heap structure itself.
-     min_heap *heap = (min_heap *)malloc(sizeof(min_heap)); // Changed variable name to 'heap'
-     if (heap == NULL) {
-         return NULL;
-     }
-     // Allocate memory for the array of heap_node elements within the min_heap.
-     heap->elements = (heap_node *)malloc(sizeof(heap_node) * capacity);
-     if (heap->elements == NULL) {
-         free(heap);
-         return NULL;
-     }
-     // Initialize the size of the heap to 0, indicating it's currently empty.
-     heap->size = 0;
-     // Set the capacity of the heap to the specified value.
-     heap->capacity = capacity;
-     // Return a pointer to the successfully created min_heap structure.
-     return heap;
- }
+// For every way, the nodes that list it among their ways, and the subset of them at which it
+// meets a different way: its junctions. Both are in CSR form, with node ids ascending.
+struct junction_index {
+  int *node_offsets; // num_ways + 1 offsets into 'nodes'.
+  int *nodes; // The nodes of each way.
+  int *junction_offsets; // num_ways + 1 offsets into 'junctions'.
+  int *junctions; // The junctions of each way.
+};
 
-/**
- * Swaps two heap_node elements in the min_heap.
- *
- * @param a Pointer to the first heap_node to be swapped.
- * @param b Pointer to the second heap_node to be swapped.
- *
- * This function performs a swap operation between two heap_node elements. It's used to maintain
- * the min-heap property during heap operations such as insertion, deletion, and key decrease.
- * The swap is done by copying the contents of one node to a temporary node, then copying
- * the contents of the second node to the first, and finally copying the contents of the
- * temporary node to the second. This ensures that the actual nodes in the heap are swapped,
- * not just their distances or node IDs.
- */
-void swap_heap_node(heap_node* a, heap_node* b) {
-    // Temporary storage to hold the contents of the first node
-    heap_node t = *a;
-    // Copy the contents of the second node to the first node
-    *a = *b;
-    // Copy the contents of the temporary storage (originally the first node) to the second node
-    *b = t;
+// A k-d tree over the node positions in xyz. The tree is implicit in the order of 'nodes': the
+// subtree over entries [lo, hi) has its root at mid = lo + (hi - lo) / 2 and is split along
+// coordinate axis[mid], with the entries before mid no farther along it than the root, and
+// those after it no nearer.
+struct kd_tree {
+  int *nodes; // Ids of all existing nodes, arranged as above.
+  unsigned char *axis; // Per entry, the coordinate (0, 1 or 2) its subtree is split along.
+  int size; // Number of entries.
+};
 
-}
+// A spatial index of the road segments, the stretches of way between two consecutive nodes. It
+// is a k-d tree over the midpoints of the segments, arranged like struct kd_tree.
+struct segment_index {
+  int *from; // Per segment, the node it starts at, in the order of its way.
+  int *to; // Per segment, the node it ends at.
+  int *ways; // Per segment, the way it is part of.
+  int num_segments; // Number of segments.
+  struct kd_tree tree; // The segment numbers, arranged by midpoint.
+  double *reach; // Per tree entry, the largest half-length of any segment in its subtree, in km.
+};
 
-/**
- * Maintains the min-heap property of a given subtree in the min_heap data structure.
- *
- * @param min_heap Pointer to the min_heap structure.
- * @param idx Index of the root node of the subtree within the heap's array to be heapified.
- *
- * This function ensures that the subtree rooted at the given index adheres to the min-heap
- * property, where the key (distance in this context) of a parent node is less than or equal to
- * the keys of its children. It recursively adjusts parts of the heap that violate this property
- * by swapping nodes and heapifying the affected sub-trees.
- *
- * The function calculates the indices of the left and right children of the current node based
- * on the current node's index. It then compares the distances of these children to the distance
- * of the current node to find the smallest among the three. If the current node is not the smallest,
- * it swaps the current node with the smallest of its children and recursively applies the same
- * process to the subtree rooted at the new position of the swapped node.
- */
-void min_heapify(min_heap *min_heap, int idx) {
-    // Initialize indices for the current node, its left child, and its right child.
-    int smallest, left, right;
-    smallest = idx;
-    left = 2 * idx + 1;
-    right = 2 * idx + 2;
+// A growable array of ints.
+struct int_list {
+  int *items; // The elements.
+  int size; // Number of elements in use.
+  int capacity; // Number of elements allocated.
+};
 
-    // Check if the left child exists and is smaller than the current node.
-    if (left < min_heap->size && min_heap->elements[left].distance < min_heap->elements[smallest].distance) {
-        smallest = left; // Update smallest if the left child is smaller.
-    }
+// A chunk of memory that arena allocations are carved out of, front to back.
+struct arena_block {
+  struct arena_block *next; // Block that was in use before this one.
+  size_t size; // Number of bytes in 'data'.
+  size_t used; // Number of bytes handed out so far; may overshoot 'size' once the block is full.
+  char data[]; // The memory itself.
+};
 
-    // Check if the right child exists and is smaller than the current (or left child) node.
-    if (right < min_heap->size && min_heap->elements[right].distance < min_heap->elements[smallest].distance) {
-        smallest = right; // Update smallest if the right child is smaller.
-    }
+// A bump-pointer allocator. Everything allocated from it is freed at once by arena_free.
+struct arena {
+  struct arena_block *head; // Block that allocations are currently taken from, or NULL.
+  size_t block_size; // Size of the blocks to allocate.
+  pthread_mutex_t lock; // Held while a new block is added.
+};
 
-    // If the smallest node is not the current node, swap and heapify the affected subtree.
-    if (smallest != idx) {
-        swap_heap_node(&min_heap->elements[idx], &min_heap->elements[smallest]);
-        min_heapify(min_heap, smallest); // Recursively apply min_heapify to the subtree affected by the swap.
-    }
+// Represents the entire map, consisting of nodes and ways.
+struct ssmap {
+  struct node **nodes; // Array of pointers to 'node' structures in the map.
+  struct way **ways; // Array of pointers to 'way' structures in the map.
+  int num_nodes; // Total number of nodes in the map.
+  int num_ways; // Total number of ways in the map.
+  float max_speed; // Highest speed limit of any way, used by the A* heuristic.
+  double *xyz; // Position of every node on a sphere of the earth's radius, 3 coordinates per node, in km.
+  struct adjacency forward; // Edges in driving direction, built by ssmap_initialize.
+  struct adjacency reverse; // The same edges reversed: targets are the nodes they come from.
+  struct hierarchy *hierarchy; // Contraction hierarchy built by ssmap_contract, or NULL.
+  struct name_index names; // Trigram index of the way names, built by ssmap_initialize.
+  struct junction_index junctions; // Nodes and junctions of every way, built by ssmap_initialize.
+  struct kd_tree kd; // Spatial index of the nodes, built by ssmap_initialize.
+  struct segment_index segments; // Spatial index of the road segments, built by ssmap_initialize.
+  char *snapshot; // Mapping of the snapshot the map was loaded from, or NULL.
+  size_t snapshot_size; // Length of the mapping.
+  struct arena node_arena; // Storage of all nodes and their arrays of way pointers.
+  struct arena way_arena; // Storage of all ways, their names and their arrays of node ids.
+};
+
+// Workspace for route queries. Entries of the per-node arrays only count if their stamp equals
+// the current generation, so starting a new query does not have to reset them.
+struct ssmap_query_ctx {
+  int capacity; // Number of nodes the arrays have room for.
+  unsigned generation; // Stamp of the current query.
+  double *dist[2]; // Per search direction, the distance of each node from that search's origin.
+  int *parent[2]; // Per search direction, the node (or hierarchy edge) each node was reached from.
+  unsigned *labelled[2]; // Per search direction, the generation in which dist and parent were set.
+  unsigned *settled[2]; // Per search direction, the generation in which each node was settled.
+  enum ssmap_queue queue; // Kind of priority queue used for the frontiers.
+  min_heap *heap[2]; // Per search direction, the frontier, with SSMAP_QUEUE_BINARY_HEAP.
+  radix_heap *radix[2]; // Per search direction, the frontier, with SSMAP_QUEUE_RADIX_HEAP.
+  int *path; // The nodes of the path found.
+  int *edges; // Scratch space for the hierarchy edges of a path.
+  int *stack; // Scratch space for unpacking hierarchy edges.
+  int num_settled; // Number of nodes settled by the current route query.
+};
 
-}
 
 /**
- * Extracts and returns the minimum element from the min_heap.
- *
- * @param min_heap Pointer to the min_heap structure from which to extract the minimum element.
- * @return The heap_node representing the minimum element in the heap. If the heap is empty,
- *         returns a heap_node with an ID of -1 and a distance of 0 as an indication of failure.
+ * Converts from degree to radian
  *
- * This function removes the root of the min_heap, which is the minimum element due to the
- * min-heap property, and returns it. To maintain the min-heap property after removal,
- * it places the last element of the heap at the root position and then applies the
- * min_heapify function to restructure the heap. This ensures that the structure remains
- * a valid min-heap after the minimum element's extraction.
+ * @param deg The angle in degrees.
+ * @return the equivalent value in radian
  */
-heap_node extract_min(min_heap *min_heap) {
-    // Check if the heap is empty; if so, return a default heap_node indicating failure.
-    if (min_heap->size == 0) {
-        return (heap_node){-1, 0}; // Use -1 as an invalid node_id and 0 as the distance.
-    }
-
-    // Store the root of the heap (the minimum element) to return it later.
-    heap_node root = min_heap->elements[0];
-
-    // Move the last element in the heap to the root position.
-    min_heap->elements[0] = min_heap->elements[min_heap->size - 1];
-
-    // Decrease the heap's size since the minimum element is being removed.
-    min_heap->size--;
-
-    // Reapply the min-heap property starting from the new root.
-    min_heapify(min_heap, 0);
-
-    // Return the originally stored root, which is the minimum element.
-    return root;
-
-}
+#define d2r(deg) ((deg) * M_PI/180.)
 
 /**
- * Decreases the distance value for a specified node in the min_heap and restructures
- * the heap if necessary to maintain the min-heap property.
- *
- * @param min_heap Pointer to the min_heap structure.
- * @param node_id The identifier of the node for which the distance value is to be decreased.
- * @param distance The new distance value for the node, which is assumed to be less than
- *        the node's current distance value.
+ * Calculates the distance between two nodes using the Haversine formula.
  *
- * This function first locates the node with the given node_id within the heap. Once found,
- * it updates the node's distance to the new, lower value. To maintain the min-heap property
- * (where the parent node's distance is always less than or equal to its children's distances),
- * the function then iteratively swaps the updated node with its parent node as long as the
- * updated node's distance is less than its parent's distance. This process continues until
- * the node reaches a position where the min-heap property is restored.
+ * @param x The first node.
+ * @param y the second node.
+ * @return the distance between two nodes, in kilometre.
  */
-void decrease_key(min_heap *min_heap, int node_id, double distance) {
-    // Loop through the heap to find the node with the specified node_id.
-    for (int i = 0; i < min_heap->size; i++) {
-        if (min_heap->elements[i].node_id == node_id) {
-            // Once found, update the node's distance to the new, decreased value.
-            min_heap->elements[i].distance = distance;
-
-            // Move the node up the heap to its correct position to maintain the min-heap property.
-            // This is done by comparing and potentially swapping the node with its parent.
-            while (i != 0 && min_heap->elements[(i - 1) / 2].distance > min_heap->elements[i].distance) {
-                // Swap the current node with its parent if the current node's distance is smaller.
-                swap_heap_node(&min_heap->elements[i], &min_heap->elements[(i - 1) / 2]);
-
-                // Update the index 'i' to the parent's index after swapping.
-                i = (i - 1) / 2;
-            }
-            break; // Exit the loop after updating the node's distance and repositioning it in the heap.
-        }
-    }
-
+static double
+distance_between_nodes(const struct node * x, const struct node * y) {
+    double R = 6371.;
+    double lat1 = x->lat;
+    double lon1 = x->lon;
+    double lat2 = y->lat;
+    double lon2 = y->lon;
+    double dlat = d2r(lat2-lat1);
+    double dlon = d2r(lon2-lon1);
+    double a = pow(sin(dlat/2), 2) + cos(d2r(lat1)) * cos(d2r(lat2)) * pow(sin(dlon/2), 2);
+    double c = 2 * atan2(sqrt(a), sqrt(1-a));
+    return R * c;
 }
 
-/**
- * Checks whether a node is present in the min_heap.
- *
- * @param min_heap Pointer to the min_heap structure to be searched.
- * @param node_id The identifier of the node to search for within the min_heap.
- * @return A boolean value indicating whether the node is found in the min_heap.
- *         Returns true if the node is found; otherwise, returns false.
- *
- * This function iterates over all elements in the min_heap's elements array, comparing
- * each element's node_id with the specified node_id. The search continues until either
- * the node is found (in which case true is returned) or all elements have been checked
- * (resulting in false being returned if the node is not found). This function is useful
- * for determining whether to insert a new node into the min_heap or to update an existing
- * node's distance value using the decrease_key function.
- */
-bool is_in_min_heap(min_heap *min_heap, int node_id) {
-    // Loop through all the nodes currently in the min_heap.
-    for (int i = 0; i < min_heap->size; i++) {
-        // Check if the current node's ID matches the specified node_id.
-        if (min_heap->elements[i].node_id == node_id) {
-            // If a match is found, return true to indicate the node is in the min_heap.
-            return true;
-        }
-    }
-    // If no match is found after checking all nodes, return false.
-    return false;
+// Smallest block an arena allocates, in bytes.
+#define ARENA_MIN_BLOCK 4096
 
-}
+// Guesses at the average storage of a way's name and node list and of a node's way list, used
+// to size the arenas from the counts given to ssmap_create.
+#define ARENA_NAME_BYTES 24
+#define ARENA_NODES_PER_WAY 16
+#define ARENA_WAYS_PER_NODE 2
 
 /**
- * Inserts a new node into the min_heap with a given distance.
+ * Prepares an empty arena.
  *
- * @param min_heap Pointer to the min_heap structure where the new node will be inserted.
- * @param node_id The identifier of the node to be inserted.
- * @param distance The distance value associated with the node, used as the key for heap insertion.
+ * @param a Pointer to the arena to be initialized.
+ * @param block_size The size of each block the arena allocates, in bytes. Allocations larger
+ *        than this get a block of their own.
  *
- * This function inserts a new node into the min_heap while maintaining the min-heap property,
- * which requires that every parent node's distance is less than or equal to the distances of its children.
- * If the heap is already at full capacity, the function will not insert the new node. After insertion,
- * the function ensures the min-heap property is maintained by adjusting the position of the newly inserted
- * node as necessary through a series of swaps with its parent nodes.
+ * No memory is allocated until the first call to arena_alloc.
  */
-void insert_min_heap(min_heap *min_heap, int node_id, double distance) {
-    // Check if the heap has reached its maximum capacity.
-    if (min_heap->size == min_heap->capacity) {
-        // If the heap is full, do not insert the new node and return early.
-        return;
-    }
-
-    // Increase the size of the heap to accommodate the new node.
-    min_heap->size++;
-    // Calculate the index where the new node will be placed (at the end of the heap).
-    int i = min_heap->size - 1;
-
-    // Initialize the new node at the calculated position with the given node_id and distance.
-    min_heap->elements[i].node_id = node_id;
-    min_heap->elements[i].distance = distance;
-
-    // Fix the min-heap property if it is violated due to the insertion of the new node.
-    // This is done by comparing the new node's distance with its parent's distance and
-    // swapping them if the parent's distance is greater, thereby moving the new node up the heap.
-    while (i != 0 && min_heap->elements[(i - 1) / 2].distance > min_heap->elements[i].distance) {
-
-        // Swap the new node with its parent.
-        swap_heap_node(&min_heap->elements[i], &min_heap->elements[(i - 1) / 2]);
-
-        // Update the index 'i' to that of the parent after the swap, and repeat the process
-        // until the new node is in the correct position or it becomes the root of the heap.
-        i = (i - 1) / 2;
-    }
-
+static void
+arena_init(struct arena *a, size_t block_size)
+{
+    a->head = NULL;
+    a->block_size = block_size < ARENA_MIN_BLOCK ? ARENA_MIN_BLOCK : block_size;
+    pthread_mutex_init(&a->lock, NULL);
 }
 
 /**
- * Searches for a specific node within a way and returns its index.
+ * Carves a piece of memory out of an arena.
  *
- * @param way Pointer to the 'way' structure in which to search for the node.
- * @param node_id The identifier of the node to search for within the way.
- * @return The index of the node within the way's node_ids array if found;
- *         otherwise, returns -1 to indicate that the node is not part of the way.
+ * @param a Pointer to the arena.
+ * @param size The number of bytes needed.
+ * @return A pointer to size bytes aligned to 8 bytes, or NULL if a new block could not be allocated.
  *
- * This function iterates through the array of node IDs in the specified way to find
- * a node with the given node_id. It's used to determine the position of a node within
- * a way, which is essential for understanding the connectivity and traversal possibilities
- * within the map, especially when dealing with adjacency in pathfinding algorithms.
+ * This function bumps the offset of the current block with an atomic add, so several threads
+ * can allocate from the same arena at once. Only when the current block runs out does a thread
+ * take the arena's lock to put a new block in front. The memory is never freed individually; it
+ * is released all at once by arena_free.
  */
-int find_node_index_in_way(const struct way *way, int node_id) {
-    // Loop through all nodes in the way's node_ids array.
-    for (int i = 0; i < way->num_nodes; ++i) {
-        // Check if the current node's ID matches the specified node_id.
-        if (way->node_ids[i] == node_id) {
-            // If a match is found, return the current index.
-            return i;
+static void *
+arena_alloc(struct arena *a, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+
+    while (true) {
+        struct arena_block *block = __atomic_load_n(&a->head, __ATOMIC_ACQUIRE);
+        if (block != NULL) {
+            size_t offset = __atomic_fetch_add(&block->used, size, __ATOMIC_RELAXED);
+            if (offset + size <= block->size) {
+                return block->data + offset;
+            }
         }
-    }
-    // If no match is found after checking all nodes, return -1 to indicate failure.
-    return -1;
 
+        // The block is full. Unless another thread has already replaced it, add a new one.
+        pthread_mutex_lock(&a->lock);
+        if (a->head == block) {
+            size_t block_size = size > a->block_size ? size : a->block_size;
+            struct arena_block *fresh = malloc(sizeof(struct arena_block) + block_size);
+            if (fresh == NULL) {
+                pthread_mutex_unlock(&a->lock);
+                return NULL;
+            }
+            fresh->next = block;
+            fresh->size = block_size;
+            fresh->used = 0;
+            __atomic_store_n(&a->head, fresh, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
 }
 
 /**
- * Frees the memory allocated for a min_heap structure.
+ * Frees every block of an arena, and with them everything allocated from it.
  *
- * @param min_heap Pointer to the min_heap structure to be freed.
- *
- * This function ensures that all memory allocated for the min_heap, including its
- * elements array, is properly freed. It's crucial to call this function to avoid
- * memory leaks once the min_heap is no longer needed.
+ * @param a Pointer to the arena. The structure itself is not freed.
  */
-void free_min_heap(min_heap *min_heap) {
-    if (min_heap != NULL) {
-        // Free the elements array if it's not NULL.
-        if (min_heap->elements != NULL) {
-            free(min_heap->elements);
-            min_heap->elements = NULL; // Set to NULL to avoid dangling pointer.
-        }
-        // Free the min_heap structure itself.
-        free(min_heap);
-        min_heap = NULL; // Set to NULL to avoid dangling pointer.
+static void
+arena_free(struct arena *a)
+{
+    while (a->head != NULL) {
+        struct arena_block *next = a->head->next;
+        free(a->head);
+        a->head = next;
     }
+    pthread_mutex_destroy(&a->lock);
 }
 
 /**
@@ -368,15 +306,16 @@ ssmap_create(int nr_nodes, int nr_ways)
         return NULL;
     }
 
-    // Allocate memory for the array of pointers to 'way' structures.
-    map->ways = malloc(nr_ways * sizeof(struct way *));
+    // Allocate memory for the array of pointers to 'way' structures. Slots start out NULL
+    // until the way is added.
+    map->ways = calloc(nr_ways, sizeof(struct way *));
     if (map->ways == NULL) {
         free(map);
         return NULL;
     }
 
     // Allocate memory for the array of pointers to 'node' structures.
-    map->nodes = malloc(nr_nodes * sizeof(struct node *));
+    map->nodes = calloc(nr_nodes, sizeof(struct node *));
     if (map->nodes == NULL) {
         free(map->ways);
         free(map);
@@ -386,6 +325,26 @@ ssmap_create(int nr_nodes, int nr_ways)
     // Set the number of nodes and ways in the map to the specified values.
     map->num_nodes = nr_nodes;
     map->num_ways = nr_ways;
+    map->max_speed = 0;
+
+    // The adjacency and node positions are only built by ssmap_initialize.
+    map->xyz = NULL;
+    map->hierarchy = NULL;
+    map->snapshot = NULL;
+    map->snapshot_size = 0;
+    memset(&map->forward, 0, sizeof(map->forward));
+    memset(&map->reverse, 0, sizeof(map->reverse));
+    memset(&map->names, 0, sizeof(map->names));
+    memset(&map->junctions, 0, sizeof(map->junctions));
+    memset(&map->kd, 0, sizeof(map->kd));
+    memset(&map->segments, 0, sizeof(map->segments));
+
+    // Size the arenas so that a typical map fits in one block each. Untouched parts of a large
+    // block are never paged in, so overestimating costs little.
+    arena_init(&map->node_arena, nr_nodes * (sizeof(struct node) +
+                                             ARENA_WAYS_PER_NODE * sizeof(struct way *)));
+    arena_init(&map->way_arena, nr_ways * (sizeof(struct way) + ARENA_NAME_BYTES +
+                                           ARENA_NODES_PER_WAY * sizeof(int)));
 
     // Return a pointer to the successfully created ssmap structure.
     return map;
@@ -393,748 +352,4429 @@ ssmap_create(int nr_nodes, int nr_ways)
 }
 
 /**
- * Performs additional initialization tasks for a Simple Street Map (ssmap) structure.
+ * Allocates the arrays of a CSR adjacency.
  *
- * @param m Pointer to the ssmap structure to be further initialized.
- * @return A boolean value indicating the success of the initialization process.
- *         Returns true if initialization is successful, and false if there are any issues.
+ * @param adj Pointer to the adjacency whose arrays should be allocated.
+ * @param num_nodes The number of nodes in the graph.
+ * @param num_edges The number of edges in the graph.
+ * @return true if all allocations succeeded, false otherwise.
  *
- * This function is designed to perform any additional initialization logic required for
- * the ssmap structure after its basic setup. This might include setting up data structures,
- * pre-computing values, or any other initialization tasks that are necessary before the map
- * can be used. The current implementation returns true to indicate success, but this function
- * can be expanded to include actual initialization logic as needed. If during the initialization
- * any issue is encountered (e.g., out of memory), the function should return false.
+ * On failure, arrays that were allocated are left in place; free_adjacency releases them.
+ */
+static bool
+alloc_adjacency(struct adjacency *adj, int num_nodes, int num_edges)
+{
+    adj->num_edges = num_edges;
+    adj->offsets = calloc(num_nodes + 1, sizeof(int));
+    // Allocate at least one element so that an empty graph is not mistaken for a failure.
+    adj->targets = malloc((num_edges + 1) * sizeof(int));
+    adj->way_ids = malloc((num_edges + 1) * sizeof(int));
+    adj->weights = malloc((num_edges + 1) * sizeof(double));
+    adj->lengths = malloc((num_edges + 1) * sizeof(double));
+    return adj->offsets != NULL && adj->targets != NULL && adj->way_ids != NULL &&
+           adj->weights != NULL && adj->lengths != NULL;
+}
+
+/**
+ * Frees the arrays of a CSR adjacency.
  *
+ * @param adj Pointer to the adjacency to be freed. The structure itself is not freed.
  */
-bool
-ssmap_initialize(struct ssmap * m)
+static void
+free_adjacency(struct adjacency *adj)
 {
-    // Currently, there's no additional initialization logic, so return true.
-    return true;
+    free(adj->offsets);
+    free(adj->targets);
+    free(adj->way_ids);
+    free(adj->weights);
+    free(adj->lengths);
+    memset(adj, 0, sizeof(*adj));
+}
 
+/**
+ * Frees a contraction hierarchy.
+ *
+ * @param h Pointer to the hierarchy to be freed, or NULL.
+ */
+static void
+free_hierarchy(struct hierarchy *h)
+{
+    if (h != NULL) {
+        free(h->rank);
+        free(h->edges);
+        free_adjacency(&h->up);
+        free_adjacency(&h->down);
+        free(h);
+    }
 }
 
 /**
- * Frees all memory allocated for a Simple Street Map (ssmap) structure and its components.
+ * Calls a visitor for every edge leaving a node, in the order in which routing relaxes them.
  *
- * @param m Pointer to the ssmap structure to be destroyed.
+ * @param m Pointer to the ssmap structure.
+ * @param u The node whose outgoing edges are visited.
+ * @param visit Callback receiving the node, the edge's target, its way and a user pointer.
+ * @param arg User pointer passed through to the callback.
+ * @return false if a way refers to a node that does not exist, true otherwise.
  *
- * This function is responsible for properly freeing all dynamically allocated memory associated
- * with the ssmap structure, including memory for nodes, ways, and their respective components.
- * It iterates through the arrays of nodes and ways, freeing each individual node and way, along
- * with their dynamically allocated members, before finally freeing the arrays themselves and the
- * ssmap structure. This cleanup helps prevent memory leaks and ensures that the resources are
- * properly returned to the system upon the map's disposal.
+ * An edge leads from u to its predecessor in a way (unless the way is one-way) and to its
+ * successor in the way. Ways are visited in the order listed by the node, and every position at
+ * which u occurs in a way contributes its edges. Edges from a node to itself are skipped.
  */
-void
-ssmap_destroy(struct ssmap * m)
+static bool
+for_each_out_edge(const struct ssmap *m, int u,
+                  void (*visit)(int u, int v, const struct way *way, void *arg), void *arg)
 {
-    // Check if the nodes array is not NULL to avoid dereferencing a NULL pointer.
-    if (m->nodes != NULL) {
-        // Iterate through each node in the nodes array.
-        for (int i = 0; i < m->num_nodes; i++) {
-            struct node *current_node = m->nodes[i];
-            // Ensure the current node is not NULL before attempting to free.
-            if (current_node != NULL) {
-                // Free the ways array associated with the current node.
-                free(current_node->ways);
-                // Free the current node itself.
-                free(current_node);
-            }
+    const struct node *node = m->nodes[u];
+
+    for (int i = 0; i < node->num_ways; i++) {
+        const struct way *way = node->ways[i];
+        if (way == NULL) {
+            continue;
         }
-        // After all nodes have been processed, free the nodes array.
-        free(m->nodes);
-    }
 
-    // Repeat a similar process for the ways array.
-    if (m->ways != NULL) {
-        // Iterate through each way in the ways array.
-        for (int i = 0; i < m->num_ways; i++) {
-          struct way *current_way = m->ways[i];
-          // Ensure the current way is not NULL before attempting to free.
-          if (current_way != NULL) {
-            // Free the node_ids array associated with the current way.
-            free(current_way->node_ids);
-            // Free the dynamically allocated name.
-            free(current_way->name);
-            // Free the current way itself.
-            free(current_way);
-          }
+        for (int j = 0; j < way->num_nodes; j++) {
+            if (way->node_ids[j] != u) {
+                continue;
+            }
+
+            // Check both directions; the predecessor is unreachable on a one-way street.
+            for (int offset = -1; offset <= 1; offset += 2) {
+                int k = j + offset;
+                if (k < 0 || k >= way->num_nodes || (way->one_way && offset < 0)) {
+                    continue;
+                }
+
+                int v = way->node_ids[k];
+                if (v < 0 || v >= m->num_nodes || m->nodes[v] == NULL) {
+                    return false;
+                }
+                if (v != u) {
+                    visit(u, v, way, arg);
+                }
+            }
         }
-        // After all ways have been processed, free the ways array.
-        free(m->ways);
     }
 
-    // Finally, free the ssmap structure itself.
-    free(m);
+    return true;
+}
+
+// Visitor for for_each_out_edge that only counts the edges of a node.
+static void
+count_edge(int u, int v, const struct way *way, void *arg)
+{
+    (*(int *)arg)++;
+}
 
+// Visitor for for_each_out_edge that appends the edge to the forward adjacency.
+static void
+store_edge(int u, int v, const struct way *way, void *arg)
+{
+    struct ssmap *m = arg;
+    struct adjacency *adj = &m->forward;
+    int e = adj->offsets[u + 1]++;
+    double distance = distance_between_nodes(m->nodes[u], m->nodes[v]);
+
+    adj->targets[e] = v;
+    adj->way_ids[e] = way->id;
+    adj->weights[e] = distance / way->max_speed * 60;
+    adj->lengths[e] = distance * 1000;
 }
 
 /**
- * Adds a new way to the Simple Street Map (ssmap) structure.
+ * Builds the forward and reverse CSR adjacency of the map.
  *
- * @param m Pointer to the ssmap structure where the new way will be added.
- * @param id Unique identifier for the new way.
- * @param name Name of the new way. If the way is unnamed, this should be an empty string or a placeholder.
- * @param maxspeed Maximum legal speed on the new way, in the unit specified by the map's convention (e.g., km/h).
- * @param oneway Boolean flag indicating if the new way is one-way (true) or two-way (false).
- * @param num_nodes Number of nodes that make up the new way.
- * @param node_ids Array of node IDs that constitute the way, ordered from start to end.
- * @return A pointer to the newly created way structure, or NULL if the creation fails.
+ * @param m Pointer to the ssmap structure whose nodes and ways have all been added.
+ * @return true on success, false if memory runs out or a way refers to a missing node.
  *
- * This function creates and initializes a new way structure with the specified properties,
- * including its connectivity (nodes that make up the way). It dynamically allocates memory
- * for the new way and its array of node IDs. After successful creation, the new way is added
- * to the ssmap's array of ways using the way's ID as the index. If any memory allocation fails,
- * the function ensures to clean up any allocated memory before returning NULL to prevent leaks.
+ * The forward adjacency is filled in two passes over for_each_out_edge: the first counts the
+ * edges of every node to compute the offsets, the second stores the target, way, length and
+ * travel time of each edge. This is the only place where edge lengths are computed with the
+ * haversine formula; queries only read the stored values. The reverse adjacency is its
+ * transpose, computed with a counting sort on the edge targets, so the incoming edges of a node
+ * keep the order of their sources.
  */
-struct way *
-ssmap_add_way(struct ssmap * m, int id, const char * name, float maxspeed, bool oneway,
-              int num_nodes, const int node_ids[num_nodes])
+static bool
+build_adjacency(struct ssmap *m)
 {
-    // Allocate memory for the new way structure.
-    struct way *new_way = malloc(sizeof(struct way));
-    if (new_way == NULL) {
-        // If memory allocation fails, return NULL.
-        return NULL;
+    struct adjacency *fwd = &m->forward;
+    struct adjacency *rev = &m->reverse;
+    int num_edges = 0;
+
+    // First pass: count the edges of every node.
+    for (int u = 0; u < m->num_nodes; u++) {
+        if (m->nodes[u] != NULL && !for_each_out_edge(m, u, count_edge, &num_edges)) {
+            return false;
+        }
     }
 
-    // Initialize the new way's properties.
-    new_way->id = id;
-
-    // Dynamically allocate memory for the name and copy it.
-    new_way->name = malloc(strlen(name) + 1); // Plus one for null terminator
-    if (new_way->name == NULL) {
-        // If memory allocation for name fails, clean up and return NULL.
-        free(new_way); // Only need to free new_way since name allocation failed.
-        return NULL;
+    if (!alloc_adjacency(fwd, m->num_nodes, num_edges) ||
+        !alloc_adjacency(rev, m->num_nodes, num_edges)) {
+        return false;
     }
-    strcpy(new_way->name, name); // Safe to use strcpy as memory is allocated based on name length.
 
-    new_way->max_speed = maxspeed;
-    new_way->one_way = oneway;
-    new_way->num_nodes = num_nodes;
+    // Second pass: offsets[u + 1] serves as the insertion cursor of node u while storing, and
+    // ends up as the start of node u + 1 once node u is complete.
+    for (int u = 0; u < m->num_nodes; u++) {
+        fwd->offsets[u + 1] = fwd->offsets[u];
+        if (m->nodes[u] != NULL) {
+            for_each_out_edge(m, u, store_edge, m);
+        }
+    }
 
-    // Allocate memory for the array of node IDs that make up the new way.
-    new_way->node_ids = malloc(num_nodes * sizeof(int));
-    if (new_way->node_ids == NULL) {
-        // If memory allocation for node IDs fails, clean up and return NULL.
-        free(new_way->name);
-        free(new_way); // Need to free both new_way and name as they were successfully allocated.
-        return NULL;
+    // Transpose: count the incoming edges of every node, then place each edge at its target.
+    for (int e = 0; e < num_edges; e++) {
+        rev->offsets[fwd->targets[e] + 1]++;
+    }
+    for (int v = 0; v < m->num_nodes; v++) {
+        rev->offsets[v + 1] += rev->offsets[v];
+    }
+    for (int u = 0; u < m->num_nodes; u++) {
+        for (int e = fwd->offsets[u]; e < fwd->offsets[u + 1]; e++) {
+            int v = fwd->targets[e];
+            // The cursor of v is its start offset plus the number of edges placed so far,
+            // which is tracked by temporarily advancing offsets[v].
+            int r = rev->offsets[v]++;
+            rev->targets[r] = u;
+            rev->way_ids[r] = fwd->way_ids[e];
+            rev->weights[r] = fwd->weights[e];
+            rev->lengths[r] = fwd->lengths[e];
+        }
+    }
+    // Every offsets[v] was advanced to the start of v + 1; shift them back into place.
+    for (int v = m->num_nodes; v > 0; v--) {
+        rev->offsets[v] = rev->offsets[v - 1];
     }
+    rev->offsets[0] = 0;
 
-    // Copy the provided node IDs to the new way's node_ids array.
-    memcpy(new_way->node_ids, node_ids, num_nodes * sizeof(int));
+    return true;
+}
 
-    // Add the new way to the ssmap's array of ways.
-    m->ways[id] = new_way;
+// Packs the three bytes starting at s into a trigram key.
+#define TRIGRAM(s) ((uint32_t)(unsigned char)(s)[0] << 16 | (uint32_t)(unsigned char)(s)[1] << 8 | \
+                    (uint32_t)(unsigned char)(s)[2])
 
-    // Return a pointer to the successfully created and added new way.
-    return new_way;
+// Most posting lists find_ways intersects for one keyword.
+#define FIND_MAX_LISTS 16
 
+/**
+ * Frees the arrays of a trigram index.
+ *
+ * @param index Pointer to the index. The structure itself is not freed.
+ */
+static void
+free_name_index(struct name_index *index)
+{
+    free(index->grams);
+    free(index->offsets);
+    free(index->ways);
+    memset(index, 0, sizeof(*index));
 }
 
 /**
- * Adds a new node to the Simple Street Map (ssmap) structure.
+ * Builds the trigram index of the way names.
  *
- * @param m Pointer to the ssmap structure to which the node will be added.
- * @param id The unique identifier for the new node.
- * @param lat The latitude coordinate of the new node.
- * @param lon The longitude coordinate of the new node.
- * @param num_ways The number of ways (roads) that the new node is connected to.
- * @param way_ids Array containing the identifiers of the ways that the new node is connected to.
- * @return A pointer to the newly created node structure, or NULL if the node could not be created.
+ * @param m Pointer to the ssmap structure whose ways have all been added.
+ * @return true on success, false if memory runs out.
  *
- * This function dynamically allocates memory for a new node and initializes it with the
- * provided details, including its location (latitude and longitude), connections to ways,
- * and its unique identifier. It also links the node to its associated ways based on the provided
- * way_ids array. If successful, the new node is added to the ssmap structure and a pointer to the
- * node is returned. If any memory allocation fails, the function cleans up any allocated resources
- * and returns NULL.
+ * Every trigram of every name is paired with the way's id in one 64-bit key, trigram in the high
+ * half. The pairs are generated in order of way id, so a stable sort by trigram alone groups them
+ * into posting lists, one per distinct trigram, each listing its ways in ascending order. The
+ * trigrams are 24 bits, which a radix sort handles in three passes of one byte each, so the whole
+ * build takes O(L) time for L bytes of names. The index takes about 4 bytes per name byte.
  */
-struct node *
-ssmap_add_node(struct ssmap * m, int id, double lat, double lon,
-               int num_ways, const int way_ids[num_ways])
+static bool
+build_name_index(struct ssmap *m)
 {
-    // Check if the ssmap structure is NULL, indicating an invalid map.
-    if (m == NULL) {
-        return NULL;
+    struct name_index *index = &m->names;
+    size_t count = 0;
+    for (int i = 0; i < m->num_ways; i++) {
+        size_t length = m->ways[i] != NULL ? strlen(m->ways[i]->name) : 0;
+        count += length > 2 ? length - 2 : 0;
     }
 
-    // Dynamically allocate memory for the new node.
-    struct node *new_node = malloc(sizeof(struct node));
-    if (new_node == NULL) { // Check for successful memory allocation.
-        return NULL;
+    uint64_t *pairs = malloc((count + 1) * sizeof(uint64_t));
+    uint64_t *sorted = malloc((count + 1) * sizeof(uint64_t));
+    if (pairs == NULL || sorted == NULL) {
+        free(pairs);
+        free(sorted);
+        return false;
     }
-
-    // Initialize the new node with the provided parameters.
-    new_node->id = id;
-    new_node->lat = lat;
-    new_node->lon = lon;
-    new_node->num_ways = num_ways;
-
-    // Allocate memory for the array of pointers to the ways connected to this node.
-    new_node->ways = malloc(num_ways * sizeof(struct way *));
-    if (new_node->ways == NULL) { // Check for successful memory allocation.
-        free(new_node); // Clean up the previously allocated node memory.
-        return NULL;
+    size_t n = 0;
+    for (int i = 0; i < m->num_ways; i++) {
+        if (m->ways[i] == NULL) {
+            continue;
+        }
+        for (const char *p = m->ways[i]->name; p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++) {
+            pairs[n++] = (uint64_t)TRIGRAM(p) << 32 | (uint32_t)i;
+        }
     }
-
-    // Populate the ways array for the new node using the provided way_ids.
-    for (int i = 0; i < num_ways; i++) {
-        // Assign pointers to the actual way structures based on the provided way_ids.
-        new_node->ways[i] = m->ways[way_ids[i]];
+    for (int shift = 32; shift < 56; shift += 8) {
+        size_t start[257] = {0};
+        for (size_t k = 0; k < n; k++) {
+            start[(pairs[k] >> shift & 0xff) + 1]++;
+        }
+        for (int d = 0; d < 256; d++) {
+            start[d + 1] += start[d];
+        }
+        for (size_t k = 0; k < n; k++) {
+            sorted[start[pairs[k] >> shift & 0xff]++] = pairs[k];
+        }
+        uint64_t *t = pairs;
+        pairs = sorted;
+        sorted = t;
+    }
+    free(sorted);
+
+    // Drop the pairs repeated by names that contain a trigram more than once, and count the
+    // distinct trigrams.
+    size_t unique = 0;
+    int num_grams = 0;
+    for (size_t k = 0; k < n; k++) {
+        if (unique == 0 || pairs[k] != pairs[unique - 1]) {
+            num_grams += unique == 0 || pairs[k] >> 32 != pairs[unique - 1] >> 32;
+            pairs[unique++] = pairs[k];
+        }
     }
 
-    // Add the new node to the ssmap structure, using its ID as the index.
-    m->nodes[id] = new_node;
+    index->grams = malloc((num_grams + 1) * sizeof(uint32_t));
+    index->offsets = malloc((num_grams + 1) * sizeof(int));
+    index->ways = malloc((unique + 1) * sizeof(int));
+    if (index->grams == NULL || index->offsets == NULL || index->ways == NULL) {
+        free(pairs);
+        free_name_index(index);
+        return false;
+    }
 
-    // Return a pointer to the newly created node.
-    return new_node;
+    int g = 0;
+    for (size_t k = 0; k < unique; k++) {
+        uint32_t gram = pairs[k] >> 32;
+        if (k == 0 || gram != index->grams[g - 1]) {
+            index->grams[g] = gram;
+            index->offsets[g++] = k;
+        }
+        index->ways[k] = (int)(uint32_t)pairs[k];
+    }
+    index->offsets[g] = unique;
+    index->num_grams = num_grams;
 
+    free(pairs);
+    return true;
 }
 
 /**
- * Prints information about a specific way within the Simple Street Map (ssmap).
- *
- * @param m Pointer to the ssmap structure from which the way's information will be printed.
- * @param id The unique identifier of the way to be printed.
- *
- * This function looks up a way by its identifier within the provided ssmap structure
- * and prints its details, including its ID and name. If the specified way ID is out of range
- * or does not correspond to an existing way in the map, an error message is printed instead.
+ * Frees the arrays of a junction index.
  *
+ * @param index Pointer to the index. The structure itself is not freed.
  */
-void
-ssmap_print_way(const struct ssmap * m, int id)
+static void
+free_junction_index(struct junction_index *index)
+{
+    free(index->node_offsets);
+    free(index->nodes);
+    free(index->junction_offsets);
+    free(index->junctions);
+    memset(index, 0, sizeof(*index));
+}
+
+/**
+ * Tells whether a position in a node's list of ways holds a way not listed before it.
+ *
+ * @param node The node.
+ * @param j The position in node->ways.
+ * @return false if node->ways[j] is NULL (a way that was never added) or node->ways[0 .. j)
+ *         includes a way with the same id, true otherwise.
+ */
+static bool
+node_way_first(const struct node *node, int j)
+{
+    if (node->ways[j] == NULL) {
+        return false;
+    }
+    for (int k = 0; k < j; k++) {
+        if (node->ways[k] != NULL && node->ways[k]->id == node->ways[j]->id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Builds the junction index: the nodes of every way, and those at which it meets another way.
+ *
+ * @param m Pointer to the ssmap structure whose nodes have all been added.
+ * @return true on success, false if memory runs out.
+ *
+ * The index is built from the ways each node lists, which are what ssmap_find_node_by_names
+ * matches against. A node with at least two distinct ways is a junction of each of them. One
+ * pass over the nodes counts the entries of every way and a second fills them in, so both lists
+ * come out in ascending order of node id, in time linear in the number of node-way pairs.
+ */
+static bool
+build_junction_index(struct ssmap *m)
+{
+    struct junction_index *index = &m->junctions;
+    index->node_offsets = calloc(m->num_ways + 1, sizeof(int));
+    index->junction_offsets = calloc(m->num_ways + 1, sizeof(int));
+    if (index->node_offsets == NULL || index->junction_offsets == NULL) {
+        free_junction_index(index);
+        return false;
+    }
+
+    // Count the nodes and junctions of every way, each node once per distinct way.
+    for (int i = 0; i < m->num_nodes; i++) {
+        const struct node *node = m->nodes[i];
+        if (node == NULL) {
+            continue;
+        }
+        int distinct = 0;
+        for (int j = 0; j < node->num_ways; j++) {
+            distinct += node_way_first(node, j);
+        }
+        for (int j = 0; j < node->num_ways; j++) {
+            if (node_way_first(node, j)) {
+                index->node_offsets[node->ways[j]->id + 1]++;
+                index->junction_offsets[node->ways[j]->id + 1] += distinct > 1;
+            }
+        }
+    }
+    for (int w = 0; w < m->num_ways; w++) {
+        index->node_offsets[w + 1] += index->node_offsets[w];
+        index->junction_offsets[w + 1] += index->junction_offsets[w];
+    }
+
+    index->nodes = malloc((index->node_offsets[m->num_ways] + 1) * sizeof(int));
+    index->junctions = malloc((index->junction_offsets[m->num_ways] + 1) * sizeof(int));
+    if (index->nodes == NULL || index->junctions == NULL) {
+        free_junction_index(index);
+        return false;
+    }
+
+    // Fill in the lists, using the start offsets as cursors, then shift the cursors back.
+    for (int i = 0; i < m->num_nodes; i++) {
+        const struct node *node = m->nodes[i];
+        if (node == NULL) {
+            continue;
+        }
+        int distinct = 0;
+        for (int j = 0; j < node->num_ways; j++) {
+            distinct += node_way_first(node, j);
+        }
+        for (int j = 0; j < node->num_ways; j++) {
+            if (node_way_first(node, j)) {
+                int w = node->ways[j]->id;
+                index->nodes[index->node_offsets[w]++] = i;
+                if (distinct > 1) {
+                    index->junctions[index->junction_offsets[w]++] = i;
+                }
+            }
+        }
+    }
+    memmove(index->node_offsets + 1, index->node_offsets, m->num_ways * sizeof(int));
+    memmove(index->junction_offsets + 1, index->junction_offsets, m->num_ways * sizeof(int));
+    index->node_offsets[0] = 0;
+    index->junction_offsets[0] = 0;
+
+    return true;
+}
+
+// Radius of the earth, in kilometres, as used by distance_between_nodes.
+#define EARTH_RADIUS 6371.
+
+/**
+ * Computes the cartesian position of a point on the earth's surface.
+ *
+ * @param lat The latitude of the point, in degrees.
+ * @param lon The longitude of the point, in degrees.
+ * @param p Receives the x, y and z coordinates, in kilometres from the centre of the earth.
+ */
+static void
+position_of(double lat, double lon, double p[3])
+{
+    p[0] = EARTH_RADIUS * cos(d2r(lat)) * cos(d2r(lon));
+    p[1] = EARTH_RADIUS * cos(d2r(lat)) * sin(d2r(lon));
+    p[2] = EARTH_RADIUS * sin(d2r(lat));
+}
+
+/**
+ * Computes the cartesian position of every node.
+ *
+ * @param m Pointer to the ssmap structure whose nodes have all been added.
+ * @return true on success, false if memory runs out.
+ *
+ * Each node is placed on a sphere with the same radius as the one used by distance_between_nodes,
+ * so the straight-line (chord) distance between two positions is a slightly shorter
+ * approximation of their great-circle distance that needs no trigonometry to evaluate.
+ */
+static bool
+build_positions(struct ssmap *m)
+{
+    m->xyz = malloc(3 * m->num_nodes * sizeof(double));
+    if (m->xyz == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < m->num_nodes; i++) {
+        const struct node *node = m->nodes[i];
+        double *p = &m->xyz[3 * i];
+        if (node == NULL) {
+            p[0] = p[1] = p[2] = 0;
+            continue;
+        }
+        position_of(node->lat, node->lon, p);
+    }
+
+    return true;
+}
+
+// An entry of a k-d tree while it is being built: an id together with its position, so that
+// arranging the entries moves them through memory in order rather than looking up positions
+// all over the map.
+struct kd_point {
+  double p[3]; // The cartesian position.
+  int id; // The node or segment at that position.
+};
+
+/**
+ * Arranges a range of k-d tree entries into a subtree.
+ *
+ * @param kd The k-d tree, whose axis array receives the split of every entry in the range.
+ * @param points The entries with their positions, rearranged in place.
+ * @param lo The first entry of the range.
+ * @param hi One past the last entry of the range.
+ *
+ * The range is split along the coordinate in which its positions spread the most, which keeps
+ * the cells of the tree compact even where a map is long and thin. Quickselect moves the median
+ * entry to the middle, with no farther entries before it and no nearer ones after it, in time
+ * linear in the size of the range; the two halves are then arranged in turn. The whole tree
+ * takes O(N log N) time. The caller copies the ids into the tree once the points are arranged.
+ */
+static void
+kd_build(struct kd_tree *kd, struct kd_point *points, int lo, int hi)
+{
+    if (hi - lo < 2) {
+        if (hi > lo) {
+            kd->axis[lo] = 0;
+        }
+        return;
+    }
+
+    double min[3] = { INFINITY, INFINITY, INFINITY }, max[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (int i = lo; i < hi; i++) {
+        const double *p = points[i].p;
+        for (int c = 0; c < 3; c++) {
+            min[c] = p[c] < min[c] ? p[c] : min[c];
+            max[c] = p[c] > max[c] ? p[c] : max[c];
+        }
+    }
+    int axis = 0;
+    for (int c = 1; c < 3; c++) {
+        if (max[c] - min[c] > max[axis] - min[axis]) {
+            axis = c;
+        }
+    }
+
+    // Quickselect the median along the axis.
+    int mid = lo + (hi - lo) / 2;
+    int left = lo, right = hi - 1;
+    while (left < right) {
+        double pivot = points[left + (right - left) / 2].p[axis];
+        int i = left, j = right;
+        while (i <= j) {
+            while (points[i].p[axis] < pivot) {
+                i++;
+            }
+            while (points[j].p[axis] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                struct kd_point t = points[i];
+                points[i++] = points[j];
+                points[j--] = t;
+            }
+        }
+        if (mid <= j) {
+            right = j;
+        } else if (mid >= i) {
+            left = i;
+        } else {
+            break;
+        }
+    }
+
+    kd->axis[mid] = axis;
+    kd_build(kd, points, lo, mid);
+    kd_build(kd, points, mid + 1, hi);
+}
+
+/**
+ * Builds the k-d tree over the positions of all existing nodes.
+ *
+ * @param m Pointer to the ssmap structure, with its node positions computed.
+ * @return true on success, false if memory runs out.
+ */
+static bool
+build_kd_tree(struct ssmap *m)
+{
+    struct kd_tree *kd = &m->kd;
+    kd->nodes = malloc((m->num_nodes + 1) * sizeof(int));
+    kd->axis = malloc(m->num_nodes + 1);
+    struct kd_point *points = malloc((m->num_nodes + 1) * sizeof(struct kd_point));
+    if (kd->nodes == NULL || kd->axis == NULL || points == NULL) {
+        free(kd->nodes);
+        free(kd->axis);
+        free(points);
+        memset(kd, 0, sizeof(*kd));
+        return false;
+    }
+
+    kd->size = 0;
+    for (int i = 0; i < m->num_nodes; i++) {
+        if (m->nodes[i] != NULL) {
+            memcpy(points[kd->size].p, &m->xyz[3 * i], sizeof(points->p));
+            points[kd->size++].id = i;
+        }
+    }
+    kd_build(kd, points, 0, kd->size);
+    for (int i = 0; i < kd->size; i++) {
+        kd->nodes[i] = points[i].id;
+    }
+    free(points);
+    return true;
+}
+
+/**
+ * Frees the arrays of a segment index and clears it.
+ *
+ * @param index Pointer to the segment index.
+ */
+static void
+free_segment_index(struct segment_index *index)
+{
+    free(index->from);
+    free(index->to);
+    free(index->ways);
+    free(index->tree.nodes);
+    free(index->tree.axis);
+    free(index->reach);
+    memset(index, 0, sizeof(*index));
+}
+
+/**
+ * Computes the reach of every entry in a subtree of the segment index.
+ *
+ * @param m Pointer to the ssmap structure, with its segment tree arranged.
+ * @param lo The first entry of the subtree.
+ * @param hi One past the last entry of the subtree.
+ * @return The reach of the subtree: the largest half-length of any of its segments, in km, or 0
+ *         if it is empty.
+ *
+ * No point of a segment is farther from its midpoint than half its length, so a search can skip
+ * a subtree whose midpoints all lie farther beyond a splitting plane than its reach.
+ */
+static double
+segment_reach(struct ssmap *m, int lo, int hi)
+{
+    struct segment_index *index = &m->segments;
+    if (lo >= hi) {
+        return 0;
+    }
+
+    int mid = lo + (hi - lo) / 2;
+    int s = index->tree.nodes[mid];
+    const double *a = &m->xyz[3 * index->from[s]];
+    const double *b = &m->xyz[3 * index->to[s]];
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    double reach = sqrt(dx * dx + dy * dy + dz * dz) / 2;
+
+    double left = segment_reach(m, lo, mid);
+    double right = segment_reach(m, mid + 1, hi);
+    reach = left > reach ? left : reach;
+    reach = right > reach ? right : reach;
+    index->reach[mid] = reach;
+    return reach;
+}
+
+/**
+ * Builds the segment index over every pair of consecutive nodes of every way.
+ *
+ * @param m Pointer to the ssmap structure, with its node positions computed.
+ * @return true on success, false if memory runs out.
+ *
+ * Segments from a node to itself are left out, as they are by the adjacency. The midpoints are
+ * only needed to arrange the tree; searches recompute them from the two ends.
+ */
+static bool
+build_segment_index(struct ssmap *m)
+{
+    struct segment_index *index = &m->segments;
+    int count = 0;
+    for (int i = 0; i < m->num_ways; i++) {
+        const struct way *way = m->ways[i];
+        for (int j = 0; way != NULL && j + 1 < way->num_nodes; j++) {
+            count += way->node_ids[j] != way->node_ids[j + 1];
+        }
+    }
+
+    index->from = malloc((count + 1) * sizeof(int));
+    index->to = malloc((count + 1) * sizeof(int));
+    index->ways = malloc((count + 1) * sizeof(int));
+    index->tree.nodes = malloc((count + 1) * sizeof(int));
+    index->tree.axis = malloc(count + 1);
+    index->reach = malloc((count + 1) * sizeof(double));
+    struct kd_point *midpoints = malloc((count + 1) * sizeof(struct kd_point));
+    if (index->from == NULL || index->to == NULL || index->ways == NULL ||
+        index->tree.nodes == NULL || index->tree.axis == NULL || index->reach == NULL ||
+        midpoints == NULL) {
+        free_segment_index(index);
+        free(midpoints);
+        return false;
+    }
+
+    int s = 0;
+    for (int i = 0; i < m->num_ways; i++) {
+        const struct way *way = m->ways[i];
+        for (int j = 0; way != NULL && j + 1 < way->num_nodes; j++) {
+            int u = way->node_ids[j], v = way->node_ids[j + 1];
+            if (u == v) {
+                continue;
+            }
+            index->from[s] = u;
+            index->to[s] = v;
+            index->ways[s] = i;
+            for (int c = 0; c < 3; c++) {
+                midpoints[s].p[c] = (m->xyz[3 * u + c] + m->xyz[3 * v + c]) / 2;
+            }
+            midpoints[s].id = s;
+            s++;
+        }
+    }
+    index->num_segments = count;
+    index->tree.size = count;
+
+    kd_build(&index->tree, midpoints, 0, count);
+    for (int i = 0; i < count; i++) {
+        index->tree.nodes[i] = midpoints[i].id;
+    }
+    segment_reach(m, 0, count);
+    free(midpoints);
+    return true;
+}
+
+/**
+ * Finds the fastest edge leading directly from one node to another.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @param u The node the edge starts at.
+ * @param v The node the edge ends at.
+ * @return The index of the edge in m->forward, or -1 if there is no such edge. When several
+ *         ways connect the two nodes, the one with the smallest travel time is returned.
+ */
+static int
+find_edge(const struct ssmap *m, int u, int v)
+{
+    const struct adjacency *adj = &m->forward;
+    int best = -1;
+
+    for (int e = adj->offsets[u]; e < adj->offsets[u + 1]; e++) {
+        if (adj->targets[e] == v && (best < 0 || adj->weights[e] < adj->weights[best])) {
+            best = e;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Performs additional initialization tasks for a Simple Street Map (ssmap) structure.
+ *
+ * @param m Pointer to the ssmap structure to be further initialized.
+ * @return A boolean value indicating the success of the initialization process.
+ *         Returns true if initialization is successful, and false if there are any issues.
+ *
+ * Once all ways and nodes have been added, this function builds the forward and reverse
+ * adjacency used for routing (see build_adjacency), precomputing the travel time of every edge,
+ * the cartesian node positions used by the A* heuristic (see build_positions), and the lookup
+ * indexes: the trigram index of way names (see build_name_index), the index of the nodes where
+ * ways meet (see build_junction_index), the k-d tree of node positions (see build_kd_tree) and
+ * the k-d tree of road segments (see build_segment_index). A map loaded from a snapshot comes
+ * with all of these already in place, so this function builds none of them for such a map.
+ * If during the initialization any issue is encountered (e.g., out of memory, or a way that
+ * refers to a node that was never added), the function returns false.
+ *
+ */
+bool
+ssmap_initialize(struct ssmap * m)
+{
+    // A map loaded from a snapshot comes with all of this in place.
+    if (m->forward.offsets == NULL && !build_adjacency(m)) {
+        free_adjacency(&m->forward);
+        free_adjacency(&m->reverse);
+        return false;
+    }
+
+    if (m->xyz == NULL && !build_positions(m)) {
+        return false;
+    }
+
+    if (m->names.grams == NULL && !build_name_index(m)) {
+        return false;
+    }
+
+    if (m->junctions.nodes == NULL && !build_junction_index(m)) {
+        return false;
+    }
+
+    if (m->kd.nodes == NULL && !build_kd_tree(m)) {
+        return false;
+    }
+
+    if (m->segments.from == NULL && !build_segment_index(m)) {
+        return false;
+    }
+
+    // Keep track of the fastest way in the map for the A* heuristic. This is done here rather
+    // than in ssmap_add_way so that ways can be added from several threads at once.
+    for (int i = 0; i < m->num_ways; i++) {
+        if (m->ways[i] != NULL && m->ways[i]->max_speed > m->max_speed) {
+            m->max_speed = m->ways[i]->max_speed;
+        }
+    }
+
+    return true;
+
+}
+
+/**
+ * Frees all memory allocated for a Simple Street Map (ssmap) structure and its components.
+ *
+ * @param m Pointer to the ssmap structure to be destroyed.
+ *
+ * This function is responsible for properly freeing all dynamically allocated memory associated
+ * with the ssmap structure, including memory for nodes, ways, and their respective components.
+ * Since nodes and ways are carved out of the map's arenas, this takes time proportional to the
+ * number of arena blocks rather than the number of nodes and ways. This cleanup helps prevent
+ * memory leaks and ensures that the resources are properly returned to the system upon the
+ * map's disposal.
+ */
+void
+ssmap_destroy(struct ssmap * m)
+{
+    // The nodes and ways themselves, with their names and id arrays, all live in the two
+    // arenas, so only the slot arrays and the arenas' blocks need to be freed.
+    free(m->nodes);
+    free(m->ways);
+    arena_free(&m->node_arena);
+    arena_free(&m->way_arena);
+
+    // Free the routing data and indexes built by ssmap_initialize, unless they live in a
+    // snapshot mapping.
+    if (m->snapshot != NULL) {
+        munmap(m->snapshot, m->snapshot_size);
+    } else {
+        free(m->xyz);
+        free_adjacency(&m->forward);
+        free_adjacency(&m->reverse);
+        free_name_index(&m->names);
+        free_junction_index(&m->junctions);
+        free(m->kd.nodes);
+        free(m->kd.axis);
+        free_segment_index(&m->segments);
+    }
+    free_hierarchy(m->hierarchy);
+
+    // Finally, free the ssmap structure itself.
+    free(m);
+
+}
+
+/**
+ * Adds a new way to the Simple Street Map (ssmap) structure.
+ *
+ * @param m Pointer to the ssmap structure where the new way will be added.
+ * @param id Unique identifier for the new way.
+ * @param name Name of the new way. If the way is unnamed, this should be an empty string or a placeholder.
+ * @param maxspeed Maximum legal speed on the new way, in the unit specified by the map's convention (e.g., km/h).
+ * @param oneway Boolean flag indicating if the new way is one-way (true) or two-way (false).
+ * @param num_nodes Number of nodes that make up the new way.
+ * @param node_ids Array of node IDs that constitute the way, ordered from start to end.
+ * @return A pointer to the newly created way structure, or NULL if the creation fails.
+ *
+ * This function creates and initializes a new way structure with the specified properties,
+ * including its connectivity (nodes that make up the way). It dynamically allocates memory
+ * for the new way and its array of node IDs. After successful creation, the new way is added
+ * to the ssmap's array of ways using the way's ID as the index. If any memory allocation fails,
+ * the function ensures to clean up any allocated memory before returning NULL to prevent leaks.
+ */
+struct way *
+ssmap_add_way(struct ssmap * m, int id, const char * name, float maxspeed, bool oneway,
+              int num_nodes, const int node_ids[])
+{
+    // Carve the way, its node ids and its name out of the way arena in one piece, so they sit
+    // next to each other in memory.
+    size_t name_size = strlen(name) + 1; // Plus one for null terminator
+    struct way *new_way = arena_alloc(&m->way_arena, sizeof(struct way) +
+                                      num_nodes * sizeof(int) + name_size);
+    if (new_way == NULL) {
+        // If memory allocation fails, return NULL.
+        return NULL;
+    }
+
+    // Initialize the new way's properties.
+    new_way->id = id;
+    new_way->max_speed = maxspeed;
+    new_way->one_way = oneway;
+    new_way->num_nodes = num_nodes;
+
+    // Copy the provided node IDs to the new way's node_ids array, right after the structure.
+    new_way->node_ids = (int *)(new_way + 1);
+    memcpy(new_way->node_ids, node_ids, num_nodes * sizeof(int));
+
+    // Make a full copy of the name after the node IDs.
+    new_way->name = (char *)(new_way->node_ids + num_nodes);
+    memcpy(new_way->name, name, name_size);
+
+    // Add the new way to the ssmap's array of ways.
+    m->ways[id] = new_way;
+
+    // Return a pointer to the successfully created and added new way.
+    return new_way;
+
+}
+
+/**
+ * Adds a new node to the Simple Street Map (ssmap) structure.
+ *
+ * @param m Pointer to the ssmap structure to which the node will be added.
+ * @param id The unique identifier for the new node.
+ * @param lat The latitude coordinate of the new node.
+ * @param lon The longitude coordinate of the new node.
+ * @param num_ways The number of ways (roads) that the new node is connected to.
+ * @param way_ids Array containing the identifiers of the ways that the new node is connected to.
+ * @return A pointer to the newly created node structure, or NULL if the node could not be created.
+ *
+ * This function dynamically allocates memory for a new node and initializes it with the
+ * provided details, including its location (latitude and longitude), connections to ways,
+ * and its unique identifier. It also links the node to its associated ways based on the provided
+ * way_ids array. If successful, the new node is added to the ssmap structure and a pointer to the
+ * node is returned. If any memory allocation fails, the function cleans up any allocated resources
+ * and returns NULL.
+ */
+struct node *
+ssmap_add_node(struct ssmap * m, int id, double lat, double lon,
+               int num_ways, const int way_ids[])
+{
+    // Check if the ssmap structure is NULL, indicating an invalid map.
+    if (m == NULL) {
+        return NULL;
+    }
+
+    // Carve the node and its array of way pointers out of the node arena in one piece.
+    struct node *new_node = arena_alloc(&m->node_arena, sizeof(struct node) +
+                                        num_ways * sizeof(struct way *));
+    if (new_node == NULL) { // Check for successful memory allocation.
+        return NULL;
+    }
+
+    // Initialize the new node with the provided parameters.
+    new_node->id = id;
+    new_node->lat = lat;
+    new_node->lon = lon;
+    new_node->num_ways = num_ways;
+    new_node->ways = (struct way **)(new_node + 1);
+
+    // Populate the ways array for the new node using the provided way_ids.
+    for (int i = 0; i < num_ways; i++) {
+        // Assign pointers to the actual way structures based on the provided way_ids.
+        new_node->ways[i] = m->ways[way_ids[i]];
+    }
+
+    // Add the new node to the ssmap structure, using its ID as the index.
+    m->nodes[id] = new_node;
+
+    // Return a pointer to the newly created node.
+    return new_node;
+
+}
+
+/**
+ * Returns the number of node slots in the map.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @return The nr_nodes the map was created with; valid node ids are below it.
+ */
+int
+ssmap_num_nodes(const struct ssmap * m)
+{
+    return m->num_nodes;
+}
+
+/**
+ * Returns the number of way slots in the map.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @return The nr_ways the map was created with; valid way ids are below it.
+ */
+int
+ssmap_num_ways(const struct ssmap * m)
+{
+    return m->num_ways;
+}
+
+// The stream the print functions write to on this thread, or NULL for stdout.
+static __thread FILE *thread_output;
+
+/**
+ * Returns the stream the print functions of the calling thread write to.
+ */
+static FILE *
+output(void)
+{
+    return thread_output != NULL ? thread_output : stdout;
+}
+
+/**
+ * Redirects the output of the print functions on the calling thread.
+ *
+ * @param stream The stream to write to, or NULL for stdout.
+ */
+void
+ssmap_set_output(FILE * stream)
+{
+    thread_output = stream;
+}
+
+/**
+ * Returns the version of the library.
+ *
+ * @return SSMAP_VERSION as it was when the library was compiled.
+ */
+const char *
+ssmap_version(void)
+{
+    return SSMAP_VERSION;
+}
+
+/**
+ * Looks up the latitude and longitude of a node.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @param id The node id.
+ * @param lat Receives the latitude of the node, if it exists.
+ * @param lon Receives the longitude of the node, if it exists.
+ * @return true if the node exists, false otherwise.
+ */
+bool
+ssmap_node_position(const struct ssmap * m, int id, double * lat, double * lon)
+{
+    if (id < 0 || id >= m->num_nodes || m->nodes[id] == NULL) {
+        return false;
+    }
+    *lat = m->nodes[id]->lat;
+    *lon = m->nodes[id]->lon;
+    return true;
+}
+
+// Version of the snapshot format written by ssmap_save. Bump it whenever the layout changes.
+#define SNAPSHOT_VERSION 3
+
+// Written into every snapshot header so that a snapshot is rejected on a machine with a different byte order.
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+// Bits of a snapshot's way flags.
+#define SNAPSHOT_PRESENT 1 // The way or node was added to the map.
+#define SNAPSHOT_ONE_WAY 2 // The way is one-way.
+
+// The arrays stored in a snapshot, in file order.
+enum snapshot_section {
+  SEC_NODE_FLAGS, // uint8_t per node: SNAPSHOT_PRESENT.
+  SEC_NODE_COORDS, // double[2] per node: latitude and longitude.
+  SEC_NODE_WAY_OFFSETS, // int[num_nodes + 1]: ways of node i are NODE_WAY_IDS[offsets[i] .. offsets[i + 1]).
+  SEC_NODE_WAY_IDS, // int per node-way pair.
+  SEC_WAY_FLAGS, // uint8_t per way: SNAPSHOT_PRESENT, SNAPSHOT_ONE_WAY.
+  SEC_WAY_SPEEDS, // float per way.
+  SEC_WAY_NAME_OFFSETS, // int per way: start of its NUL-terminated name in NAMES.
+  SEC_NAMES, // char per byte of all names.
+  SEC_WAY_NODE_OFFSETS, // int[num_ways + 1]: nodes of way i are WAY_NODE_IDS[offsets[i] .. offsets[i + 1]).
+  SEC_WAY_NODE_IDS, // int per way-node pair.
+  SEC_XYZ, // double[3] per node, as computed by build_positions.
+  SEC_FORWARD_OFFSETS, SEC_FORWARD_TARGETS, SEC_FORWARD_WAYS, SEC_FORWARD_WEIGHTS, SEC_FORWARD_LENGTHS,
+  SEC_REVERSE_OFFSETS, SEC_REVERSE_TARGETS, SEC_REVERSE_WAYS, SEC_REVERSE_WEIGHTS, SEC_REVERSE_LENGTHS,
+  SEC_GRAMS, // uint32_t per distinct trigram of the name index, ascending.
+  SEC_GRAM_OFFSETS, // int[num_grams + 1]: ways containing trigram g are GRAM_WAYS[offsets[g] .. offsets[g + 1]).
+  SEC_GRAM_WAYS, // int per trigram-way pair.
+  SEC_JUNCTION_NODE_OFFSETS, // int[num_ways + 1]: nodes of way i are JUNCTION_NODES[offsets[i] .. offsets[i + 1]).
+  SEC_JUNCTION_NODES, // int per distinct way-node pair.
+  SEC_JUNCTION_OFFSETS, // int[num_ways + 1]: junctions of way i are JUNCTIONS[offsets[i] .. offsets[i + 1]).
+  SEC_JUNCTIONS, // int per way-junction pair.
+  SEC_KD_NODES, // int per existing node, in the order of the k-d tree.
+  SEC_KD_AXIS, // uint8_t per k-d tree entry.
+  SEC_SEGMENT_FROM, SEC_SEGMENT_TO, SEC_SEGMENT_WAYS, // int per road segment.
+  SEC_SEGMENT_TREE, // int per road segment, in the order of the segment tree.
+  SEC_SEGMENT_AXIS, // uint8_t per segment tree entry.
+  SEC_SEGMENT_REACH, // double per segment tree entry.
+  NUM_SECTIONS
+};
+
+// Header at the start of a snapshot. Every section starts at a multiple of 8 bytes.
+struct snapshot_header {
+  char magic[8]; // SSMAP_SNAPSHOT_MAGIC.
+  uint32_t version; // SNAPSHOT_VERSION.
+  uint32_t byte_order; // SNAPSHOT_BYTE_ORDER, as written by the saving machine.
+  uint64_t checksum; // snapshot_checksum of everything after the header.
+  uint64_t file_size; // Total size of the snapshot in bytes.
+  int32_t num_nodes; // Number of node slots.
+  int32_t num_ways; // Number of way slots.
+  int32_t num_node_ways; // Length of SEC_NODE_WAY_IDS.
+  int32_t num_way_nodes; // Length of SEC_WAY_NODE_IDS.
+  int32_t names_size; // Length of SEC_NAMES.
+  int32_t num_edges; // Number of edges in each adjacency.
+  int32_t num_grams; // Length of SEC_GRAMS.
+  int32_t num_gram_ways; // Length of SEC_GRAM_WAYS.
+  int32_t num_junction_nodes; // Length of SEC_JUNCTION_NODES.
+  int32_t num_junctions; // Length of SEC_JUNCTIONS.
+  int32_t kd_size; // Length of SEC_KD_NODES.
+  int32_t num_segments; // Length of each SEC_SEGMENT_* section.
+  float max_speed; // Highest speed limit of any way.
+  uint32_t reserved; // Zero.
+  uint64_t offsets[NUM_SECTIONS]; // Byte offset of each section from the start of the file.
+  uint64_t sizes[NUM_SECTIONS]; // Byte size of each section.
+};
+
+// Rounds a byte count up to the next multiple of 8.
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+/**
+ * Computes the checksum of a snapshot's payload.
+ *
+ * @param data The payload, which is 8-byte aligned and a multiple of 8 bytes long.
+ * @param size The length of the payload in bytes.
+ * @return A 64-bit FNV-1a hash of the payload, taken over 64-bit words rather than bytes so
+ *         that verifying a large snapshot takes little more than reading it.
+ */
+static uint64_t
+snapshot_checksum(const void *data, uint64_t size)
+{
+    const uint64_t *words = data;
+    uint64_t hash = 14695981039346656037ull;
+
+    for (uint64_t i = 0; i < size / 8; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * Lays out the sections of a snapshot and computes the total file size.
+ *
+ * @param h Pointer to a header whose counts are filled in; its offsets, sizes and file_size
+ *        are set by this function.
+ */
+static void
+snapshot_layout(struct snapshot_header *h)
+{
+    uint64_t n = h->num_nodes, w = h->num_ways, e = h->num_edges;
+
+    h->sizes[SEC_NODE_FLAGS] = n;
+    h->sizes[SEC_NODE_COORDS] = 2 * n * sizeof(double);
+    h->sizes[SEC_NODE_WAY_OFFSETS] = (n + 1) * sizeof(int);
+    h->sizes[SEC_NODE_WAY_IDS] = (uint64_t)h->num_node_ways * sizeof(int);
+    h->sizes[SEC_WAY_FLAGS] = w;
+    h->sizes[SEC_WAY_SPEEDS] = w * sizeof(float);
+    h->sizes[SEC_WAY_NAME_OFFSETS] = w * sizeof(int);
+    h->sizes[SEC_NAMES] = h->names_size;
+    h->sizes[SEC_WAY_NODE_OFFSETS] = (w + 1) * sizeof(int);
+    h->sizes[SEC_WAY_NODE_IDS] = (uint64_t)h->num_way_nodes * sizeof(int);
+    h->sizes[SEC_XYZ] = 3 * n * sizeof(double);
+    for (int s = SEC_FORWARD_OFFSETS; s <= SEC_REVERSE_OFFSETS; s += SEC_REVERSE_OFFSETS - SEC_FORWARD_OFFSETS) {
+        h->sizes[s] = (n + 1) * sizeof(int);
+        h->sizes[s + 1] = e * sizeof(int);
+        h->sizes[s + 2] = e * sizeof(int);
+        h->sizes[s + 3] = e * sizeof(double);
+        h->sizes[s + 4] = e * sizeof(double);
+    }
+    h->sizes[SEC_GRAMS] = (uint64_t)h->num_grams * sizeof(uint32_t);
+    h->sizes[SEC_GRAM_OFFSETS] = ((uint64_t)h->num_grams + 1) * sizeof(int);
+    h->sizes[SEC_GRAM_WAYS] = (uint64_t)h->num_gram_ways * sizeof(int);
+    h->sizes[SEC_JUNCTION_NODE_OFFSETS] = (w + 1) * sizeof(int);
+    h->sizes[SEC_JUNCTION_NODES] = (uint64_t)h->num_junction_nodes * sizeof(int);
+    h->sizes[SEC_JUNCTION_OFFSETS] = (w + 1) * sizeof(int);
+    h->sizes[SEC_JUNCTIONS] = (uint64_t)h->num_junctions * sizeof(int);
+    h->sizes[SEC_KD_NODES] = (uint64_t)h->kd_size * sizeof(int);
+    h->sizes[SEC_KD_AXIS] = h->kd_size;
+    for (int s = SEC_SEGMENT_FROM; s <= SEC_SEGMENT_TREE; s++) {
+        h->sizes[s] = (uint64_t)h->num_segments * sizeof(int);
+    }
+    h->sizes[SEC_SEGMENT_AXIS] = h->num_segments;
+    h->sizes[SEC_SEGMENT_REACH] = (uint64_t)h->num_segments * sizeof(double);
+
+    uint64_t offset = ALIGN8(sizeof(struct snapshot_header));
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        h->offsets[s] = offset;
+        offset += ALIGN8(h->sizes[s]);
+    }
+    h->file_size = offset;
+}
+
+/**
+ * Copies one CSR adjacency into the sections of a snapshot.
+ *
+ * @param image The snapshot being written.
+ * @param h Its header.
+ * @param first The section holding the offsets of this adjacency.
+ * @param adj The adjacency to copy.
+ */
+static void
+snapshot_put_adjacency(char *image, const struct snapshot_header *h, int first,
+                       const struct adjacency *adj)
+{
+    memcpy(image + h->offsets[first], adj->offsets, h->sizes[first]);
+    memcpy(image + h->offsets[first + 1], adj->targets, h->sizes[first + 1]);
+    memcpy(image + h->offsets[first + 2], adj->way_ids, h->sizes[first + 2]);
+    memcpy(image + h->offsets[first + 3], adj->weights, h->sizes[first + 3]);
+    memcpy(image + h->offsets[first + 4], adj->lengths, h->sizes[first + 4]);
+}
+
+/**
+ * Writes a binary snapshot of an initialized map to a file.
+ *
+ * @param m Pointer to the ssmap structure, after ssmap_initialize.
+ * @param filename The file to write.
+ * @return true on success, false if memory runs out or the file cannot be written.
+ *
+ * The snapshot holds the nodes, ways and names as flat arrays indexed by id, along with the
+ * node positions, both adjacencies and all the indexes computed by ssmap_initialize, so
+ * loading it requires no parsing, no distance computations and no sorting. The whole image is assembled in memory, checksummed, and written with a
+ * single fwrite.
+ */
+bool
+ssmap_save(const struct ssmap * m, const char * filename)
+{
+    struct snapshot_header h = { .magic = SSMAP_SNAPSHOT_MAGIC };
+
+    h.version = SNAPSHOT_VERSION;
+    h.byte_order = SNAPSHOT_BYTE_ORDER;
+    h.num_nodes = m->num_nodes;
+    h.num_ways = m->num_ways;
+    h.num_edges = m->forward.num_edges;
+    h.num_grams = m->names.num_grams;
+    h.num_gram_ways = m->names.offsets[m->names.num_grams];
+    h.num_junction_nodes = m->junctions.node_offsets[m->num_ways];
+    h.num_junctions = m->junctions.junction_offsets[m->num_ways];
+    h.kd_size = m->kd.size;
+    h.num_segments = m->segments.num_segments;
+    h.max_speed = m->max_speed;
+    for (int i = 0; i < m->num_nodes; i++) {
+        h.num_node_ways += m->nodes[i] != NULL ? m->nodes[i]->num_ways : 0;
+    }
+    for (int i = 0; i < m->num_ways; i++) {
+        if (m->ways[i] != NULL) {
+            h.num_way_nodes += m->ways[i]->num_nodes;
+            h.names_size += strlen(m->ways[i]->name) + 1;
+        }
+    }
+    snapshot_layout(&h);
+
+    char *image = calloc(1, h.file_size);
+    if (image == NULL) {
+        return false;
+    }
+
+    // Nodes: presence, coordinates and the ids of their ways.
+    uint8_t *node_flags = (uint8_t *)(image + h.offsets[SEC_NODE_FLAGS]);
+    double *coords = (double *)(image + h.offsets[SEC_NODE_COORDS]);
+    int *node_way_offsets = (int *)(image + h.offsets[SEC_NODE_WAY_OFFSETS]);
+    int *node_way_ids = (int *)(image + h.offsets[SEC_NODE_WAY_IDS]);
+    for (int i = 0; i < m->num_nodes; i++) {
+        const struct node *node = m->nodes[i];
+        node_way_offsets[i + 1] = node_way_offsets[i];
+        if (node == NULL) {
+            continue;
+        }
+        node_flags[i] = SNAPSHOT_PRESENT;
+        coords[2 * i] = node->lat;
+        coords[2 * i + 1] = node->lon;
+        for (int j = 0; j < node->num_ways; j++) {
+            node_way_ids[node_way_offsets[i + 1]++] = node->ways[j] != NULL ? node->ways[j]->id : INVALID_ID;
+        }
+    }
+
+    // Ways: flags, speed limits, names and the ids of their nodes.
+    uint8_t *way_flags = (uint8_t *)(image + h.offsets[SEC_WAY_FLAGS]);
+    float *speeds = (float *)(image + h.offsets[SEC_WAY_SPEEDS]);
+    int *name_offsets = (int *)(image + h.offsets[SEC_WAY_NAME_OFFSETS]);
+    char *names = image + h.offsets[SEC_NAMES];
+    int *way_node_offsets = (int *)(image + h.offsets[SEC_WAY_NODE_OFFSETS]);
+    int *way_node_ids = (int *)(image + h.offsets[SEC_WAY_NODE_IDS]);
+    int names_used = 0;
+    for (int i = 0; i < m->num_ways; i++) {
+        const struct way *way = m->ways[i];
+        way_node_offsets[i + 1] = way_node_offsets[i];
+        if (way == NULL) {
+            continue;
+        }
+        way_flags[i] = SNAPSHOT_PRESENT | (way->one_way ? SNAPSHOT_ONE_WAY : 0);
+        speeds[i] = way->max_speed;
+        name_offsets[i] = names_used;
+        strcpy(names + names_used, way->name);
+        names_used += strlen(way->name) + 1;
+        memcpy(way_node_ids + way_node_offsets[i], way->node_ids, way->num_nodes * sizeof(int));
+        way_node_offsets[i + 1] += way->num_nodes;
+    }
+
+    // Data derived by ssmap_initialize.
+    memcpy(image + h.offsets[SEC_XYZ], m->xyz, h.sizes[SEC_XYZ]);
+    snapshot_put_adjacency(image, &h, SEC_FORWARD_OFFSETS, &m->forward);
+    snapshot_put_adjacency(image, &h, SEC_REVERSE_OFFSETS, &m->reverse);
+    memcpy(image + h.offsets[SEC_GRAMS], m->names.grams, h.sizes[SEC_GRAMS]);
+    memcpy(image + h.offsets[SEC_GRAM_OFFSETS], m->names.offsets, h.sizes[SEC_GRAM_OFFSETS]);
+    memcpy(image + h.offsets[SEC_GRAM_WAYS], m->names.ways, h.sizes[SEC_GRAM_WAYS]);
+    memcpy(image + h.offsets[SEC_JUNCTION_NODE_OFFSETS], m->junctions.node_offsets, h.sizes[SEC_JUNCTION_NODE_OFFSETS]);
+    memcpy(image + h.offsets[SEC_JUNCTION_NODES], m->junctions.nodes, h.sizes[SEC_JUNCTION_NODES]);
+    memcpy(image + h.offsets[SEC_JUNCTION_OFFSETS], m->junctions.junction_offsets, h.sizes[SEC_JUNCTION_OFFSETS]);
+    memcpy(image + h.offsets[SEC_JUNCTIONS], m->junctions.junctions, h.sizes[SEC_JUNCTIONS]);
+    memcpy(image + h.offsets[SEC_KD_NODES], m->kd.nodes, h.sizes[SEC_KD_NODES]);
+    memcpy(image + h.offsets[SEC_KD_AXIS], m->kd.axis, h.sizes[SEC_KD_AXIS]);
+    memcpy(image + h.offsets[SEC_SEGMENT_FROM], m->segments.from, h.sizes[SEC_SEGMENT_FROM]);
+    memcpy(image + h.offsets[SEC_SEGMENT_TO], m->segments.to, h.sizes[SEC_SEGMENT_TO]);
+    memcpy(image + h.offsets[SEC_SEGMENT_WAYS], m->segments.ways, h.sizes[SEC_SEGMENT_WAYS]);
+    memcpy(image + h.offsets[SEC_SEGMENT_TREE], m->segments.tree.nodes, h.sizes[SEC_SEGMENT_TREE]);
+    memcpy(image + h.offsets[SEC_SEGMENT_AXIS], m->segments.tree.axis, h.sizes[SEC_SEGMENT_AXIS]);
+    memcpy(image + h.offsets[SEC_SEGMENT_REACH], m->segments.reach, h.sizes[SEC_SEGMENT_REACH]);
+
+    uint64_t header_size = ALIGN8(sizeof(struct snapshot_header));
+    h.checksum = snapshot_checksum(image + header_size, h.file_size - header_size);
+    memcpy(image, &h, sizeof(h));
+
+    FILE *f = fopen(filename, "wb");
+    bool ok = f != NULL && fwrite(image, 1, h.file_size, f) == h.file_size;
+    if (f != NULL && fclose(f) != 0) {
+        ok = false;
+    }
+    free(image);
+    return ok;
+}
+
+/**
+ * Checks that an offsets array of a snapshot is non-decreasing and stays within its data.
+ *
+ * @param offsets The array of count + 1 offsets.
+ * @param count The number of entries the offsets index.
+ * @param limit The length of the array the offsets point into.
+ * @return true if the offsets are well-formed.
+ */
+static bool
+snapshot_offsets_valid(const int *offsets, int count, int limit)
+{
+    if (offsets[0] != 0 || offsets[count] != limit) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (offsets[i] > offsets[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that every id in an array of a snapshot refers to a valid slot.
+ *
+ * @param ids The array of ids.
+ * @param count The number of ids.
+ * @param limit The number of slots; valid ids are in [0, limit).
+ * @param allow_invalid Whether INVALID_ID, an empty slot, is accepted as well.
+ * @return true if all ids are in range.
+ */
+static bool
+snapshot_ids_valid(const int *ids, int count, int limit, bool allow_invalid)
+{
+    for (int i = 0; i < count; i++) {
+        if (allow_invalid && ids[i] == INVALID_ID) {
+            continue;
+        }
+        if (ids[i] < 0 || ids[i] >= limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that every id in an index array of a snapshot refers to a slot that is in use.
+ *
+ * @param ids The array of ids.
+ * @param count The number of ids.
+ * @param flags The flags of the slots, which must have SNAPSHOT_PRESENT set.
+ * @param limit The number of slots.
+ * @return true if all ids refer to existing nodes or ways.
+ *
+ * The indexes only ever list existing nodes and ways, and their searches look them up without
+ * checking, so an id of an empty slot is as malformed as one out of range.
+ */
+static bool
+snapshot_ids_present(const int *ids, int count, const uint8_t *flags, int limit)
+{
+    for (int i = 0; i < count; i++) {
+        if (ids[i] < 0 || ids[i] >= limit || !(flags[ids[i]] & SNAPSHOT_PRESENT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Points one CSR adjacency at the sections of a mapped snapshot.
+ *
+ * @param adj The adjacency to fill in.
+ * @param base Start of the mapped snapshot.
+ * @param h Its header.
+ * @param first The section holding the offsets of this adjacency.
+ * @return true if the adjacency is well-formed.
+ */
+static bool
+snapshot_get_adjacency(struct adjacency *adj, char *base, const struct snapshot_header *h, int first)
+{
+    adj->num_edges = h->num_edges;
+    adj->offsets = (int *)(base + h->offsets[first]);
+    adj->targets = (int *)(base + h->offsets[first + 1]);
+    adj->way_ids = (int *)(base + h->offsets[first + 2]);
+    adj->weights = (double *)(base + h->offsets[first + 3]);
+    adj->lengths = (double *)(base + h->offsets[first + 4]);
+    return snapshot_offsets_valid(adj->offsets, h->num_nodes, h->num_edges) &&
+           snapshot_ids_valid(adj->targets, h->num_edges, h->num_nodes, false) &&
+           snapshot_ids_valid(adj->way_ids, h->num_edges, h->num_ways, false);
+}
+
+/**
+ * Loads a map from a binary snapshot written by ssmap_save.
+ *
+ * @param filename The snapshot to load.
+ * @return A ready-to-use ssmap structure, or NULL if the file cannot be read, is not a
+ *         snapshot of this version and byte order, fails its checksum or is malformed.
+ *
+ * The file is mapped read-only with a single mmap, so its pages are shared by all processes
+ * that load the same snapshot. After the header, checksum and the consistency of every id and
+ * offset have been verified, the map is pieced together without copying the bulk data: way
+ * names and node lists, node positions, both adjacencies and every index point straight into
+ * the mapping.
+ * Only the node and way structures themselves are allocated, in one array each, together with
+ * one array backing all the nodes' way pointers. ssmap_initialize is then run to build anything
+ * the snapshot does not contain.
+ */
+struct ssmap *
+ssmap_load_snapshot(const char * filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < ALIGN8(sizeof(struct snapshot_header))) {
+        close(fd);
+        return NULL;
+    }
+
+    char *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct snapshot_header h;
+    struct ssmap *m = NULL;
+    memcpy(&h, base, sizeof(h));
+
+    // Reject anything that is not an intact snapshot of this exact format.
+    uint64_t header_size = ALIGN8(sizeof(struct snapshot_header));
+    struct snapshot_header expected = h;
+    if (h.num_nodes <= 0 || h.num_ways <= 0 || h.num_node_ways < 0 || h.num_way_nodes < 0 ||
+        h.names_size < 0 || h.num_edges < 0 || h.num_grams < 0 || h.num_gram_ways < 0 ||
+        h.num_junction_nodes < 0 || h.num_junctions < 0 || h.kd_size < 0 || h.kd_size > h.num_nodes ||
+        h.num_segments < 0) {
+        goto fail;
+    }
+    snapshot_layout(&expected);
+    if (memcmp(h.magic, SSMAP_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != SNAPSHOT_VERSION || h.byte_order != SNAPSHOT_BYTE_ORDER ||
+        h.file_size != (uint64_t)st.st_size || memcmp(&expected, &h, sizeof(h)) != 0 ||
+        snapshot_checksum(base + header_size, h.file_size - header_size) != h.checksum) {
+        goto fail;
+    }
+
+    const uint8_t *node_flags = (const uint8_t *)(base + h.offsets[SEC_NODE_FLAGS]);
+    const double *coords = (const double *)(base + h.offsets[SEC_NODE_COORDS]);
+    const int *node_way_offsets = (const int *)(base + h.offsets[SEC_NODE_WAY_OFFSETS]);
+    const int *node_way_ids = (const int *)(base + h.offsets[SEC_NODE_WAY_IDS]);
+    const uint8_t *way_flags = (const uint8_t *)(base + h.offsets[SEC_WAY_FLAGS]);
+    const float *speeds = (const float *)(base + h.offsets[SEC_WAY_SPEEDS]);
+    const int *name_offsets = (const int *)(base + h.offsets[SEC_WAY_NAME_OFFSETS]);
+    char *names = base + h.offsets[SEC_NAMES];
+    const int *way_node_offsets = (const int *)(base + h.offsets[SEC_WAY_NODE_OFFSETS]);
+    int *way_node_ids = (int *)(base + h.offsets[SEC_WAY_NODE_IDS]);
+    const int *gram_offsets = (const int *)(base + h.offsets[SEC_GRAM_OFFSETS]);
+    const int *gram_ways = (const int *)(base + h.offsets[SEC_GRAM_WAYS]);
+    const int *junction_node_offsets = (const int *)(base + h.offsets[SEC_JUNCTION_NODE_OFFSETS]);
+    const int *junction_nodes = (const int *)(base + h.offsets[SEC_JUNCTION_NODES]);
+    const int *junction_offsets = (const int *)(base + h.offsets[SEC_JUNCTION_OFFSETS]);
+    const int *junctions = (const int *)(base + h.offsets[SEC_JUNCTIONS]);
+    const int *kd_nodes = (const int *)(base + h.offsets[SEC_KD_NODES]);
+    const uint8_t *kd_axis = (const uint8_t *)(base + h.offsets[SEC_KD_AXIS]);
+    const int *segment_from = (const int *)(base + h.offsets[SEC_SEGMENT_FROM]);
+    const int *segment_to = (const int *)(base + h.offsets[SEC_SEGMENT_TO]);
+    const int *segment_ways = (const int *)(base + h.offsets[SEC_SEGMENT_WAYS]);
+    const int *segment_tree = (const int *)(base + h.offsets[SEC_SEGMENT_TREE]);
+    const uint8_t *segment_axis = (const uint8_t *)(base + h.offsets[SEC_SEGMENT_AXIS]);
+
+    // A way id repeated in the source map leaves empty way slots in nodes.
+    if (!snapshot_offsets_valid(node_way_offsets, h.num_nodes, h.num_node_ways) ||
+        !snapshot_ids_valid(node_way_ids, h.num_node_ways, h.num_ways, true) ||
+        !snapshot_offsets_valid(way_node_offsets, h.num_ways, h.num_way_nodes) ||
+        !snapshot_ids_valid(way_node_ids, h.num_way_nodes, h.num_nodes, false) ||
+        (h.names_size > 0 && names[h.names_size - 1] != '\0')) {
+        goto fail;
+    }
+    if (!snapshot_offsets_valid(gram_offsets, h.num_grams, h.num_gram_ways) ||
+        !snapshot_ids_present(gram_ways, h.num_gram_ways, way_flags, h.num_ways) ||
+        !snapshot_offsets_valid(junction_node_offsets, h.num_ways, h.num_junction_nodes) ||
+        !snapshot_ids_present(junction_nodes, h.num_junction_nodes, node_flags, h.num_nodes) ||
+        !snapshot_offsets_valid(junction_offsets, h.num_ways, h.num_junctions) ||
+        !snapshot_ids_present(junctions, h.num_junctions, node_flags, h.num_nodes) ||
+        !snapshot_ids_present(kd_nodes, h.kd_size, node_flags, h.num_nodes) ||
+        !snapshot_ids_present(segment_from, h.num_segments, node_flags, h.num_nodes) ||
+        !snapshot_ids_present(segment_to, h.num_segments, node_flags, h.num_nodes) ||
+        !snapshot_ids_present(segment_ways, h.num_segments, way_flags, h.num_ways) ||
+        !snapshot_ids_valid(segment_tree, h.num_segments, h.num_segments, false)) {
+        goto fail;
+    }
+    for (int i = 0; i < h.kd_size; i++) {
+        if (kd_axis[i] > 2) {
+            goto fail;
+        }
+    }
+    for (int i = 0; i < h.num_segments; i++) {
+        if (segment_axis[i] > 2) {
+            goto fail;
+        }
+    }
+    for (int i = 0; i < h.num_ways; i++) {
+        if ((way_flags[i] & SNAPSHOT_PRESENT) && (name_offsets[i] < 0 || name_offsets[i] >= h.names_size)) {
+            goto fail;
+        }
+    }
+
+    m = ssmap_create(h.num_nodes, h.num_ways);
+    if (m == NULL) {
+        goto fail;
+    }
+    m->snapshot = base;
+    m->snapshot_size = h.file_size;
+    m->max_speed = h.max_speed;
+
+    // The ways' names and node lists stay in the read-only mapping; nothing writes to them.
+    // Only the structures themselves and the nodes' way pointers are taken from the arenas.
+    for (int i = 0; i < h.num_ways; i++) {
+        if (!(way_flags[i] & SNAPSHOT_PRESENT)) {
+            continue;
+        }
+        struct way *way = arena_alloc(&m->way_arena, sizeof(struct way));
+        if (way == NULL) {
+            ssmap_destroy(m);
+            return NULL;
+        }
+        way->id = i;
+        way->name = names + name_offsets[i];
+        way->max_speed = speeds[i];
+        way->one_way = (way_flags[i] & SNAPSHOT_ONE_WAY) != 0;
+        way->node_ids = way_node_ids + way_node_offsets[i];
+        way->num_nodes = way_node_offsets[i + 1] - way_node_offsets[i];
+        m->ways[i] = way;
+    }
+
+    for (int i = 0; i < h.num_nodes; i++) {
+        if (!(node_flags[i] & SNAPSHOT_PRESENT)) {
+            continue;
+        }
+        int num_ways = node_way_offsets[i + 1] - node_way_offsets[i];
+        struct node *node = arena_alloc(&m->node_arena, sizeof(struct node) +
+                                        num_ways * sizeof(struct way *));
+        if (node == NULL) {
+            ssmap_destroy(m);
+            return NULL;
+        }
+        node->id = i;
+        node->lat = coords[2 * i];
+        node->lon = coords[2 * i + 1];
+        node->ways = (struct way **)(node + 1);
+        node->num_ways = num_ways;
+        for (int j = 0; j < node->num_ways; j++) {
+            int way_id = node_way_ids[node_way_offsets[i] + j];
+            node->ways[j] = way_id != INVALID_ID ? m->ways[way_id] : NULL;
+        }
+        m->nodes[i] = node;
+    }
+
+    m->xyz = (double *)(base + h.offsets[SEC_XYZ]);
+    m->names.grams = (uint32_t *)(base + h.offsets[SEC_GRAMS]);
+    m->names.offsets = (int *)gram_offsets;
+    m->names.ways = (int *)gram_ways;
+    m->names.num_grams = h.num_grams;
+    m->junctions.node_offsets = (int *)junction_node_offsets;
+    m->junctions.nodes = (int *)junction_nodes;
+    m->junctions.junction_offsets = (int *)junction_offsets;
+    m->junctions.junctions = (int *)junctions;
+    m->kd.nodes = (int *)kd_nodes;
+    m->kd.axis = (unsigned char *)kd_axis;
+    m->kd.size = h.kd_size;
+    m->segments.from = (int *)segment_from;
+    m->segments.to = (int *)segment_to;
+    m->segments.ways = (int *)segment_ways;
+    m->segments.num_segments = h.num_segments;
+    m->segments.tree.nodes = (int *)segment_tree;
+    m->segments.tree.axis = (unsigned char *)segment_axis;
+    m->segments.tree.size = h.num_segments;
+    m->segments.reach = (double *)(base + h.offsets[SEC_SEGMENT_REACH]);
+    if (!snapshot_get_adjacency(&m->forward, base, &h, SEC_FORWARD_OFFSETS) ||
+        !snapshot_get_adjacency(&m->reverse, base, &h, SEC_REVERSE_OFFSETS) ||
+        !ssmap_initialize(m)) {
+        ssmap_destroy(m);
+        return NULL;
+    }
+
+    return m;
+
+fail:
+    munmap(base, st.st_size);
+    return NULL;
+}
+
+/**
+ * Prints information about a specific way within the Simple Street Map (ssmap).
+ *
+ * @param m Pointer to the ssmap structure from which the way's information will be printed.
+ * @param id The unique identifier of the way to be printed.
+ *
+ * This function looks up a way by its identifier within the provided ssmap structure
+ * and prints its details, including its ID and name. If the specified way ID is out of range
+ * or does not correspond to an existing way in the map, an error message is printed instead.
+ *
+ */
+void
+ssmap_print_way(const struct ssmap * m, int id)
 {
     // Validate the way ID is within the valid range and the way exists.
     if (id < 0 || id >= m->num_ways || m->ways[id] == NULL) {
         // If the way ID is invalid or the way does not exist, print an error message.
-        printf("error: way %d does not exist\n", id);
+        fprintf(output(), "error: way %d does not exist\n", id);
+    } else {
+        // If the way exists, retrieve the pointer to the way structure.
+        struct way *way_to_print = m->ways[id];
+        // Retrieve the pointer to the way's name for easier access.
+        char *name_ptr = way_to_print->name;
+        // Print the way's ID and name.
+        fprintf(output(), "Way %d: %s\n", id, name_ptr);
+
+    }
+
+}
+
+/**
+ * Prints information about a specific node within the Simple Street Map (ssmap).
+ *
+ * @param m Pointer to the ssmap structure from which the node's information will be printed.
+ * @param id The unique identifier of the node to be printed.
+ *
+ * This function searches for a node by its identifier within the provided ssmap structure
+ * and prints its details, including its ID, latitude, and longitude. If the specified node ID
+ * is out of range or does not correspond to an existing node in the map, an error message is
+ * printed instead.
+ *
+ */
+void
+ssmap_print_node(const struct ssmap * m, int id)
+{
+    // Validate the node ID is within the valid range and the node exists.
+    if (id < 0 || id >= m->num_nodes || m->nodes[id] == NULL) {
+        // If the node ID is invalid or the node does not exist, print an error message.
+        fprintf(output(), "error: node %d does not exist\n", id);
+    } else {
+        // If the node exists, retrieve the pointer to the node structure.
+        struct node *node_to_print = m->nodes[id];
+        // Print the node's ID and its coordinates (latitude and longitude) to a precision of 6 decimal places.
+        fprintf(output(), "Node %d: (%.7f, %.7f)\n", id, node_to_print->lat, node_to_print->lon);
+
+    }
+
+}
+
+/**
+ * Looks up the stored length and travel time of the edge from one node to another.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @param from_id The node the edge starts at.
+ * @param to_id The node the edge ends at.
+ * @param way_id If not NULL, receives the id of the way the edge belongs to.
+ * @param length If not NULL, receives the length of the edge in metres.
+ * @param minutes If not NULL, receives the travel time along the edge in minutes.
+ * @return true if both nodes exist and an edge leads directly from from_id to to_id,
+ *         false otherwise (the output parameters are then left untouched).
+ *
+ * The values are the ones computed by ssmap_initialize, so no distance is recomputed. If several
+ * ways connect the two nodes, the fastest edge is reported.
+ */
+bool
+ssmap_edge_info(const struct ssmap * m, int from_id, int to_id,
+                int * way_id, double * length, double * minutes)
+{
+    // Validate both node IDs before looking at the adjacency.
+    if (from_id < 0 || from_id >= m->num_nodes || m->nodes[from_id] == NULL ||
+        to_id < 0 || to_id >= m->num_nodes || m->nodes[to_id] == NULL) {
+        return false;
+    }
+
+    int e = find_edge(m, from_id, to_id);
+    if (e < 0) {
+        return false;
+    }
+
+    if (way_id != NULL) {
+        *way_id = m->forward.way_ids[e];
+    }
+    if (length != NULL) {
+        *length = m->forward.lengths[e];
+    }
+    if (minutes != NULL) {
+        *minutes = m->forward.weights[e];
+    }
+    return true;
+
+}
+
+/**
+ * Prints the stored length and travel time of the edge from one node to another.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @param from_id The node the edge starts at.
+ * @param to_id The node the edge ends at.
+ *
+ * This function validates both node ids, then prints the way, length and travel time found by
+ * ssmap_edge_info. If no edge leads directly from from_id to to_id (for example because the
+ * nodes are not adjacent, or only connected against the direction of a one-way street), an
+ * error message is printed instead.
+ */
+void
+ssmap_print_edge(const struct ssmap * m, int from_id, int to_id)
+{
+    int way_id;
+    double length, minutes;
+
+    // Validate the node IDs so that the error names the offending node.
+    if (from_id < 0 || from_id >= m->num_nodes || m->nodes[from_id] == NULL) {
+        fprintf(output(), "error: node %d does not exist\n", from_id);
+    } else if (to_id < 0 || to_id >= m->num_nodes || m->nodes[to_id] == NULL) {
+        fprintf(output(), "error: node %d does not exist\n", to_id);
+    } else if (!ssmap_edge_info(m, from_id, to_id, &way_id, &length, &minutes)) {
+        fprintf(output(), "error: there is no edge from node %d to node %d\n", from_id, to_id);
+    } else {
+        fprintf(output(), "Edge %d -> %d: way %d, %.1f metres, %.4f minutes\n",
+               from_id, to_id, way_id, length, minutes);
+    }
+
+}
+
+/**
+ * Finds the posting list of a trigram.
+ *
+ * @param index Pointer to the trigram index.
+ * @param gram The trigram, as packed by TRIGRAM.
+ * @param length Receives the number of ways in the list.
+ * @return The ways whose names contain the trigram, in ascending order; *length is 0 if none do.
+ */
+static const int *
+name_index_lookup(const struct name_index *index, uint32_t gram, int *length)
+{
+    int lo = 0, hi = index->num_grams;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->grams[mid] < gram) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == index->num_grams || index->grams[lo] != gram) {
+        *length = 0;
+        return NULL;
+    }
+    *length = index->offsets[lo + 1] - index->offsets[lo];
+    return index->ways + index->offsets[lo];
+}
+
+/**
+ * Tells whether a sorted array of ints contains a value, by binary search.
+ */
+static bool
+sorted_contains(const int *items, int count, int value)
+{
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (items[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < count && items[lo] == value;
+}
+
+/**
+ * Finds the ways whose names contain a keyword.
+ *
+ * @param m Pointer to the ssmap structure to be searched.
+ * @param name The keyword.
+ * @param ways Set to a malloc'ed array of the ids of the matching ways, in ascending order, which
+ *        the caller must free. It is NULL if no way can match.
+ * @return The number of matching ways, or -1 if memory runs out.
+ *
+ * A name can only contain the keyword if it contains every trigram of the keyword, so the
+ * candidates are the ways in all of the keyword's posting lists. The shortest list is taken as
+ * the first set of candidates, and every other list (shortest first) removes the candidates it
+ * does not contain, until none are left. Only the candidates that remain are compared with
+ * strstr, which rules out names that contain the trigrams in a different arrangement. For a
+ * selective keyword this takes time proportional to its rarest trigram's posting list, however
+ * many ways the map has; the array of candidates is sized by that list too. Keywords shorter
+ * than three bytes have no trigrams, so for them every name is compared, and the array grows
+ * with the matches.
+ */
+static int
+find_ways(const struct ssmap * m, const char * name, int ** ways)
+{
+    int count = 0;
+    size_t length = strlen(name);
+
+    *ways = NULL;
+    if (length < 3) {
+        int capacity = 0;
+        for (int i = 0; i < m->num_ways; i++) {
+            if (m->ways[i] == NULL || strstr(m->ways[i]->name, name) == NULL) {
+                continue;
+            }
+            if (count == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 16;
+                int *grown = realloc(*ways, capacity * sizeof(int));
+                if (grown == NULL) {
+                    free(*ways);
+                    *ways = NULL;
+                    return -1;
+                }
+                *ways = grown;
+            }
+            (*ways)[count++] = i;
+        }
+        return count;
+    }
+
+    // Look up the posting list of each trigram; any trigram no name contains rules out all ways.
+    // The shortest FIND_MAX_LISTS lists are kept, shortest first, by insertion sort. Fewer lists
+    // only leave more candidates, which the final check removes, so the arrays can be of fixed
+    // size however long the keyword is, and stay small enough for any thread's stack.
+    const int *lists[FIND_MAX_LISTS];
+    int lengths[FIND_MAX_LISTS];
+    int num_lists = 0;
+    for (size_t k = 0; k + 2 < length; k++) {
+        int n;
+        const int *list = name_index_lookup(&m->names, TRIGRAM(name + k), &n);
+        if (n == 0) {
+            return 0;
+        }
+        if (num_lists == FIND_MAX_LISTS && n >= lengths[num_lists - 1]) {
+            continue;
+        }
+        int j = num_lists < FIND_MAX_LISTS ? num_lists++ : num_lists - 1;
+        for (; j > 0 && n < lengths[j - 1]; j--) {
+            lists[j] = lists[j - 1];
+            lengths[j] = lengths[j - 1];
+        }
+        lists[j] = list;
+        lengths[j] = n;
+    }
+
+    // Every match is in the shortest list, so the candidates start out as its copy.
+    int *candidates = malloc(lengths[0] * sizeof(int));
+    if (candidates == NULL) {
+        return -1;
+    }
+    memcpy(candidates, lists[0], lengths[0] * sizeof(int));
+    count = lengths[0];
+    for (int k = 1; k < num_lists && count > 0; k++) {
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (sorted_contains(lists[k], lengths[k], candidates[i])) {
+                candidates[kept++] = candidates[i];
+            }
+        }
+        count = kept;
+    }
+
+    // Verify the candidates against the whole keyword.
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (strstr(m->ways[candidates[i]]->name, name) != NULL) {
+            candidates[kept++] = candidates[i];
+        }
+    }
+    *ways = candidates;
+    return kept;
+}
+
+/**
+ * Looks up the ways whose names contain a keyword.
+ *
+ * @param m Pointer to the ssmap structure to be searched.
+ * @param name The keyword.
+ * @param way_ids Room for capacity way ids, which receives the ids of the matching ways in
+ *        ascending order.
+ * @param capacity The number of entries way_ids has room for.
+ * @return The number of matching ways, which may exceed capacity, or -1 if memory runs out.
+ *
+ * This function runs the trigram search of find_ways, and as many of the matches as fit are
+ * copied to the caller's buffer.
+ */
+int
+ssmap_find_ways(const struct ssmap * m, const char * name, int way_ids[], int capacity)
+{
+    int *ways;
+    int count = find_ways(m, name, &ways);
+    for (int i = 0; i < count && i < capacity; i++) {
+        way_ids[i] = ways[i];
+    }
+    free(ways);
+    return count;
+}
+
+/**
+ * Searches for and prints the IDs of all ways within the Simple Street Map (ssmap)
+ * that contain a specified name.
+ *
+ * @param m Pointer to the ssmap structure to be searched.
+ * @param name The name (or substring of the name) to search for within the ways' names.
+ *
+ * This function looks up the ways whose names contain the specified search string with
+ * find_ways, which only compares the names that share all of its trigrams, and prints their IDs
+ * to the standard output in ascending order. This allows for a simple search functionality
+ * within the map, useful for identifying specific roads or paths by name or part of a name.
+ *
+ * Note: The search is case-sensitive and looks for the presence of the specified name
+ * as a substring within each way's name, using the strstr() function from the C standard library.
+ */
+void
+ssmap_find_way_by_name(const struct ssmap * m, const char * name)
+{
+    int *ways;
+
+    // Print the ID of every matching way.
+    int count = find_ways(m, name, &ways);
+    for (int i = 0; i < count; i++) {
+        fprintf(output(), "%d ", ways[i]);
+    }
+    free(ways);
+
+    // Print a newline character after listing all matching way IDs to format the output.
+    fprintf(output(), "\n");
+}
+
+/**
+ * Tells whether a node lies on a way from a set other than a given way.
+ *
+ * @param node The node.
+ * @param way The id of the way to disregard.
+ * @param ways The set of ways, as ascending way ids.
+ * @param count The number of ways in the set.
+ * @return true if one of the node's ways other than 'way' is in the set, false otherwise.
+ */
+static bool
+node_meets_other_way(const struct node *node, int way, const int *ways, int count)
+{
+    for (int j = 0; j < node->num_ways; j++) {
+        if (node->ways[j] == NULL) {
+            continue;
+        }
+        int id = node->ways[j]->id;
+        if (id != way && sorted_contains(ways, count, id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Orders ints ascending, for qsort.
+ */
+static int
+compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Finds the nodes connected to ways that contain specified names.
+ *
+ * @param m Pointer to the ssmap structure to be searched.
+ * @param name1 The first name (or substring of the name) to search for within the ways' names.
+ * @param name2 The second name (or substring of the name) to search for within the ways' names.
+ *        If name2 is NULL, the function will only search for name1.
+ * @param nodes Set to a malloc'ed array of the matching node ids, in ascending order, which the
+ *        caller must free.
+ * @return The number of matching nodes, or -1 if memory runs out.
+ *
+ * This function finds nodes that are connected to ways containing either one or both specified
+ * names in their names. It first identifies all ways that match each name with find_ways. If
+ * name2 is NULL, every node of a way matching name1 matches. Otherwise a node matches if it
+ * lies on two different ways, one matching each name. Such a node is a junction of both ways, so
+ * only the junction lists of the ways matching one of the names have to be checked, and the
+ * function picks whichever name has the fewer junctions. Its cost, and the memory it takes,
+ * depend on the ways that match, not on the size of the map.
+ */
+static int
+find_nodes(const struct ssmap * m, const char * name1, const char * name2, int ** nodes)
+{
+    const struct junction_index *index = &m->junctions;
+    int *ways[2] = { NULL, NULL };
+    int *found = NULL;
+    int result = -1;
+
+    // Find the ways whose names contain name1 and name2, and count the entries of their lists.
+    // If no way matches name1, no node can be on ways matching both, so name2 is not looked up.
+    int count[2] = { find_ways(m, name1, &ways[0]), 0 };
+    if (name2 != NULL && count[0] > 0) {
+        count[1] = find_ways(m, name2, &ways[1]);
+    }
+    if (count[0] < 0 || count[1] < 0) {
+        goto out;
+    }
+    const int *offsets = name2 == NULL ? index->node_offsets : index->junction_offsets;
+    const int *lists = name2 == NULL ? index->nodes : index->junctions;
+    size_t entries[2] = { 0, 0 };
+    for (int side = 0; side < 2; side++) {
+        for (int i = 0; i < count[side]; i++) {
+            entries[side] += offsets[ways[side][i] + 1] - offsets[ways[side][i]];
+        }
+    }
+
+    // Walk the lists of the name with fewer entries; the other one only has to be looked up.
+    int side = name2 != NULL && entries[1] < entries[0];
+    found = malloc((entries[side] + 1) * sizeof(int));
+    if (found == NULL) {
+        goto out;
+    }
+    size_t num_found = 0;
+    for (int i = 0; i < count[side]; i++) {
+        int way = ways[side][i];
+        for (int k = offsets[way]; k < offsets[way + 1]; k++) {
+            int node_id = lists[k];
+            if (name2 == NULL || node_meets_other_way(m->nodes[node_id], way, ways[!side], count[!side])) {
+                found[num_found++] = node_id;
+            }
+        }
+    }
+
+    // A node on several matching ways was found once for each of them; keep it once, in order.
+    qsort(found, num_found, sizeof(int), compare_ints);
+    result = 0;
+    for (size_t i = 0; i < num_found; i++) {
+        if (i == 0 || found[i] != found[i - 1]) {
+            found[result++] = found[i];
+        }
+    }
+    *nodes = found;
+    found = NULL;
+
+out:
+    free(ways[0]);
+    free(ways[1]);
+    free(found);
+    return result;
+}
+
+/**
+ * Looks up the nodes connected to ways that contain specified names.
+ *
+ * @param m Pointer to the ssmap structure to be searched.
+ * @param name1 The first name (or substring of the name) to search for within the ways' names.
+ * @param name2 The second name, or NULL to search for name1 only.
+ * @param node_ids Room for capacity node ids, which receives the matching nodes in ascending
+ *        order.
+ * @param capacity The number of entries node_ids has room for.
+ * @return The number of matching nodes, which may exceed capacity, or -1 if memory runs out.
+ *
+ * The nodes are found with find_nodes, and as many as fit are copied to the caller's buffer.
+ */
+int
+ssmap_find_nodes(const struct ssmap * m, const char * name1, const char * name2, int node_ids[],
+                 int capacity)
+{
+    int *nodes;
+    int count = find_nodes(m, name1, name2, &nodes);
+    if (count >= 0) {
+        memcpy(node_ids, nodes, (count < capacity ? count : capacity) * sizeof(int));
+        free(nodes);
+    }
+    return count;
+}
+
+/**
+ * Searches for and prints the IDs of nodes connected to ways that contain specified names.
+ *
+ * @param m Pointer to the ssmap structure to be searched.
+ * @param name1 The first name (or substring of the name) to search for within the ways' names.
+ * @param name2 The second name (or substring of the name) to search for within the ways' names.
+ *        If name2 is NULL, the function will only search for name1.
+ *
+ * This function prints the nodes found by find_nodes, in ascending order: every node of a way
+ * matching name1 if name2 is NULL, otherwise the junctions of a way matching name1 with a
+ * different way matching name2. This function is useful for finding intersections or common
+ * points related to specified road or path names within the map.
+ */
+void
+ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2)
+{
+    int *nodes;
+    int count = find_nodes(m, name1, name2, &nodes);
+    for (int i = 0; i < count; i++) {
+        fprintf(output(), "%d ", nodes[i]);
+    }
+    if (count >= 0) {
+        free(nodes);
+    }
+
+    // Print a newline character to properly format the output.
+    fprintf(output(), "\n");
+
+}
+
+/**
+ * Finds the earliest node of a path that occurs in it more than once.
+ *
+ * @param size The number of nodes in the path.
+ * @param node_ids The IDs of the nodes in the path, in order.
+ * @return The smallest position holding a node that also occurs later in the path, -1 if every
+ *         node occurs once, or -2 if memory runs out.
+ *
+ * Each node is looked up in an open-addressing hash set of the positions seen so far, keyed by
+ * node id, so the whole path is checked in expected O(size) time.
+ */
+static int
+find_repeated_node(int size, const int node_ids[])
+{
+    int capacity = 2;
+    while (capacity < 2 * size) {
+        capacity *= 2;
+    }
+    int *slots = malloc(capacity * sizeof(int));
+    if (slots == NULL) {
+        return -2;
+    }
+    memset(slots, 0xff, capacity * sizeof(int));
+
+    int first = -1;
+    for (int i = 0; i < size; i++) {
+        uint32_t h = (uint32_t)node_ids[i] * 2654435769u;
+        h = (h ^ h >> 16) & (capacity - 1);
+        while (slots[h] >= 0 && node_ids[slots[h]] != node_ids[i]) {
+            h = (h + 1) & (capacity - 1);
+        }
+        if (slots[h] < 0) {
+            slots[h] = i;
+        } else if (first < 0 || slots[h] < first) {
+            first = slots[h];
+        }
+    }
+
+    free(slots);
+    return first;
+}
+
+// Whether a node lists a way among the ways it is part of.
+static bool
+node_has_way(const struct node *node, int way_id)
+{
+    for (int i = 0; i < node->num_ways; i++) {
+        if (node->ways[i] != NULL && node->ways[i]->id == way_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the forward adjacency has an edge from u to v on a way that v lists too. The way of
+// every edge of u is listed by u, since the edges are built from u's ways.
+static bool
+has_shared_edge(const struct ssmap *m, int u, int v)
+{
+    const struct adjacency *adj = &m->forward;
+    for (int e = adj->offsets[u]; e < adj->offsets[u + 1]; e++) {
+        if (adj->targets[e] == v && node_has_way(m->nodes[v], adj->way_ids[e])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether two nodes list a way in common.
+static bool
+nodes_share_way(const struct node *x, const struct node *y)
+{
+    for (int i = 0; i < x->num_ways; i++) {
+        if (x->ways[i] != NULL && node_has_way(y, x->ways[i]->id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Calculates the total travel time for a specified path through nodes in the Simple Street Map (ssmap).
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param size The number of nodes in the path.
+ * @param node_ids Array containing the IDs of the nodes in the path, in order.
+ * @return The total travel time for traversing the path, in minutes, or -1.0 if an error occurs.
+ *
+ * This function verifies the validity of the specified path, including the existence of each node
+ * and the connectivity between consecutive nodes as per the ways they are part of. It checks for
+ * duplicate nodes, direct connectivity, and adherence to one-way restrictions. Upon validation,
+ * it calculates the total travel time based on the distances between nodes and the speed limits
+ * of the connecting ways. The travel time is summed up and returned in minutes.
+ *
+ * Duplicates are found with a hash set, and each step of the path is looked up among the edges
+ * of the forward adjacency, which hold exactly the moves a way allows: to the next node, and
+ * unless it is one-way, to the previous one. A step with no such edge is a reverse move if the
+ * opposite edge exists, a skip if the two nodes still share a way, and otherwise has no road at
+ * all. All of this takes a single pass over the path, in time proportional to its length. When
+ * several steps are wrong, the error reported is the one the checks have always reported: every
+ * step is checked for a road before any is checked for a skip, and for a skip before any is
+ * checked for going in reverse.
+ */
+double
+ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[])
+{
+    // Preliminary checks for node existence.
+    for (int i = 0; i < size; i++) {
+        int id = node_ids[i];
+        if (id < 0 || id >= m->num_nodes || m->nodes[id] == NULL) {
+            fprintf(output(), "error: node %d does not exist.\n", id);
+            return -1.0;
+        }
+    }
+
+    // Check for duplicate nodes in the path.
+    int repeated = find_repeated_node(size, node_ids);
+    if (repeated == -2) {
+        fprintf(output(), "error: out of memory.\n");
+        return -1.0;
+    }
+    if (repeated >= 0) {
+        fprintf(output(), "error: node %d appeared more than once.\n", node_ids[repeated]);
+        return -1.0;
+    }
+
+    // The first step without a road, the first that skips nodes of a way, and the first that
+    // goes against a one-way street.
+    int no_road = -1, skip = -1, reverse = -1;
+
+    // Accumulator for travel_time to be returned.
+    double travel_time = 0.0;
+
+    for (int i = 0; i < size - 1 && no_road < 0; i++) {
+        int current = node_ids[i];
+        int next = node_ids[i + 1];
+
+        if (has_shared_edge(m, current, next)) {
+            // Sum the precomputed travel time of the fastest edge connecting the pair.
+            travel_time = travel_time + m->forward.weights[find_edge(m, current, next)];
+        } else if (has_shared_edge(m, next, current)) {
+            reverse = reverse < 0 ? i : reverse;
+        } else if (nodes_share_way(m->nodes[current], m->nodes[next])) {
+            skip = skip < 0 ? i : skip;
+        } else {
+            no_road = i;
+        }
+    }
+
+    if (no_road >= 0) {
+        fprintf(output(), "error: there are no roads between node %d and node %d.\n",
+               node_ids[no_road], node_ids[no_road + 1]);
+        return -1.0;
+    }
+
+    if (skip >= 0) {
+        fprintf(output(), "error: cannot go directly from node %d to node %d.\n",
+               node_ids[skip], node_ids[skip + 1]);
+        return -1.0;
+    }
+
+    if (reverse >= 0) {
+        fprintf(output(), "error: cannot go in reverse from node %d to node %d.\n",
+               node_ids[reverse], node_ids[reverse + 1]);
+        return -1.0;
+    }
+
+    // Return the travel time in minutes.
+    return travel_time;
+
+}
+
+/**
+ * Frees the arrays of a query workspace, but not the workspace itself.
+ *
+ * @param ctx Pointer to the workspace.
+ */
+static void
+query_ctx_release(struct ssmap_query_ctx *ctx)
+{
+    for (int side = 0; side < 2; side++) {
+        free(ctx->dist[side]);
+        free(ctx->parent[side]);
+        free(ctx->labelled[side]);
+        free(ctx->settled[side]);
+        free_min_heap(ctx->heap[side]);
+        free_radix_heap(ctx->radix[side]);
+    }
+    free(ctx->path);
+    free(ctx->edges);
+    free(ctx->stack);
+
+    // Keep the choice of queue; everything else is gone.
+    enum ssmap_queue queue = ctx->queue;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->queue = queue;
+}
+
+/**
+ * Allocates the arrays of a query workspace for maps of up to a given number of nodes.
+ *
+ * @param ctx Pointer to the workspace. Arrays it already has are freed first.
+ * @param capacity The number of nodes the arrays should have room for.
+ * @return true if all allocations succeeded, false otherwise.
+ *
+ * The stamp arrays start out zeroed and the generation at 0, so that no entry is labelled
+ * before the first query bumps the generation. Only the kind of priority queue selected in
+ * ctx->queue is allocated. If an allocation fails, the capacity is left at 0 so that the next
+ * query tries again.
+ */
+static bool
+query_ctx_reserve(struct ssmap_query_ctx *ctx, int capacity)
+{
+    query_ctx_release(ctx);
+
+    bool ok = true;
+    for (int side = 0; side < 2; side++) {
+        ctx->dist[side] = malloc(capacity * sizeof(double));
+        ctx->parent[side] = malloc(capacity * sizeof(int));
+        ctx->labelled[side] = calloc(capacity, sizeof(unsigned));
+        ctx->settled[side] = calloc(capacity, sizeof(unsigned));
+        ok = ok && ctx->dist[side] != NULL && ctx->parent[side] != NULL &&
+             ctx->labelled[side] != NULL && ctx->settled[side] != NULL;
+        if (ctx->queue == SSMAP_QUEUE_RADIX_HEAP) {
+            ctx->radix[side] = create_radix_heap(capacity);
+            ok = ok && ctx->radix[side] != NULL;
+        } else {
+            ctx->heap[side] = create_min_heap(capacity);
+            ok = ok && ctx->heap[side] != NULL;
+        }
+    }
+    ctx->path = malloc(capacity * sizeof(int));
+    ctx->edges = malloc(capacity * sizeof(int));
+    ctx->stack = malloc(capacity * sizeof(int));
+    ok = ok && ctx->path != NULL && ctx->edges != NULL && ctx->stack != NULL;
+
+    ctx->capacity = ok ? capacity : 0;
+    return ok;
+}
+
+/**
+ * Creates a workspace for queries on a map.
+ *
+ * @param m Pointer to the ssmap structure the workspace is sized for.
+ * @return A pointer to the new workspace, or NULL if memory runs out.
+ *
+ * All arrays a query needs are allocated here once, in time proportional to the number of nodes.
+ * The workspace can then be reused for any number of queries, each of which only touches the
+ * entries of the nodes it explores.
+ */
+struct ssmap_query_ctx *
+ssmap_query_ctx_create(const struct ssmap * m)
+{
+    struct ssmap_query_ctx *ctx = calloc(1, sizeof(struct ssmap_query_ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (!query_ctx_reserve(ctx, m->num_nodes)) {
+        ssmap_query_ctx_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/**
+ * Frees a query workspace.
+ *
+ * @param ctx Pointer to the workspace, or NULL.
+ */
+void
+ssmap_query_ctx_destroy(struct ssmap_query_ctx * ctx)
+{
+    if (ctx != NULL) {
+        query_ctx_release(ctx);
+        free(ctx);
+    }
+}
+
+/**
+ * Selects the priority queue a query workspace uses.
+ *
+ * @param ctx Pointer to the workspace.
+ * @param queue The kind of priority queue to use from now on.
+ * @return true upon success, false if memory ran out. The workspace then tries to allocate its
+ *         arrays again at the next query.
+ */
+bool
+ssmap_query_ctx_set_queue(struct ssmap_query_ctx * ctx, enum ssmap_queue queue)
+{
+    if (queue == ctx->queue) {
+        return true;
+    }
+    ctx->queue = queue;
+    return query_ctx_reserve(ctx, ctx->capacity);
+}
+
+/**
+ * Prepares a query workspace for a new query on a map.
+ *
+ * @param ctx Pointer to the workspace.
+ * @param m Pointer to the map that will be searched.
+ * @return true if the workspace is ready, false if it had to grow and memory ran out.
+ *
+ * Bumping the generation marks every node as unlabelled and unsettled without touching the
+ * arrays. Only when the counter wraps around, once in four billion queries, are the stamps
+ * cleared for real. The heaps are emptied in time proportional to what the last query left in
+ * them.
+ */
+static bool
+query_ctx_begin(struct ssmap_query_ctx *ctx, const struct ssmap *m)
+{
+    if (ctx->capacity < m->num_nodes && !query_ctx_reserve(ctx, m->num_nodes)) {
+        return false;
+    }
+
+    if (++ctx->generation == 0) {
+        for (int side = 0; side < 2; side++) {
+            memset(ctx->labelled[side], 0, ctx->capacity * sizeof(unsigned));
+            memset(ctx->settled[side], 0, ctx->capacity * sizeof(unsigned));
+        }
+        ctx->generation = 1;
+    }
+    ctx->num_settled = 0;
+
+    for (int side = 0; side < 2; side++) {
+        if (ctx->queue == SSMAP_QUEUE_RADIX_HEAP) {
+            clear_radix_heap(ctx->radix[side]);
+        } else {
+            clear_min_heap(ctx->heap[side]);
+        }
+    }
+    return true;
+}
+
+// The distance of node v from the origin of search 'side' in the current query, or infinity.
+static inline double
+query_dist(const struct ssmap_query_ctx *ctx, int side, int v)
+{
+    return ctx->labelled[side][v] == ctx->generation ? ctx->dist[side][v] : INFINITY;
+}
+
+// The parent of node v in search 'side' of the current query, or -1.
+static inline int
+query_parent(const struct ssmap_query_ctx *ctx, int side, int v)
+{
+    return ctx->labelled[side][v] == ctx->generation ? ctx->parent[side][v] : -1;
+}
+
+// Record a new distance and parent for node v in search 'side' of the current query.
+static inline void
+query_label(struct ssmap_query_ctx *ctx, int side, int v, double dist, int parent)
+{
+    ctx->labelled[side][v] = ctx->generation;
+    ctx->dist[side][v] = dist;
+    ctx->parent[side][v] = parent;
+}
+
+// Whether node v has been settled by search 'side' in the current query.
+static inline bool
+query_settled(const struct ssmap_query_ctx *ctx, int side, int v)
+{
+    return ctx->settled[side][v] == ctx->generation;
+}
+
+// The number of nodes in the frontier of search 'side'.
+static inline int
+queue_size(const struct ssmap_query_ctx *ctx, int side)
+{
+    return ctx->queue == SSMAP_QUEUE_RADIX_HEAP ? ctx->radix[side]->size : ctx->heap[side]->size;
+}
+
+// The smallest key in the frontier of search 'side', which must not be empty.
+static inline double
+queue_min_key(struct ssmap_query_ctx *ctx, int side)
+{
+    return ctx->queue == SSMAP_QUEUE_RADIX_HEAP ? radix_heap_min_key(ctx->radix[side])
+                                                : min_heap_min_key(ctx->heap[side]);
+}
+
+// Remove and return a node with the smallest key from the frontier of search 'side', or -1 if
+// the queue ran out of memory.
+static inline int
+queue_pop(struct ssmap_query_ctx *ctx, int side)
+{
+    return ctx->queue == SSMAP_QUEUE_RADIX_HEAP ? radix_heap_extract_min(ctx->radix[side])
+                                                : extract_min(ctx->heap[side]).node_id;
+}
+
+// Whether a queue ran out of memory during the current query, making its result unreliable.
+static inline bool
+queue_failed(const struct ssmap_query_ctx *ctx)
+{
+    return ctx->queue == SSMAP_QUEUE_RADIX_HEAP && (ctx->radix[0]->failed || ctx->radix[1]->failed);
+}
+
+// Add node v to the frontier of search 'side' with the given key, or lower its key.
+static inline void
+queue_push(struct ssmap_query_ctx *ctx, int side, int v, double key)
+{
+    if (ctx->queue == SSMAP_QUEUE_RADIX_HEAP) {
+        radix_heap_push(ctx->radix[side], v, key);
+    } else if (!is_in_min_heap(ctx->heap[side], v)) {
+        insert_min_heap(ctx->heap[side], v, key);
+    } else {
+        decrease_key(ctx->heap[side], v, key);
+    }
+}
+
+// The time it takes to cover the straight line between two positions at the map's highest speed
+// limit, in minutes: a lower bound on the travel time between them.
+static double
+straight_line_minutes(const struct ssmap * m, const double p[3], const double q[3])
+{
+    if (m->max_speed <= 0) {
+        return 0.0;
+    }
+
+    double dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+    return sqrt(dx * dx + dy * dy + dz * dz) / m->max_speed * 60;
+}
+
+/**
+ * Estimates the travel time from a node to the target, for A* search.
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param u The node to estimate from.
+ * @param target The node the search is heading for.
+ * @return A lower bound on the travel time from u to target, in minutes.
+ *
+ * No road between two nodes is shorter than their great-circle distance, and no road is faster
+ * than the map's highest speed limit, so the great-circle distance driven at that speed never
+ * overestimates the remaining travel time. The chord between the nodes' cartesian positions is
+ * never longer than the great-circle distance, differs from it by well under a metre at city
+ * scale, and costs a single square root instead of the haversine formula. Being a straight-line
+ * distance, the estimate is also consistent (it decreases by at most the weight of any edge),
+ * so a node never has to be settled twice.
+ */
+static double
+astar_heuristic(const struct ssmap * m, int u, int target)
+{
+    return straight_line_minutes(m, &m->xyz[3 * u], &m->xyz[3 * target]);
+}
+
+/**
+ * Finds the fastest path between two nodes with Dijkstra's algorithm or A*.
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param ctx The query workspace, prepared by query_ctx_begin.
+ * @param start_id The unique identifier of the starting node.
+ * @param end_id The unique identifier of the ending node.
+ * @param astar Whether to order the frontier by A*'s estimate rather than by distance alone.
+ * @return The number of nodes in the path, whose node ids are left in ctx->path from start_id
+ *         to end_id, or 0 if end_id cannot be reached.
+ *
+ * This function tracks distances, visited nodes, and parent nodes in the workspace, touching
+ * only the entries of the nodes it explores. It repeatedly settles the frontier node with the smallest key,
+ * relaxing its outgoing edges, until it settles the end node or runs out of reachable nodes.
+ * With plain Dijkstra the key is the distance from the start; with A* it is the distance plus
+ * astar_heuristic, which steers the search towards the end node so far fewer nodes are settled,
+ * while the path found is still optimal. Finally, it reconstructs the path by following the
+ * parent nodes from the end node back to the start node.
+ */
+static int
+route_unidirectional(const struct ssmap * m, struct ssmap_query_ctx * ctx, int start_id, int end_id,
+                     bool astar)
+{
+    // The workspace's distances, settled stamps and parents start out unset for every node; the
+    // priority queue starts out empty. Set the start node's distance to 0.
+    queue_push(ctx, 0, start_id, 0.0);
+    query_label(ctx, 0, start_id, 0.0, -1);
+
+    // Dijkstra's algorithm main loop.
+    while (queue_size(ctx, 0) > 0) {
+        int u = queue_pop(ctx, 0); // Extract the node with minimum key.
+        if (u < 0) {
+            break;
+        }
+        ctx->settled[0][u] = ctx->generation; // Mark the node as visited.
+        ctx->num_settled++;
+
+        // If the end node is reached, exit the loop.
+        if (u == end_id) {
+            break;
+        }
+
+        // Relax every edge leaving the current node.
+        const struct adjacency *adj = &m->forward;
+        double dist_u = ctx->dist[0][u];
+        for (int e = adj->offsets[u]; e < adj->offsets[u + 1]; ++e) {
+            int v = adj->targets[e];
+
+            // Update the distance if a shorter path is found.
+            if (!query_settled(ctx, 0, v)) {
+                double alt = dist_u + adj->weights[e];
+
+                if (alt < query_dist(ctx, 0, v)) {
+                    query_label(ctx, 0, v, alt, u);
+                    // A* orders the frontier by the estimated total travel time instead.
+                    double key = astar ? alt + astar_heuristic(m, v, end_id) : alt;
+                    // Add or update the node in the priority queue.
+                    queue_push(ctx, 0, v, key);
+                }
+            }
+        }
+    }
+
+    // Path reconstruction
+    if (query_parent(ctx, 0, end_id) == -1) {
+        return 0;
+    }
+
+    // Count the nodes on the path, then fill it in from the end node back to the start node.
+    int length = 0;
+    for (int at = end_id; at != -1; at = query_parent(ctx, 0, at)) {
+        length++;
+    }
+    int i = length;
+    for (int at = end_id; at != -1; at = query_parent(ctx, 0, at)) {
+        ctx->path[--i] = at;
+    }
+    return length;
+}
+
+/**
+ * Finds the fastest path between two nodes with bidirectional Dijkstra.
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param ctx The query workspace, prepared by query_ctx_begin.
+ * @param start_id The unique identifier of the starting node.
+ * @param end_id The unique identifier of the ending node.
+ * @return The number of nodes in the path, whose node ids are left in ctx->path from start_id
+ *         to end_id, or 0 if end_id cannot be reached.
+ *
+ * Two searches run side by side: a forward search from the start node over the forward
+ * adjacency, and a backward search from the end node over the reverse adjacency, which follows
+ * one-way streets against their direction. Each step advances the search whose frontier is
+ * closer to its origin. Whenever an edge reaches a node already labelled by the other search,
+ * the combined length is a candidate for the best path. Once the two smallest frontier keys add
+ * up to at least the best candidate, no shorter path can exist and the search stops. Each
+ * search only has to cover about half the distance between the nodes, which on a road network
+ * settles roughly half as many nodes as a single search.
+ */
+static int
+route_bidirectional(const struct ssmap * m, struct ssmap_query_ctx * ctx, int start_id, int end_id)
+{
+    // Per-direction distances, settled stamps, parents and frontiers live in the workspace. For
+    // the backward search, the parent of a node is the next node on the way to the end node.
+    const struct adjacency *adj[2] = { &m->forward, &m->reverse };
+    queue_push(ctx, 0, start_id, 0.0);
+    queue_push(ctx, 1, end_id, 0.0);
+    query_label(ctx, 0, start_id, 0.0, -1);
+    query_label(ctx, 1, end_id, 0.0, -1);
+
+    // Length of the best path found so far, and the node where its two halves meet.
+    double best = INFINITY;
+    int meet = -1;
+
+    while (queue_size(ctx, 0) > 0 && queue_size(ctx, 1) > 0) {
+        // Stop once neither frontier can lead to a path shorter than the best one.
+        double key[2] = { queue_min_key(ctx, 0), queue_min_key(ctx, 1) };
+        if (key[0] + key[1] >= best) {
+            break;
+        }
+
+        // Advance the search with the smaller frontier key.
+        int side = key[0] <= key[1] ? 0 : 1;
+        int u = queue_pop(ctx, side);
+        ctx->settled[side][u] = ctx->generation;
+        ctx->num_settled++;
+
+        double dist_u = ctx->dist[side][u];
+        for (int e = adj[side]->offsets[u]; e < adj[side]->offsets[u + 1]; ++e) {
+            int v = adj[side]->targets[e];
+            if (query_settled(ctx, side, v)) {
+                continue;
+            }
+
+            double alt = dist_u + adj[side]->weights[e];
+            if (alt < query_dist(ctx, side, v)) {
+                query_label(ctx, side, v, alt, u);
+                queue_push(ctx, side, v, alt);
+            }
+
+            // A node labelled by both searches joins a candidate path.
+            double through = query_dist(ctx, side, v) + query_dist(ctx, 1 - side, v);
+            if (through < best) {
+                best = through;
+                meet = v;
+            }
+        }
+    }
+
+    if (meet < 0) {
+        return 0;
+    }
+
+    // Walk back from the meeting node to the start node, then forward to the end node.
+    int length = 0;
+    for (int at = meet; at != -1; at = query_parent(ctx, 0, at)) {
+        length++;
+    }
+    int i = length;
+    for (int at = meet; at != -1; at = query_parent(ctx, 0, at)) {
+        ctx->path[--i] = at;
+    }
+    for (int at = query_parent(ctx, 1, meet); at != -1; at = query_parent(ctx, 1, at)) {
+        ctx->path[length++] = at;
+    }
+    return length;
+}
+
+/**
+ * Appends a value to an int_list, growing its storage as needed.
+ *
+ * @param list Pointer to the int_list to append to.
+ * @param value The value to append.
+ * @return true on success, false if memory runs out.
+ */
+static bool
+int_list_push(struct int_list *list, int value)
+{
+    if (list->size == list->capacity) {
+        int capacity = list->capacity > 0 ? 2 * list->capacity : 4;
+        int *items = realloc(list->items, capacity * sizeof(int));
+        if (items == NULL) {
+            return false;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->size++] = value;
+    return true;
+}
+
+// Maximum number of nodes a witness search may settle before giving up. Giving up early only
+// costs a possibly unnecessary shortcut, never a wrong route.
+#define CH_WITNESS_LIMIT 500
+
+// Working state of ssmap_contract while the hierarchy is being built.
+struct ch_builder {
+  const struct ssmap *m; // The map being contracted.
+  struct ch_edge *edges; // Road segments and shortcuts added so far.
+  int num_edges; // Number of entries in 'edges'.
+  int capacity; // Allocated length of 'edges'.
+  struct int_list *out; // Per node, the edges leaving it.
+  struct int_list *in; // Per node, the edges entering it.
+  bool *contracted; // Whether each node has been contracted already.
+  int *deleted_neighbors; // Per node, how many of its neighbours have been contracted.
+  double *dist; // Witness search distances, valid where stamp matches generation.
+  int *stamp; // Witness search in which each entry of 'dist' was written.
+  int generation; // Number of the current witness search.
+  min_heap *heap; // Witness search frontier.
+};
+
+/**
+ * Removes a value from an int_list, moving the last element into its place.
+ *
+ * @param list Pointer to the int_list to remove from.
+ * @param value The value to remove. Nothing happens if it is not in the list.
+ */
+static void
+int_list_remove(struct int_list *list, int value)
+{
+    for (int i = 0; i < list->size; i++) {
+        if (list->items[i] == value) {
+            list->items[i] = list->items[--list->size];
+            return;
+        }
+    }
+}
+
+/**
+ * Finds the edge from one node to another among the edges added so far.
+ *
+ * @param b Pointer to the builder.
+ * @param u The node the edge starts at.
+ * @param v The node the edge ends at.
+ * @return The index of the edge in b->edges, or -1 if there is none. Once either node has been
+ *         contracted, the edge is no longer found.
+ */
+static int
+ch_find_edge(const struct ch_builder *b, int u, int v)
+{
+    for (int i = 0; i < b->out[u].size; i++) {
+        int e = b->out[u].items[i];
+        if (b->edges[e].to == v) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Adds an edge to the hierarchy, or improves the existing edge between the same nodes.
+ *
+ * @param b Pointer to the builder.
+ * @param u The node the edge starts at.
+ * @param v The node the edge ends at.
+ * @param weight Travel time along the edge, in minutes.
+ * @param first For a shortcut, the edge from u to the contracted middle node; -1 otherwise.
+ * @param second For a shortcut, the edge from the middle node to v; -1 otherwise.
+ * @return true on success, false if memory runs out.
+ *
+ * At most one edge is kept per ordered pair of nodes. If one already exists, it is only replaced
+ * when the new weight is smaller.
+ */
+static bool
+ch_add_edge(struct ch_builder *b, int u, int v, double weight, int first, int second)
+{
+    int e = ch_find_edge(b, u, v);
+    if (e >= 0) {
+        if (weight < b->edges[e].weight) {
+            b->edges[e].weight = weight;
+            b->edges[e].children[0] = first;
+            b->edges[e].children[1] = second;
+        }
+        return true;
+    }
+
+    if (b->num_edges == b->capacity) {
+        int capacity = b->capacity > 0 ? 2 * b->capacity : 1024;
+        struct ch_edge *edges = realloc(b->edges, capacity * sizeof(struct ch_edge));
+        if (edges == NULL) {
+            return false;
+        }
+        b->edges = edges;
+        b->capacity = capacity;
+    }
+
+    e = b->num_edges++;
+    b->edges[e] = (struct ch_edge){ u, v, weight, { first, second } };
+    return int_list_push(&b->out[u], e) && int_list_push(&b->in[v], e);
+}
+
+/**
+ * Runs a witness search: a bounded Dijkstra among the nodes not contracted yet.
+ *
+ * @param b Pointer to the builder.
+ * @param source The node the search starts at.
+ * @param avoid The node being contracted, which the search must not pass through.
+ * @param limit The search stops once the frontier exceeds this distance.
+ *
+ * Afterwards, ch_witness_distance gives the length of the shortest path found to a node that
+ * avoids 'avoid'. The search also stops after settling CH_WITNESS_LIMIT nodes, so distances
+ * may be overestimated, which can only lead to extra shortcuts.
+ */
+static void
+ch_witness_search(struct ch_builder *b, int source, int avoid, double limit)
+{
+    b->generation++;
+    clear_min_heap(b->heap);
+    b->dist[source] = 0.0;
+    b->stamp[source] = b->generation;
+    insert_min_heap(b->heap, source, 0.0);
+
+    for (int settled = 0; b->heap->size > 0 && settled < CH_WITNESS_LIMIT; settled++) {
+        heap_node top = extract_min(b->heap);
+        if (top.distance > limit) {
+            break;
+        }
+
+        int u = top.node_id;
+        for (int i = 0; i < b->out[u].size; i++) {
+            const struct ch_edge *edge = &b->edges[b->out[u].items[i]];
+            int v = edge->to;
+            if (v == avoid || b->contracted[v]) {
+                continue;
+            }
+
+            double alt = top.distance + edge->weight;
+            if (b->stamp[v] != b->generation) {
+                b->stamp[v] = b->generation;
+                b->dist[v] = alt;
+                insert_min_heap(b->heap, v, alt);
+            } else if (alt < b->dist[v]) {
+                b->dist[v] = alt;
+                decrease_key(b->heap, v, alt);
+            }
+        }
+    }
+}
+
+// Distance to a node found by the last witness search, or infinity if it was not reached.
+static double
+ch_witness_distance(const struct ch_builder *b, int v)
+{
+    return b->stamp[v] == b->generation ? b->dist[v] : INFINITY;
+}
+
+/**
+ * Contracts a node, or simulates doing so.
+ *
+ * @param b Pointer to the builder.
+ * @param v The node to contract.
+ * @param simulate If true, only count the shortcuts that would be needed.
+ * @return The number of shortcuts needed, or -1 if memory runs out.
+ *
+ * For every pair of remaining neighbours u -> v -> w, a shortcut u -> w replacing the two edges
+ * is needed unless a witness search from u finds another path to w that is at most as fast.
+ */
+static int
+ch_contract_node(struct ch_builder *b, int v, bool simulate)
+{
+    int shortcuts = 0;
+
+    for (int i = 0; i < b->in[v].size; i++) {
+        int first = b->in[v].items[i];
+        int u = b->edges[first].from;
+        double to_v = b->edges[first].weight;
+        if (b->contracted[u]) {
+            continue;
+        }
+
+        // The witness search only has to look as far as the longest path through v.
+        double limit = -1;
+        for (int j = 0; j < b->out[v].size; j++) {
+            const struct ch_edge *edge = &b->edges[b->out[v].items[j]];
+            if (!b->contracted[edge->to] && edge->to != u && to_v + edge->weight > limit) {
+                limit = to_v + edge->weight;
+            }
+        }
+        if (limit < 0) {
+            continue;
+        }
+
+        ch_witness_search(b, u, v, limit);
+
+        for (int j = 0; j < b->out[v].size; j++) {
+            int second = b->out[v].items[j];
+            int w = b->edges[second].to;
+            double weight = to_v + b->edges[second].weight;
+            if (b->contracted[w] || w == u || ch_witness_distance(b, w) <= weight) {
+                continue;
+            }
+
+            shortcuts++;
+            if (!simulate && !ch_add_edge(b, u, w, weight, first, second)) {
+                return -1;
+            }
+        }
+    }
+
+    return shortcuts;
+}
+
+/**
+ * Computes the contraction priority of a node; nodes with smaller values are contracted first.
+ *
+ * @param b Pointer to the builder.
+ * @param v The node to rate.
+ * @return The priority, or NAN if memory runs out.
+ *
+ * The priority is twice the edge difference (shortcuts added minus edges removed by contracting
+ * v) plus the number of neighbours already contracted, which spreads contraction evenly over the
+ * map and keeps the hierarchy shallow. Weighting the edge difference more heavily keeps the
+ * number of shortcuts down.
+ */
+static double
+ch_priority(struct ch_builder *b, int v)
+{
+    int shortcuts = ch_contract_node(b, v, true);
+    if (shortcuts < 0) {
+        return NAN;
+    }
+
+    int removed = 0;
+    for (int i = 0; i < b->in[v].size; i++) {
+        removed += !b->contracted[b->edges[b->in[v].items[i]].from];
+    }
+    for (int i = 0; i < b->out[v].size; i++) {
+        removed += !b->contracted[b->edges[b->out[v].items[i]].to];
+    }
+
+    return 2 * (shortcuts - removed) + b->deleted_neighbors[v];
+}
+
+/**
+ * Stores the edges between nodes of increasing rank in CSR form.
+ *
+ * @param h Pointer to the hierarchy, whose rank and edges are already filled in.
+ * @param num_nodes The number of nodes in the map.
+ * @param upward true to group the edges leading upwards by their source, false to group the
+ *        edges leading downwards by their target.
+ * @return true on success, false if memory runs out.
+ */
+static bool
+ch_build_search_graph(struct hierarchy *h, int num_nodes, bool upward)
+{
+    struct adjacency *adj = upward ? &h->up : &h->down;
+    int count = 0;
+
+    for (int e = 0; e < h->num_edges; e++) {
+        count += (h->rank[h->edges[e].from] < h->rank[h->edges[e].to]) == upward;
+    }
+    if (!alloc_adjacency(adj, num_nodes, count)) {
+        return false;
+    }
+
+    // Count the edges of every node, turn the counts into offsets, then place the edges.
+    for (int e = 0; e < h->num_edges; e++) {
+        const struct ch_edge *edge = &h->edges[e];
+        if ((h->rank[edge->from] < h->rank[edge->to]) == upward) {
+            adj->offsets[(upward ? edge->from : edge->to) + 1]++;
+        }
+    }
+    for (int u = 0; u < num_nodes; u++) {
+        adj->offsets[u + 1] += adj->offsets[u];
+    }
+    for (int e = 0; e < h->num_edges; e++) {
+        const struct ch_edge *edge = &h->edges[e];
+        if ((h->rank[edge->from] < h->rank[edge->to]) == upward) {
+            int u = upward ? edge->from : edge->to;
+            int i = adj->offsets[u]++;
+            adj->targets[i] = upward ? edge->to : edge->from;
+            adj->way_ids[i] = e;
+            adj->weights[i] = edge->weight;
+            adj->lengths[i] = 0;
+        }
+    }
+    for (int u = num_nodes; u > 0; u--) {
+        adj->offsets[u] = adj->offsets[u - 1];
+    }
+    adj->offsets[0] = 0;
+
+    return true;
+}
+
+/**
+ * Frees the working state of ssmap_contract.
+ *
+ * @param b Pointer to the builder. The structure itself is not freed.
+ */
+static void
+free_ch_builder(struct ch_builder *b)
+{
+    for (int i = 0; b->out != NULL && i < b->m->num_nodes; i++) {
+        free(b->out[i].items);
+    }
+    for (int i = 0; b->in != NULL && i < b->m->num_nodes; i++) {
+        free(b->in[i].items);
+    }
+    free(b->out);
+    free(b->in);
+    free(b->edges);
+    free(b->contracted);
+    free(b->deleted_neighbors);
+    free(b->dist);
+    free(b->stamp);
+    free_min_heap(b->heap);
+}
+
+/**
+ * Builds a contraction hierarchy for the map.
+ *
+ * @param m Pointer to the ssmap structure, after ssmap_initialize.
+ * @param num_shortcuts If not NULL, receives the number of shortcut edges that were added.
+ * @return true on success, false if memory runs out.
+ *
+ * Nodes are contracted one at a time, least important first, as rated by ch_priority. The
+ * priorities are updated lazily: a node taken from the queue is rated again and only contracted
+ * if it is still the least important. Contracting a node removes it from the remaining graph,
+ * adding a shortcut between each pair of its neighbours whose fastest connection ran through it.
+ * Each shortcut remembers the two edges it replaces, so routes can be unpacked back to road
+ * segments. The rank of a node is its position in the contraction order. Finally, the edges
+ * leading to higher-ranked nodes are stored for the forward query and those coming from
+ * higher-ranked nodes for the backward query, both in CSR form.
+ */
+bool
+ssmap_contract(struct ssmap * m, int * num_shortcuts)
+{
+    int n = m->num_nodes;
+    struct ch_builder b = { .m = m };
+    struct hierarchy *h = calloc(1, sizeof(struct hierarchy));
+    min_heap *order = create_min_heap(n);
+
+    b.out = calloc(n, sizeof(struct int_list));
+    b.in = calloc(n, sizeof(struct int_list));
+    b.contracted = calloc(n, sizeof(bool));
+    b.deleted_neighbors = calloc(n, sizeof(int));
+    b.dist = malloc(n * sizeof(double));
+    b.stamp = calloc(n, sizeof(int));
+    b.heap = create_min_heap(n);
+    if (h == NULL || order == NULL || b.out == NULL || b.in == NULL || b.contracted == NULL ||
+        b.deleted_neighbors == NULL || b.dist == NULL || b.stamp == NULL || b.heap == NULL) {
+        goto fail;
+    }
+    h->rank = malloc(n * sizeof(int));
+    if (h->rank == NULL) {
+        goto fail;
+    }
+
+    // Start from the road segments, keeping only the fastest edge between two nodes.
+    for (int u = 0; u < n; u++) {
+        for (int e = m->forward.offsets[u]; e < m->forward.offsets[u + 1]; e++) {
+            if (!ch_add_edge(&b, u, m->forward.targets[e], m->forward.weights[e], -1, -1)) {
+                goto fail;
+            }
+        }
+    }
+
+    for (int v = 0; v < n; v++) {
+        double priority = ch_priority(&b, v);
+        if (isnan(priority)) {
+            goto fail;
+        }
+        insert_min_heap(order, v, priority);
+    }
+
+    for (int rank = 0; order->size > 0; ) {
+        int v = extract_min(order).node_id;
+
+        // Lazy update: put the node back if it is no longer the least important one.
+        double priority = ch_priority(&b, v);
+        if (isnan(priority)) {
+            goto fail;
+        }
+        if (order->size > 0 && priority > min_heap_min_key(order)) {
+            insert_min_heap(order, v, priority);
+            continue;
+        }
+
+        if (ch_contract_node(&b, v, false) < 0) {
+            goto fail;
+        }
+        b.contracted[v] = true;
+        h->rank[v] = rank++;
+
+        // Detach v from the remaining graph, so later searches do not have to skip its edges.
+        for (int i = 0; i < b.out[v].size; i++) {
+            int e = b.out[v].items[i];
+            b.deleted_neighbors[b.edges[e].to]++;
+            int_list_remove(&b.in[b.edges[e].to], e);
+        }
+        for (int i = 0; i < b.in[v].size; i++) {
+            int e = b.in[v].items[i];
+            b.deleted_neighbors[b.edges[e].from]++;
+            int_list_remove(&b.out[b.edges[e].from], e);
+        }
+    }
+
+    // The builder's edge array becomes the hierarchy's.
+    h->edges = b.edges;
+    h->num_edges = b.num_edges;
+    b.edges = NULL;
+    for (int e = 0; e < h->num_edges; e++) {
+        h->num_shortcuts += h->edges[e].children[0] >= 0;
+    }
+
+    if (!ch_build_search_graph(h, n, true) || !ch_build_search_graph(h, n, false)) {
+        goto fail;
+    }
+
+    free_ch_builder(&b);
+    free_min_heap(order);
+    free_hierarchy(m->hierarchy);
+    m->hierarchy = h;
+    if (num_shortcuts != NULL) {
+        *num_shortcuts = h->num_shortcuts;
+    }
+    return true;
+
+fail:
+    free_ch_builder(&b);
+    free_min_heap(order);
+    free_hierarchy(h);
+    return false;
+}
+
+/**
+ * Appends the road segments an edge of the hierarchy stands for to a path.
+ *
+ * @param h Pointer to the hierarchy.
+ * @param e The edge to unpack.
+ * @param path The path, which already ends with the edge's source node.
+ * @param length Pointer to the number of nodes in the path, updated as nodes are appended.
+ * @param capacity The number of entries the path has room for.
+ * @param stack Scratch space for as many edge ids as the path has room for.
+ *
+ * Shortcuts are replaced by the two edges they stand for until only road segments remain,
+ * whose target nodes are appended in order. An explicit stack avoids recursion.
+ */
+static void
+ch_unpack_edge(const struct hierarchy *h, int e, int path[], int *length, int capacity, int stack[])
+{
+    int top = 0;
+    stack[top++] = e;
+
+    while (top > 0) {
+        const struct ch_edge *edge = &h->edges[stack[--top]];
+        if (edge->children[0] >= 0 && top + 2 <= capacity) {
+            // Push the second half first so that the first half is unpacked first.
+            stack[top++] = edge->children[1];
+            stack[top++] = edge->children[0];
+        } else if (*length < capacity) {
+            path[(*length)++] = edge->to;
+        }
+    }
+}
+
+/**
+ * Finds the fastest path between two nodes with the contraction hierarchy.
+ *
+ * @param m Pointer to the ssmap structure, on which ssmap_contract has been run.
+ * @param ctx The query workspace, prepared by query_ctx_begin.
+ * @param start_id The unique identifier of the starting node.
+ * @param end_id The unique identifier of the ending node.
+ * @return The number of nodes in the path, whose node ids are left in ctx->path from start_id
+ *         to end_id, or 0 if end_id cannot be reached.
+ *
+ * Like route_bidirectional, this runs a forward search from the start node and a backward search
+ * from the end node, but both only follow edges leading to higher-ranked nodes. The fastest path
+ * always climbs to its highest-ranked node and descends from there, so the two searches meet
+ * at that node after exploring only a small part of the map. Each side stops once its frontier
+ * key reaches the best path found. The edges of the path are then unpacked into road segments.
+ */
+static int
+route_hierarchy(const struct ssmap * m, struct ssmap_query_ctx * ctx, int start_id, int end_id)
+{
+    const struct hierarchy *h = m->hierarchy;
+    const struct adjacency *adj[2] = { &h->up, &h->down };
+    // The parents recorded in the workspace are the hierarchy edges nodes were reached over.
+    queue_push(ctx, 0, start_id, 0.0);
+    queue_push(ctx, 1, end_id, 0.0);
+    query_label(ctx, 0, start_id, 0.0, -1);
+    query_label(ctx, 1, end_id, 0.0, -1);
+
+    double best = INFINITY;
+    int meet = -1;
+
+    while (true) {
+        // Pick the side with the smaller frontier key among those that can still improve.
+        bool open[2];
+        double key[2];
+        for (int side = 0; side < 2; side++) {
+            key[side] = queue_size(ctx, side) > 0 ? queue_min_key(ctx, side) : INFINITY;
+            open[side] = key[side] < best;
+        }
+        if (!open[0] && !open[1]) {
+            break;
+        }
+        int side = !open[0] || (open[1] && key[1] < key[0]);
+
+        int u = queue_pop(ctx, side);
+        ctx->num_settled++;
+
+        // A node reached from both ends joins a candidate path.
+        double through = query_dist(ctx, 0, u) + query_dist(ctx, 1, u);
+        if (through < best) {
+            best = through;
+            meet = u;
+        }
+
+        double dist_u = ctx->dist[side][u];
+        for (int e = adj[side]->offsets[u]; e < adj[side]->offsets[u + 1]; ++e) {
+            int v = adj[side]->targets[e];
+            double alt = dist_u + adj[side]->weights[e];
+            if (alt < query_dist(ctx, side, v)) {
+                // The edge id was stored in the way_ids array of the search graph.
+                query_label(ctx, side, v, alt, adj[side]->way_ids[e]);
+                queue_push(ctx, side, v, alt);
+            }
+        }
+    }
+
+    if (meet < 0) {
+        return 0;
+    }
+
+    // Collect the edges from the start node up to the meeting node, in order.
+    int *edges = ctx->edges;
+    int count = 0;
+    for (int at = meet; query_parent(ctx, 0, at) != -1; at = h->edges[query_parent(ctx, 0, at)].from) {
+        count++;
+    }
+    int i = count;
+    for (int at = meet; query_parent(ctx, 0, at) != -1; at = h->edges[query_parent(ctx, 0, at)].from) {
+        edges[--i] = query_parent(ctx, 0, at);
+    }
+    // Then the edges from the meeting node down to the end node.
+    for (int at = meet; query_parent(ctx, 1, at) != -1 && count < m->num_nodes;
+         at = h->edges[query_parent(ctx, 1, at)].to) {
+        edges[count++] = query_parent(ctx, 1, at);
+    }
+
+    int length = 0;
+    ctx->path[length++] = start_id;
+    for (i = 0; i < count; i++) {
+        ch_unpack_edge(h, edges[i], ctx->path, &length, m->num_nodes, ctx->stack);
+    }
+    return length;
+}
+
+/**
+ * Runs the search of a route query, leaving the path in the workspace.
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param ctx The query workspace to use.
+ * @param start_id The starting node, which must exist.
+ * @param end_id The ending node, which must exist.
+ * @param mode The search algorithm to use.
+ * @return The number of nodes on the path in ctx->path, 0 if there is none, or -1 if memory ran
+ *         out.
+ */
+static int
+find_route(const struct ssmap *m, struct ssmap_query_ctx *ctx, int start_id, int end_id,
+           enum ssmap_route_mode mode)
+{
+    if (!query_ctx_begin(ctx, m)) {
+        return -1;
+    }
+
+    int length;
+    if (start_id == end_id) {
+        ctx->path[0] = start_id;
+        length = 1;
+    } else if (mode == SSMAP_ROUTE_HIERARCHY && m->hierarchy != NULL) {
+        length = route_hierarchy(m, ctx, start_id, end_id);
+    } else if (mode == SSMAP_ROUTE_BIDIRECTIONAL || mode == SSMAP_ROUTE_HIERARCHY) {
+        length = route_bidirectional(m, ctx, start_id, end_id);
     } else {
-        // If the way exists, retrieve the pointer to the way structure.
-        struct way *way_to_print = m->ways[id];
-        // Retrieve the pointer to the way's name for easier access.
-        char *name_ptr = way_to_print->name;
-        // Print the way's ID and name.
-        printf("Way %d: %s\n", id, name_ptr);
+        length = route_unidirectional(m, ctx, start_id, end_id, mode == SSMAP_ROUTE_ASTAR);
+    }
+
+    // A queue that ran out of memory may have cut the search short.
+    return queue_failed(ctx) ? -1 : length;
+}
+
+/**
+ * Finds the fastest path from a start node to an end node within the Simple Street Map (ssmap).
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param ctx The query workspace to use, or NULL to allocate one just for this query.
+ * @param start_id The unique identifier of the starting node.
+ * @param end_id The unique identifier of the ending node.
+ * @param mode The search algorithm to use.
+ * @param route The caller's node_ids buffer and its capacity, which receives the path, its
+ *        length, its travel time and the number of nodes settled to find it.
+ * @return true upon success, including when there is no path; false if a node id is invalid or
+ *         memory runs out. Nothing is printed.
+ *
+ * This function finds the fastest path from the start node to the end node based on the travel
+ * times stored in the forward adjacency. With a reused workspace, a query costs time proportional
+ * to the part of the map it explores rather than to the size of the map. Every mode returns an
+ * optimal path; they differ only in how much of the map they explore, which route->settled
+ * reports. The travel time is the sum of the edges along the path, the same figure
+ * ssmap_path_travel_time gives for it.
+ */
+bool
+ssmap_route(const struct ssmap * m, struct ssmap_query_ctx * ctx, int start_id, int end_id,
+            enum ssmap_route_mode mode, struct ssmap_route * route)
+{
+    if (start_id < 0 || start_id >= m->num_nodes || m->nodes[start_id] == NULL ||
+        end_id < 0 || end_id >= m->num_nodes || m->nodes[end_id] == NULL) {
+        return false;
+    }
+
+    // Without a workspace from the caller, use one just for this query.
+    struct ssmap_query_ctx *own = NULL;
+    if (ctx == NULL && (ctx = own = ssmap_query_ctx_create(m)) == NULL) {
+        return false;
+    }
+
+    int length = find_route(m, ctx, start_id, end_id, mode);
+    bool ok = length >= 0;
+    if (ok) {
+        route->num_nodes = length;
+        route->minutes = length > 0 ? 0.0 : -1.0;
+        for (int i = 0; i < length; i++) {
+            if (i < route->capacity) {
+                route->node_ids[i] = ctx->path[i];
+            }
+            if (i > 0) {
+                route->minutes += m->forward.weights[find_edge(m, ctx->path[i - 1], ctx->path[i])];
+            }
+        }
+        route->settled = ctx->num_settled;
+    }
+
+    ssmap_query_ctx_destroy(own);
+    return ok;
+}
+
+/**
+ * Generates and prints a path from a start node to an end node within the Simple Street Map (ssmap).
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param start_id The unique identifier of the starting node.
+ * @param end_id The unique identifier of the ending node.
+ *
+ * This function runs Dijkstra's algorithm on a workspace of its own; see ssmap_path_create_with.
+ */
+void
+ssmap_path_create(const struct ssmap * m, int start_id, int end_id)
+{
+    ssmap_path_create_with(m, NULL, start_id, end_id, SSMAP_ROUTE_DIJKSTRA);
+}
+
+/**
+ * Generates and prints a path from a start node to an end node within the Simple Street Map (ssmap).
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param ctx The query workspace to use, or NULL to allocate one just for this query.
+ * @param start_id The unique identifier of the starting node.
+ * @param end_id The unique identifier of the ending node.
+ * @param mode The search algorithm to use.
+ *
+ * This function validates both node ids, finds the fastest path the way ssmap_route does and
+ * prints it straight from the workspace, so nothing sized by the map is allocated per query.
+ * Nothing is printed if the end node cannot be reached.
+ */
+void
+ssmap_path_create_with(const struct ssmap * m, struct ssmap_query_ctx * ctx, int start_id,
+                       int end_id, enum ssmap_route_mode mode)
+{
+    // Validate start and end node existence.
+    if (start_id < 0 || start_id >= m->num_nodes || m->nodes[start_id] == NULL) {
+        fprintf(output(), "error: node %d does not exist.\n", start_id);
+        return;
+    }
+
+    if (end_id < 0 || end_id >= m->num_nodes || m->nodes[end_id] == NULL) {
+        fprintf(output(), "error: node %d does not exist.\n", end_id);
+        return;
+    }
+
+    // Handle the case where the start and end nodes are the same.
+    if (start_id == end_id) {
+        fprintf(output(), "%d %d\n", start_id, end_id);
+        return;
+    }
+
+    // Without a workspace from the caller, use one just for this query.
+    struct ssmap_query_ctx *own = NULL;
+    if (ctx == NULL && (ctx = own = ssmap_query_ctx_create(m)) == NULL) {
+        return;
+    }
+
+    // Print the path in order (start to end).
+    int length = find_route(m, ctx, start_id, end_id, mode);
+    if (length > 0) {
+        for (int i = 0; i < length; i++) {
+            fprintf(output(), "%d ", ctx->path[i]);
+        }
+        fprintf(output(), "\n");
+    }
+
+    ssmap_query_ctx_destroy(own);
+}
+
+// A node reached by the backward search from a matrix target, with its distance to that target.
+struct matrix_entry {
+  int id; // In the search space of a column, the node reached; in a node's bucket, the column.
+  double dist; // Travel time from the node to the column's target, in minutes.
+};
+
+// A travel-time matrix computation, shared by the threads working on it. Each of 'count' work
+// items is handed to the next idle thread.
+struct matrix_job {
+  const struct ssmap *m; // The map.
+  const int *sources; // Node of each row.
+  int num_sources; // Number of rows.
+  const int *targets; // Node of each column.
+  int num_targets; // Number of columns.
+  double *times; // The matrix, row by row.
+  const unsigned char *is_target; // Per node, whether it is the node of some column (Dijkstra only).
+  int num_distinct; // Number of distinct nodes among the columns (Dijkstra only).
+  struct matrix_entry **entries; // Per column, the backward search space of its node (hierarchy only).
+  int *num_entries; // Per column, the number of entries in 'entries'.
+  int *bucket_offsets; // num_nodes + 1 offsets into 'buckets', by node (hierarchy only).
+  struct matrix_entry *buckets; // All backward search entries, grouped by the node they reached.
+  bool (*work)(struct matrix_job *job, struct ssmap_query_ctx *ctx, int item); // Runs one work item.
+  int count; // Number of work items.
+  int next; // Next work item to hand out; taken with an atomic increment.
+  bool failed; // Some work item ran out of memory.
+};
+
+/**
+ * Fills in one row of a travel-time matrix with a one-to-many Dijkstra search.
+ *
+ * @param job The matrix computation.
+ * @param ctx The calling thread's query workspace.
+ * @param row The row to fill in.
+ * @return true upon success, false if the workspace could not be prepared.
+ *
+ * The search settles nodes in order of their distance from the row's source, exactly like
+ * route_unidirectional, and stops as soon as every distinct target node has been settled. Nearby
+ * targets therefore only cost the part of the map within reach of the farthest of them.
+ */
+static bool
+matrix_dijkstra_row(struct matrix_job *job, struct ssmap_query_ctx *ctx, int row)
+{
+    const struct ssmap *m = job->m;
+    if (!query_ctx_begin(ctx, m)) {
+        return false;
+    }
+
+    int source = job->sources[row];
+    int remaining = job->num_distinct;
+    queue_push(ctx, 0, source, 0.0);
+    query_label(ctx, 0, source, 0.0, -1);
+
+    while (queue_size(ctx, 0) > 0 && remaining > 0) {
+        int u = queue_pop(ctx, 0);
+        if (u < 0) {
+            return false;
+        }
+        ctx->settled[0][u] = ctx->generation;
+        if (job->is_target[u]) {
+            remaining--;
+        }
+
+        const struct adjacency *adj = &m->forward;
+        double dist_u = ctx->dist[0][u];
+        for (int e = adj->offsets[u]; e < adj->offsets[u + 1]; ++e) {
+            int v = adj->targets[e];
+            double alt = dist_u + adj->weights[e];
+            if (!query_settled(ctx, 0, v) && alt < query_dist(ctx, 0, v)) {
+                query_label(ctx, 0, v, alt, u);
+                queue_push(ctx, 0, v, alt);
+            }
+        }
+    }
+
+    double *times = job->times + (size_t)row * job->num_targets;
+    for (int j = 0; j < job->num_targets; j++) {
+        int t = job->targets[j];
+        times[j] = query_settled(ctx, 0, t) ? ctx->dist[0][t] : -1.0;
+    }
+    return true;
+}
+
+/**
+ * Runs Dijkstra's algorithm without a destination, settling every node within a distance.
+ *
+ * @param ctx The query workspace, prepared by query_ctx_begin.
+ * @param origin The node to search from.
+ * @param adj The graph to search: the forward adjacency, or the upward or downward search graph
+ *        of a contraction hierarchy.
+ * @param limit The largest distance from the origin of a node to settle, or INFINITY.
+ * @return The number of nodes settled. Their ids are left in ctx->path, in the order in which
+ *         they were settled, and their distances and parents in ctx->dist[0] and
+ *         ctx->parent[0]; or -1 if the queue ran out of memory.
+ *
+ * Like every search on a workspace, this only touches the nodes it reaches, so a small limit is
+ * cheap however large the map. Over the search graph of a hierarchy, an unlimited search explores
+ * everything above the origin, which on a road network is a few hundred nodes.
+ */
+static int
+search_space(struct ssmap_query_ctx *ctx, int origin, const struct adjacency *adj, double limit)
+{
+    int count = 0;
+    queue_push(ctx, 0, origin, 0.0);
+    query_label(ctx, 0, origin, 0.0, -1);
+
+    while (queue_size(ctx, 0) > 0 && queue_min_key(ctx, 0) <= limit) {
+        int u = queue_pop(ctx, 0);
+        if (u < 0) {
+            return -1;
+        }
+        ctx->settled[0][u] = ctx->generation;
+        ctx->path[count++] = u;
+
+        double dist_u = ctx->dist[0][u];
+        for (int e = adj->offsets[u]; e < adj->offsets[u + 1]; ++e) {
+            int v = adj->targets[e];
+            double alt = dist_u + adj->weights[e];
+            if (alt < query_dist(ctx, 0, v)) {
+                query_label(ctx, 0, v, alt, u);
+                queue_push(ctx, 0, v, alt);
+            }
+        }
+    }
+    return queue_failed(ctx) ? -1 : count;
+}
+
+/**
+ * Records the backward search space of one column of a travel-time matrix.
+ *
+ * @param job The matrix computation.
+ * @param ctx The calling thread's query workspace.
+ * @param column The column whose target node is searched from.
+ * @return true upon success, false if memory ran out.
+ */
+static bool
+matrix_backward_column(struct matrix_job *job, struct ssmap_query_ctx *ctx, int column)
+{
+    if (!query_ctx_begin(ctx, job->m)) {
+        return false;
+    }
+
+    int count = search_space(ctx, job->targets[column], &job->m->hierarchy->down, INFINITY);
+    if (count < 0) {
+        return false;
+    }
+
+    struct matrix_entry *entries = malloc((count + 1) * sizeof(struct matrix_entry));
+    if (entries == NULL) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        entries[i].id = ctx->path[i];
+        entries[i].dist = ctx->dist[0][ctx->path[i]];
+    }
+    job->entries[column] = entries;
+    job->num_entries[column] = count;
+    return true;
+}
+
+/**
+ * Fills in one row of a travel-time matrix from the buckets of the backward searches.
+ *
+ * @param job The matrix computation, whose buckets have been built.
+ * @param ctx The calling thread's query workspace.
+ * @param row The row to fill in.
+ * @return true upon success, false if memory ran out.
+ *
+ * The fastest path from the source to a target climbs to its highest-ranked node and descends
+ * from there, so that node is in both the forward search space of the source and the backward
+ * search space of the target. Every entry in the bucket of a node settled by the forward search
+ * is therefore a candidate travel time to that entry's target, and the smallest one is exact.
+ */
+static bool
+matrix_hierarchy_row(struct matrix_job *job, struct ssmap_query_ctx *ctx, int row)
+{
+    if (!query_ctx_begin(ctx, job->m)) {
+        return false;
+    }
+
+    int count = search_space(ctx, job->sources[row], &job->m->hierarchy->up, INFINITY);
+    if (count < 0) {
+        return false;
+    }
+
+    double *times = job->times + (size_t)row * job->num_targets;
+    for (int j = 0; j < job->num_targets; j++) {
+        times[j] = INFINITY;
+    }
+    for (int i = 0; i < count; i++) {
+        int u = ctx->path[i];
+        double dist_u = ctx->dist[0][u];
+        for (int b = job->bucket_offsets[u]; b < job->bucket_offsets[u + 1]; b++) {
+            const struct matrix_entry *entry = &job->buckets[b];
+            if (dist_u + entry->dist < times[entry->id]) {
+                times[entry->id] = dist_u + entry->dist;
+            }
+        }
+    }
+    for (int j = 0; j < job->num_targets; j++) {
+        if (times[j] == INFINITY) {
+            times[j] = -1.0;
+        }
+    }
+    return true;
+}
+
+/**
+ * Takes work items of a matrix computation until none are left.
+ *
+ * @param arg Pointer to the matrix_job.
+ * @return NULL.
+ *
+ * Each thread runs its searches in a query workspace of its own. A thread that cannot allocate
+ * one takes no work, which leaves it to the others.
+ */
+static void *
+matrix_worker(void *arg)
+{
+    struct matrix_job *job = arg;
+    struct ssmap_query_ctx *ctx = ssmap_query_ctx_create(job->m);
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    int item;
+    while ((item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        if (!job->work(job, ctx, item)) {
+            __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+
+    ssmap_query_ctx_destroy(ctx);
+    return NULL;
+}
+
+/**
+ * Runs every work item of a matrix computation on a number of threads.
+ *
+ * @param job The matrix computation, with 'work' and 'count' set.
+ * @param num_threads The number of threads to use, including the calling one.
+ * @return true if every work item ran successfully, false otherwise.
+ *
+ * Work items are handed out one at a time rather than in fixed ranges, because searches differ
+ * widely in cost. The calling thread works too, and also picks up what would have gone to any
+ * thread that failed to start.
+ */
+static bool
+matrix_run(struct matrix_job *job, int num_threads)
+{
+    if (num_threads > job->count) {
+        num_threads = job->count;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    job->next = 0;
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    bool *started = malloc(num_threads * sizeof(bool));
+    if (threads == NULL || started == NULL) {
+        // The calling thread can still do all the work alone.
+        num_threads = 1;
+    }
+    for (int i = 1; i < num_threads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, matrix_worker, job) == 0;
+    }
+    matrix_worker(job);
+    for (int i = 1; i < num_threads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+
+    // Items nobody took mean that no thread had a workspace.
+    return !job->failed && job->next >= job->count;
+}
+
+/**
+ * Fills in a travel-time matrix with bucket-based many-to-many search over the hierarchy.
+ *
+ * @param job The matrix computation.
+ * @param num_threads The number of threads to use.
+ * @return true upon success, false if memory ran out.
+ *
+ * A backward search from every target records, for each node it reaches, the travel time from
+ * that node to the target. These entries are then grouped into one bucket per node. A forward
+ * search from every source finally combines its distances with the buckets of the nodes it
+ * reaches. Both kinds of search only explore the hierarchy above their origin, so the cost grows
+ * with the number of sources plus targets, not with their product times the size of the map.
+ */
+static bool
+matrix_hierarchy(struct matrix_job *job, int num_threads)
+{
+    int num_nodes = job->m->num_nodes;
+    bool ok = false;
+
+    job->entries = calloc(job->num_targets, sizeof(struct matrix_entry *));
+    job->num_entries = calloc(job->num_targets, sizeof(int));
+    job->bucket_offsets = calloc(num_nodes + 1, sizeof(int));
+    if (job->entries == NULL || job->num_entries == NULL || job->bucket_offsets == NULL) {
+        goto out;
+    }
+
+    job->work = matrix_backward_column;
+    job->count = job->num_targets;
+    if (!matrix_run(job, num_threads)) {
+        goto out;
+    }
+
+    // Group the entries by node, with a counting sort.
+    int total = 0;
+    for (int j = 0; j < job->num_targets; j++) {
+        total += job->num_entries[j];
+    }
+    job->buckets = malloc((total + 1) * sizeof(struct matrix_entry));
+    if (job->buckets == NULL) {
+        goto out;
+    }
+    for (int j = 0; j < job->num_targets; j++) {
+        for (int i = 0; i < job->num_entries[j]; i++) {
+            job->bucket_offsets[job->entries[j][i].id + 1]++;
+        }
+    }
+    for (int u = 0; u < num_nodes; u++) {
+        job->bucket_offsets[u + 1] += job->bucket_offsets[u];
+    }
+    for (int j = 0; j < job->num_targets; j++) {
+        for (int i = 0; i < job->num_entries[j]; i++) {
+            const struct matrix_entry *entry = &job->entries[j][i];
+            // Each bucket's start offset serves as its cursor.
+            int b = job->bucket_offsets[entry->id]++;
+            job->buckets[b].id = j;
+            job->buckets[b].dist = entry->dist;
+        }
+    }
+    // The cursors have moved on to the start of the next bucket; shift them back.
+    memmove(job->bucket_offsets + 1, job->bucket_offsets, num_nodes * sizeof(int));
+    job->bucket_offsets[0] = 0;
+
+    job->work = matrix_hierarchy_row;
+    job->count = job->num_sources;
+    ok = matrix_run(job, num_threads);
+
+out:
+    if (job->entries != NULL) {
+        for (int j = 0; j < job->num_targets; j++) {
+            free(job->entries[j]);
+        }
+    }
+    free(job->entries);
+    free(job->num_entries);
+    free(job->bucket_offsets);
+    free(job->buckets);
+    return ok;
+}
+
+/**
+ * Computes the travel time from each of a set of nodes to each of another set of nodes.
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param num_sources The number of source nodes, i.e. rows of the matrix.
+ * @param sources The source node ids.
+ * @param num_targets The number of target nodes, i.e. columns of the matrix.
+ * @param targets The target node ids.
+ * @param times The matrix to fill in, with room for num_sources * num_targets entries. Entry
+ *        i * num_targets + j receives the travel time from sources[i] to targets[j] in minutes,
+ *        or -1 if there is no path.
+ * @param num_threads The number of threads to use.
+ * @return 0 upon success, SSMAP_ERROR_NO_NODE if a node id is invalid, or SSMAP_ERROR_NO_MEMORY
+ *         if memory ran out. Nothing is printed.
+ *
+ * This function validates every node id, then computes the whole matrix in one go. With a
+ * contraction hierarchy it runs one search per source and one per target (see
+ * matrix_hierarchy). Without one it runs a Dijkstra search from every source that stops once all
+ * targets are settled. Either way, the searches are shared out among the threads, each of which
+ * has its own query workspace; the map itself is only read. The travel times are those of the
+ * paths ssmap_path_create finds, up to rounding when a hierarchy adds up shortcuts.
+ */
+int
+ssmap_matrix(const struct ssmap * m, int num_sources, const int sources[], int num_targets,
+             const int targets[], double times[], int num_threads)
+{
+    for (int i = 0; i < num_sources + num_targets; i++) {
+        int id = i < num_sources ? sources[i] : targets[i - num_sources];
+        if (id < 0 || id >= m->num_nodes || m->nodes[id] == NULL) {
+            return SSMAP_ERROR_NO_NODE;
+        }
+    }
 
+    if (num_sources == 0 || num_targets == 0) {
+        return 0;
     }
 
+    struct matrix_job job = {
+        .m = m,
+        .sources = sources,
+        .num_sources = num_sources,
+        .targets = targets,
+        .num_targets = num_targets,
+        .times = times,
+    };
+
+    if (m->hierarchy != NULL) {
+        return matrix_hierarchy(&job, num_threads) ? 0 : SSMAP_ERROR_NO_MEMORY;
+    }
+
+    // Mark the target nodes, so that each search knows when it has settled them all.
+    unsigned char *is_target = calloc(m->num_nodes, 1);
+    if (is_target == NULL) {
+        return SSMAP_ERROR_NO_MEMORY;
+    }
+    for (int j = 0; j < num_targets; j++) {
+        job.num_distinct += !is_target[targets[j]];
+        is_target[targets[j]] = 1;
+    }
+    job.is_target = is_target;
+
+    job.work = matrix_dijkstra_row;
+    job.count = num_sources;
+    bool ok = matrix_run(&job, num_threads);
+    free(is_target);
+    return ok ? 0 : SSMAP_ERROR_NO_MEMORY;
 }
 
 /**
- * Prints information about a specific node within the Simple Street Map (ssmap).
- *
- * @param m Pointer to the ssmap structure from which the node's information will be printed.
- * @param id The unique identifier of the node to be printed.
+ * Finds every node that can be reached from a node within a travel time budget.
  *
- * This function searches for a node by its identifier within the provided ssmap structure
- * and prints its details, including its ID, latitude, and longitude. If the specified node ID
- * is out of range or does not correspond to an existing node in the map, an error message is
- * printed instead.
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param ctx The query workspace to use, or NULL to allocate one just for this query.
+ * @param start_id The unique identifier of the node to start from.
+ * @param minutes The travel time budget, in minutes.
+ * @param arrivals Receives a malloc'ed array of the nodes reached with their travel times, in
+ *        order of travel time, starting with start_id itself. The caller frees it.
+ * @return The number of nodes reached, SSMAP_ERROR_NO_NODE if start_id is invalid, or
+ *         SSMAP_ERROR_NO_MEMORY if memory ran out. Nothing is printed.
  *
+ * This is Dijkstra's algorithm from the start node, as run by ssmap_path_create, stopped once the
+ * smallest key on the frontier exceeds the budget instead of when a destination is settled. With
+ * a reused workspace it costs time proportional to the part of the map within the budget, not
+ * to the size of the map.
  */
-void
-ssmap_print_node(const struct ssmap * m, int id)
+int
+ssmap_isochrone(const struct ssmap * m, struct ssmap_query_ctx * ctx, int start_id, double minutes,
+                struct ssmap_arrival ** arrivals)
 {
-    // Validate the node ID is within the valid range and the node exists.
-    if (id < 0 || id >= m->num_nodes || m->nodes[id] == NULL) {
-        // If the node ID is invalid or the node does not exist, print an error message.
-        printf("error: node %d does not exist\n", id);
-    } else {
-        // If the node exists, retrieve the pointer to the node structure.
-        struct node *node_to_print = m->nodes[id];
-        // Print the node's ID and its coordinates (latitude and longitude) to a precision of 6 decimal places.
-        printf("Node %d: (%.7f, %.7f)\n", id, node_to_print->lat, node_to_print->lon);
+    if (start_id < 0 || start_id >= m->num_nodes || m->nodes[start_id] == NULL) {
+        return SSMAP_ERROR_NO_NODE;
+    }
+
+    // Without a workspace from the caller, use one just for this query.
+    struct ssmap_query_ctx *own = NULL;
+    if (ctx == NULL && (ctx = own = ssmap_query_ctx_create(m)) == NULL) {
+        return SSMAP_ERROR_NO_MEMORY;
+    }
+    if (!query_ctx_begin(ctx, m)) {
+        ssmap_query_ctx_destroy(own);
+        return SSMAP_ERROR_NO_MEMORY;
+    }
 
+    int count = search_space(ctx, start_id, &m->forward, minutes);
+    struct ssmap_arrival *reached = count >= 0 ? malloc((count + 1) * sizeof(*reached)) : NULL;
+    if (reached == NULL) {
+        count = SSMAP_ERROR_NO_MEMORY;
+    }
+    for (int i = 0; i < count; i++) {
+        reached[i].node_id = ctx->path[i];
+        reached[i].minutes = ctx->dist[0][ctx->path[i]];
+    }
+    if (reached != NULL) {
+        *arrivals = reached;
     }
 
+    ssmap_query_ctx_destroy(own);
+    return count;
 }
 
+// A node projected onto a plane around the area it lies in, for computing a hull.
+struct hull_point {
+  double x; // Longitude, scaled by the cosine of the area's latitude.
+  double y; // Latitude.
+  int id; // The node.
+};
+
 /**
- * Searches for and prints the IDs of all ways within the Simple Street Map (ssmap)
- * that contain a specified name.
- *
- * @param m Pointer to the ssmap structure to be searched.
- * @param name The name (or substring of the name) to search for within the ways' names.
- *
- * This function iterates over all ways in the provided ssmap structure, checking if
- * each way's name contains the specified search string. If a match is found (indicating
- * that the current way's name contains the specified name as a substring), the ID of
- * the way is printed to the standard output. This allows for a simple search functionality
- * within the map, useful for identifying specific roads or paths by name or part of a name.
- *
- * Note: The search is case-sensitive and looks for the presence of the specified name
- * as a substring within each way's name, using the strstr() function from the C standard library.
+ * Orders hull points from left to right, and from bottom to top where they line up vertically.
  */
-void
-ssmap_find_way_by_name(const struct ssmap * m, const char * name)
+static int
+compare_hull_points(const void *a, const void *b)
 {
-    // Iterate through all the ways in the map.
-    for (int i = 0; i < m->num_ways; i++) {
-        // Check if the current way is not NULL and its name contains the specified substring.
-        if (m->ways[i] != NULL && strstr(m->ways[i]->name, name) != NULL) {
-            // If a match is found, print the ID of the way.
-            printf("%d ", i);
-        }
+    const struct hull_point *p = a, *q = b;
+    if (p->x != q->x) {
+        return p->x < q->x ? -1 : 1;
     }
+    return (p->y > q->y) - (p->y < q->y);
+}
 
-    // Print a newline character after listing all matching way IDs to format the output.
-    printf("\n");
+/**
+ * Tells which way the path from a to b turns when it continues to c.
+ *
+ * @return A positive value for a left turn, a negative one for a right turn, and zero if the
+ *         three points are collinear.
+ */
+static double
+hull_turn(const struct hull_point *a, const struct hull_point *b, const struct hull_point *c)
+{
+    return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
 }
 
 /**
- * Searches for and prints the IDs of nodes connected to ways that contain specified names.
+ * Computes the convex hull of a set of nodes.
  *
- * @param m Pointer to the ssmap structure to be searched.
- * @param name1 The first name (or substring of the name) to search for within the ways' names.
- * @param name2 The second name (or substring of the name) to search for within the ways' names.
- *        If name2 is NULL, the function will only search for name1.
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param count The number of nodes.
+ * @param node_ids The nodes, which must all exist.
+ * @param hull Room for count node ids, which receives the corners of the hull.
+ * @return The number of corners, listed counterclockwise from the westernmost node, or -1 if
+ *         memory ran out.
  *
- * This function performs a search to find nodes that are connected to ways containing either
- * one or both specified names in their names. It first identifies all ways that match each
- * name and then checks each node to see if it is connected to the identified ways. If a node
- * is connected to ways containing both names (or just one name if name2 is NULL), its ID is printed.
- * This function is useful for finding intersections or common points related to specified road
- * or path names within the map.
+ * The nodes are projected onto a plane with longitudes scaled by the cosine of their mean
+ * latitude, which keeps angles true over the extent of a city. The hull is then found with
+ * Andrew's monotone chain algorithm in O(N log N) time: the nodes are sorted from west to east,
+ * and the lower and upper halves of the hull are each built in one sweep, dropping every corner
+ * at which the boundary would turn clockwise or run straight on.
  */
-void
-ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2)
+int
+ssmap_convex_hull(const struct ssmap * m, int count, const int node_ids[], int hull[])
 {
-    // Create arrays to store ways containing name1 and name2
-    int ways_with_name1[m->num_ways];
-    int num_ways_with_name1 = 0;
-    int ways_with_name2[m->num_ways];
-    int num_ways_with_name2 = 0;
+    if (count == 0) {
+        return 0;
+    }
 
-    // Populate the arrays based on whether each way contains name1 or name2 or both
-    for (int i = 0; i < m->num_ways; i++) {
-        if (strstr(m->ways[i]->name, name1) != NULL) {
-            ways_with_name1[num_ways_with_name1++] = i;
-            if (name2 != NULL && strstr(m->ways[i]->name, name2) != NULL) {
-                ways_with_name2[num_ways_with_name2++] = i;
-            }
+    struct hull_point *points = malloc(count * sizeof(struct hull_point));
+    struct hull_point **chain = malloc(2 * count * sizeof(struct hull_point *));
+    if (points == NULL || chain == NULL) {
+        free(points);
+        free(chain);
+        return -1;
+    }
+
+    double lat = 0.0;
+    for (int i = 0; i < count; i++) {
+        lat += m->nodes[node_ids[i]]->lat / count;
+    }
+    double scale = cos(d2r(lat));
+    for (int i = 0; i < count; i++) {
+        const struct node *n = m->nodes[node_ids[i]];
+        points[i].x = n->lon * scale;
+        points[i].y = n->lat;
+        points[i].id = n->id;
+    }
+    qsort(points, count, sizeof(struct hull_point), compare_hull_points);
+
+    // The lower half from west to east, then the upper half back from east to west. Each sweep
+    // ends on the point the other one starts from, which is only kept once.
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        while (size >= 2 && hull_turn(chain[size - 2], chain[size - 1], &points[i]) <= 0) {
+            size--;
         }
-        else if (name2 != NULL && strstr(m->ways[i]->name, name2) != NULL) {
-            ways_with_name2[num_ways_with_name2++] = i;
+        chain[size++] = &points[i];
+    }
+    for (int i = count - 2, lower = size + 1; i >= 0; i--) {
+        while (size >= lower && hull_turn(chain[size - 2], chain[size - 1], &points[i]) <= 0) {
+            size--;
         }
+        chain[size++] = &points[i];
+    }
+    if (size > 1) {
+        size--;
     }
 
-    // Iterate through each node to check if it's connected to the identified ways.
-    for (int i = 0; i < m->num_nodes; i++) {
-        // Access the node using node_id
-        int node_id = i;
-        const struct node *node = m->nodes[node_id];
-
-        // Allocate memory for the array of way IDs
-        int *node_way_ids = malloc(node->num_ways * sizeof(int));
-        // Ensure memory allocation succeeded.
-        if (node_way_ids == NULL) {
-            continue; // Skip this node if memory allocation failed.
-        }
+    for (int i = 0; i < size; i++) {
+        hull[i] = chain[i]->id;
+    }
+    free(points);
+    free(chain);
+    return size;
+}
 
-        // Populate the array with IDs of ways associated with the node
-        for (int j = 0; j < node->num_ways; j++) {
-            node_way_ids[j] = node->ways[j]->id;
-        }
-
-        // If only searching for name1.
-        if (name2 == NULL) {
-            // Check if the current node is connected to any way containing name1.
-            bool bool_checker = false;
-            for (int j = 0; j < node->num_ways; j++) {
-                bool found_name1 = false;
-                for (int k = 0; k < num_ways_with_name1; k++) {
-                    if (node_way_ids[j] == ways_with_name1[k]) {
-                        found_name1 = true;
-                        break; // Exit the loop once a match is found.
-                    }
-                }
+// The nearest entries found so far by a k-d tree search.
+struct kd_best {
+  int *ids; // Their node ids, nearest first.
+  double *dist; // Their squared straight-line distances from the query point, in km².
+  int count; // Number of entries found so far.
+  int k; // Number of entries wanted.
+};
 
-                if (found_name1) {
-                    bool_checker = true;
-                    break; // Exit the loop once a match is found.
-                }
+/**
+ * Offers a node to the nearest entries found by a k-d tree search.
+ *
+ * @param best The entries found so far.
+ * @param id The node.
+ * @param dist Its squared distance from the query point.
+ *
+ * The node is inserted in order of distance, after any equally near ones, if there is still
+ * room or it is nearer than the farthest entry, which then drops out.
+ */
+static void
+kd_offer(struct kd_best *best, int id, double dist)
+{
+    if (best->count == best->k && dist >= best->dist[best->count - 1]) {
+        return;
+    }
 
-            }
+    int i = best->count < best->k ? best->count++ : best->count - 1;
+    for (; i > 0 && best->dist[i - 1] > dist; i--) {
+        best->ids[i] = best->ids[i - 1];
+        best->dist[i] = best->dist[i - 1];
+    }
+    best->ids[i] = id;
+    best->dist[i] = dist;
+}
 
-            // Print the node ID if it's connected to a way containing name1.
-            if (bool_checker) {
-                printf("%d ", node_id);
-            }
+/**
+ * Searches a subtree of the k-d tree for the nodes nearest to a point.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @param q The cartesian position of the query point.
+ * @param lo The first entry of the subtree.
+ * @param hi One past the last entry of the subtree.
+ * @param best The nearest entries found so far, updated in place.
+ *
+ * The root of the subtree is offered first, then the half on the query point's side of the
+ * split, which is where the nearest nodes most likely are. The other half is only searched if
+ * the splitting plane is nearer than the farthest of the entries found, or not enough have been
+ * found yet. On a road map this visits O(log N + k) entries.
+ */
+static void
+kd_search(const struct ssmap *m, const double q[3], int lo, int hi, struct kd_best *best)
+{
+    if (lo >= hi) {
+        return;
+    }
 
+    int mid = lo + (hi - lo) / 2;
+    const double *p = &m->xyz[3 * m->kd.nodes[mid]];
+    double dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+    kd_offer(best, m->kd.nodes[mid], dx * dx + dy * dy + dz * dz);
 
+    double delta = q[m->kd.axis[mid]] - p[m->kd.axis[mid]];
+    if (delta < 0) {
+        kd_search(m, q, lo, mid, best);
+    } else {
+        kd_search(m, q, mid + 1, hi, best);
+    }
+    if (best->count < best->k || delta * delta < best->dist[best->count - 1]) {
+        if (delta < 0) {
+            kd_search(m, q, mid + 1, hi, best);
         } else {
-              // If searching for both name1 and name2.
-              bool bool_checker1 = false;
-              bool bool_checker2 = false;
-              for (int j = 0; j < node->num_ways; j++) {
-                  // Check for connections to ways containing name1.
-                  bool found_name1 = false;
-                  bool found_name2 = false;
-                  for (int k = 0; k < num_ways_with_name1; k++) {
-                      if (node_way_ids[j] == ways_with_name1[k]) {
-                          found_name1 = true;
-                          for (int l = 0; l < node->num_ways; l++) {
-                              // Check for connections to ways containing name2.
-                              for (int m = 0; m < num_ways_with_name2; m++) {
-                                  if (node_way_ids[l] == ways_with_name2[m] && ways_with_name1[k] != ways_with_name2[m]) {
-                                      found_name2 = true;
-                                      break; // Exit the loop once a match is found.
-                                  }
-                              }
-
-                              if (found_name1 && found_name2) {
-                                  break; // Exit the loop once a match is found.
-                              }
-
-                          }
-                      }
-
-                      if (found_name1 && found_name2) {
-                          break; // Exit the loop once a match is found.
-                      }
-
-                  }
+            kd_search(m, q, lo, mid, best);
+        }
+    }
+}
 
-                  if (found_name1 && found_name2) {
-                      bool_checker1 = found_name1;
-                      bool_checker2 = found_name2;
-                      break; // Exit the loop once both matches are found.
-                  }
+/**
+ * Finds the nodes nearest to a point given by its latitude and longitude.
+ *
+ * @param m Pointer to the ssmap structure representing the map.
+ * @param lat The latitude of the point, in degrees.
+ * @param lon The longitude of the point, in degrees.
+ * @param k The number of nodes to find.
+ * @param node_ids Room for k node ids, which receives the nearest nodes, nearest first.
+ * @param metres Room for k distances, which receives the great-circle distance of each node
+ *        from the point in metres, or NULL.
+ * @return The number of nodes found: k, or fewer if the map has fewer nodes, or -1 if memory ran
+ *         out.
+ *
+ * The point is placed on the same sphere as the nodes' positions, and the k-d tree built by
+ * ssmap_initialize is searched for the positions nearest to it in a straight line. Straight-line
+ * (chord) distance grows with great-circle distance, so these are also the nearest nodes along
+ * the earth's surface, and the chord is converted to the latter exactly.
+ */
+int
+ssmap_nearest_nodes(const struct ssmap * m, double lat, double lon, int k, int node_ids[],
+                    double metres[])
+{
+    if (k <= 0) {
+        return 0;
+    }
 
-              }
+    struct kd_best best = { node_ids, metres, 0, k };
+    if (metres == NULL && (best.dist = malloc(k * sizeof(double))) == NULL) {
+        return -1;
+    }
 
-              // Print the node ID if it's connected to ways containing both names.
-              if (bool_checker1 && bool_checker2) {
-                  printf("%d ", node_id);
-              }
+    double q[3];
+    position_of(lat, lon, q);
+    kd_search(m, q, 0, m->kd.size, &best);
 
+    if (metres != NULL) {
+        for (int i = 0; i < best.count; i++) {
+            double half = sqrt(metres[i]) / (2 * EARTH_RADIUS);
+            metres[i] = 2 * EARTH_RADIUS * asin(half < 1 ? half : 1) * 1000;
         }
+    } else {
+        free(best.dist);
+    }
+    return best.count;
+}
 
-        // Free the temporary array of way IDs.
-        free(node_way_ids);
+// A point on a road segment: where a position given by latitude and longitude meets the road.
+struct snap {
+  int segment; // The segment, or -1 if none has been found yet.
+  double fraction; // How far along the segment the point lies, from 0 at its start to 1 at its end.
+  double p[3]; // The cartesian position of the point.
+  double dist; // The squared straight-line distance from the position to the point, in km².
+};
 
+/**
+ * Offers a segment to a search for the one nearest to a position.
+ *
+ * @param m Pointer to the ssmap structure.
+ * @param q The cartesian position.
+ * @param s The segment.
+ * @param best The nearest point on any segment found so far, replaced if this one is nearer.
+ *
+ * The position is projected onto the chord between the ends of the segment, and the projection
+ * clamped to the segment. At the lengths of road segments the chord lies within centimetres of
+ * the great-circle arc between the ends.
+ */
+static void
+segment_offer(const struct ssmap *m, const double q[3], int s, struct snap *best)
+{
+    const double *a = &m->xyz[3 * m->segments.from[s]];
+    const double *b = &m->xyz[3 * m->segments.to[s]];
+    double ab[3], along = 0, length = 0;
+    for (int c = 0; c < 3; c++) {
+        ab[c] = b[c] - a[c];
+        along += (q[c] - a[c]) * ab[c];
+        length += ab[c] * ab[c];
     }
 
-    // Print a newline character to properly format the output.
-    printf("\n");
+    double t = length > 0 ? along / length : 0;
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    double p[3], dist = 0;
+    for (int c = 0; c < 3; c++) {
+        p[c] = a[c] + t * ab[c];
+        dist += (q[c] - p[c]) * (q[c] - p[c]);
+    }
 
+    if (dist < best->dist) {
+        best->segment = s;
+        best->fraction = t;
+        memcpy(best->p, p, sizeof(p));
+        best->dist = dist;
+    }
 }
 
 /**
- * Converts from degree to radian
+ * Searches a subtree of the segment index for the segment nearest to a position.
  *
- * @param deg The angle in degrees.
- * @return the equivalent value in radian
- */
-#define d2r(deg) ((deg) * M_PI/180.)
-
-/**
- * Calculates the distance between two nodes using the Haversine formula.
+ * @param m Pointer to the ssmap structure.
+ * @param q The cartesian position.
+ * @param lo The first entry of the subtree.
+ * @param hi One past the last entry of the subtree.
+ * @param best The nearest point on any segment found so far, updated in place.
  *
- * @param x The first node.
- * @param y the second node.
- * @return the distance between two nodes, in kilometre.
+ * This is kd_search for a single nearest entry, except that the other half of a split is only
+ * skipped once the splitting plane is farther away than the nearest point found by more than
+ * the reach of that half. Long segments therefore cost some pruning near the top of the tree,
+ * but not in the small subtrees further down where most of the search happens.
  */
-static double
-distance_between_nodes(const struct node * x, const struct node * y) {
-    double R = 6371.;
-    double lat1 = x->lat;
-    double lon1 = x->lon;
-    double lat2 = y->lat;
-    double lon2 = y->lon;
-    double dlat = d2r(lat2-lat1);
-    double dlon = d2r(lon2-lon1);
-    double a = pow(sin(dlat/2), 2) + cos(d2r(lat1)) * cos(d2r(lat2)) * pow(sin(dlon/2), 2);
-    double c = 2 * atan2(sqrt(a), sqrt(1-a));
-    return R * c;
+static void
+segment_search(const struct ssmap *m, const double q[3], int lo, int hi, struct snap *best)
+{
+    const struct segment_index *index = &m->segments;
+    if (lo >= hi) {
+        return;
+    }
+
+    int mid = lo + (hi - lo) / 2;
+    int s = index->tree.nodes[mid];
+    segment_offer(m, q, s, best);
+
+    // The midpoint is computed exactly as when the tree was built.
+    int axis = index->tree.axis[mid];
+    double split = (m->xyz[3 * index->from[s] + axis] + m->xyz[3 * index->to[s] + axis]) / 2;
+    double delta = q[axis] - split;
+    if (delta < 0) {
+        segment_search(m, q, lo, mid, best);
+        lo = mid + 1;
+    } else {
+        segment_search(m, q, mid + 1, hi, best);
+        hi = mid;
+    }
+    if (lo < hi) {
+        double gap = fabs(delta) - index->reach[lo + (hi - lo) / 2];
+        if (gap <= 0 || gap * gap < best->dist) {
+            segment_search(m, q, lo, hi, best);
+        }
+    }
 }
 
 /**
- * Calculates the total travel time for a specified path through nodes in the Simple Street Map (ssmap).
+ * Finds the fastest path between two points on road segments, with A*.
  *
  * @param m Pointer to the ssmap structure representing the map.
- * @param size The number of nodes in the path.
- * @param node_ids Array containing the IDs of the nodes in the path, in order.
- * @return The total travel time for traversing the path, in minutes, or -1.0 if an error occurs.
+ * @param ctx The query workspace, prepared by query_ctx_begin.
+ * @param from The point to start from.
+ * @param to The point to reach.
+ * @return The number of nodes the path passes through, whose node ids are left in ctx->path in
+ *         order, 0 if the path stays on a single segment, or -1 if to cannot be reached.
  *
- * This function verifies the validity of the specified path, including the existence of each node
- * and the connectivity between consecutive nodes as per the ways they are part of. It checks for
- * duplicate nodes, direct connectivity, and adherence to one-way restrictions. Upon validation,
- * it calculates the total travel time based on the distances between nodes and the speed limits
- * of the connecting ways. The travel time is summed up and returned in minutes.
+ * The two points act as virtual nodes with edges to the ends of their segments, which cost the
+ * part of the segment's travel time they cover. The start point leads to the end of its segment
+ * and, unless its way is one-way, back to the start; likewise the end point is reached from the
+ * start of its segment and, unless one-way, from its end. When both points are on the same
+ * segment, driving straight from one to the other is a candidate too. The search begins with
+ * the ends of the start segment labelled by their partial costs, and ends once no frontier key
+ * is below the best candidate; the heuristic aims at the end point itself.
  */
-double
-ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[size])
+static int
+route_between_snaps(const struct ssmap * m, struct ssmap_query_ctx * ctx, const struct snap * from,
+                    const struct snap * to)
 {
-    // Preliminary checks for node existence.
-    for (int i = 0; i < size; i++) {
-        int id = node_ids[i];
-        if (id < 0 || id >= m->num_nodes || m->nodes[id] == NULL) {
-            printf("error: node %d does not exist.\n", id);
-            return -1.0;
-        }
+    const struct segment_index *index = &m->segments;
+    const struct snap *snaps[2] = { from, to };
+    double weight[2];
+    bool one_way[2];
+    for (int i = 0; i < 2; i++) {
+        int s = snaps[i]->segment;
+        const struct way *way = m->ways[index->ways[s]];
+        double distance = distance_between_nodes(m->nodes[index->from[s]], m->nodes[index->to[s]]);
+        // The same travel time as the edge between the two nodes in the adjacency.
+        weight[i] = distance / way->max_speed * 60;
+        one_way[i] = way->one_way;
     }
 
-    // Check for duplicate nodes in the path.
-    for (int i = 0; i < size; i++) {
-        int count = 0;
-        for (int j = 0; j < size; j++) {
-            if (node_ids[j] == node_ids[i]) {
-                count++;
-            }
-        }
-        if (count > 1) {
-            printf("error: node %d appeared more than once.\n", node_ids[i]);
-            return -1.0;
+    // The nodes the search starts from and the ones it can leave the graph at, with the partial
+    // travel times to and from the points; -1 where a one-way street forbids it. A point at the
+    // very end of a one-way segment is at the node, and can use it either way.
+    int sources[2] = { index->to[from->segment],
+                       one_way[0] && from->fraction > 0 ? -1 : index->from[from->segment] };
+    double source_cost[2] = { (1 - from->fraction) * weight[0], from->fraction * weight[0] };
+    int exits[2] = { index->from[to->segment],
+                     one_way[1] && to->fraction < 1 ? -1 : index->to[to->segment] };
+    double exit_cost[2] = { to->fraction * weight[1], (1 - to->fraction) * weight[1] };
+
+    double best = INFINITY;
+    if (from->segment == to->segment) {
+        if (to->fraction >= from->fraction) {
+            best = (to->fraction - from->fraction) * weight[0];
+        } else if (!one_way[0]) {
+            best = (from->fraction - to->fraction) * weight[0];
         }
     }
 
-    // Check for Way Object connectivity between adjacent nodes in node_ids.
-    for (int i = 0; i < size - 1; i++) {
-        bool error_three_bool = false;
-        int current = node_ids[i];
-        int next = node_ids[i + 1];
-
-        struct node *node1 = m->nodes[current];
-        struct node *node2 = m->nodes[next];
-        for (int j = 0; j < node1->num_ways; j++) {
-            for (int k = 0; k < node2->num_ways; k++) {
-                if (node1->ways[j]->id == node2->ways[k]->id) {
-                    error_three_bool = true;
-                    break;
-                }
-            }
-        }
-
-        if (!error_three_bool) {
-            printf("error: there are no roads between node %d and node %d.\n", current, next);
-            return -1.0;
+    for (int i = 0; i < 2; i++) {
+        int v = sources[i];
+        if (v >= 0 && source_cost[i] < query_dist(ctx, 0, v)) {
+            query_label(ctx, 0, v, source_cost[i], -1);
+            queue_push(ctx, 0, v, source_cost[i] + straight_line_minutes(m, &m->xyz[3 * v], to->p));
         }
     }
 
-    // Check for adjacency of adjacent node ids in the Way Object connecting them.
-    for (int i = 0; i < size - 1; i++) {
-        bool error_four_bool = false;
-        int current = node_ids[i];
-        int next = node_ids[i + 1];
-
-        struct node *node1 = m->nodes[current];
-        struct node *node2 = m->nodes[next];
-        for (int j = 0; j < node1->num_ways; j++) {
-            for (int k = 0; k < node2->num_ways; k++) {
-                if (node1->ways[j]->id == node2->ways[k]->id) {
-                    for (int l = 0; l < node1->ways[j]->num_nodes - 1; l++) {
-                        if ((node1->ways[j]->node_ids[l] == current && node1->ways[j]->node_ids[l + 1] == next) || (node1->ways[j]->node_ids[l] == next && node1->ways[j]->node_ids[l + 1] == current))  {
-                            error_four_bool = true;
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-
-        if (!error_four_bool) {
-            printf("error: cannot go directly from node %d to node %d.\n", current, next);
-            return -1.0;
+    int end = -1;
+    while (queue_size(ctx, 0) > 0 && queue_min_key(ctx, 0) < best) {
+        int u = queue_pop(ctx, 0);
+        if (u < 0) {
+            break;
         }
-    }
-
-    // Check for violation of one_way-ness of Way Objects.
-    for (int i = 0; i < size - 1; i++) {
-        bool error_five_bool = false;
-        int current = node_ids[i];
-        int next = node_ids[i + 1];
+        ctx->settled[0][u] = ctx->generation;
 
-        struct node *node1 = m->nodes[current];
-        struct node *node2 = m->nodes[next];
-        for (int j = 0; j < node1->num_ways; j++) {
-            for (int k = 0; k < node2->num_ways; k++) {
-                if (node1->ways[j]->id == node2->ways[k]->id) {
-                    for (int l = 0; l < node1->ways[j]->num_nodes - 1; l++) {
-                        if (node1->ways[j]->one_way && node1->ways[j]->node_ids[l] == current && node1->ways[j]->node_ids[l + 1] == next) {
-                            error_five_bool = true;
-                            break;
-                        } else if (!node1->ways[j]->one_way && ((node1->ways[j]->node_ids[l] == current && node1->ways[j]->node_ids[l + 1] == next) || (node1->ways[j]->node_ids[l] == next && node1->ways[j]->node_ids[l + 1] == current))) {
-                              error_five_bool = true;
-                              break;
-                        }
-                    }
-                }
+        double dist_u = ctx->dist[0][u];
+        for (int i = 0; i < 2; i++) {
+            if (u == exits[i] && dist_u + exit_cost[i] < best) {
+                best = dist_u + exit_cost[i];
+                end = u;
             }
         }
 
-      if (!error_five_bool) {
-          printf("error: cannot go in reverse from node %d to node %d.\n", current, next);
-          return -1.0;
-      }
-    }
-
-    // Accumulator for travel_time to be returned.
-    double travel_time = 0.0;
-
-    // Loop over all the indices of node_ids to calculate the sole way_id
-    // connecting the each pair of Nodes
-    for (int i = 0; i < size - 1; i++) {
-        int current = node_ids[i];
-        int next = node_ids[i + 1];
-        struct node *node1 = m->nodes[current];
-        struct node *node2 = m->nodes[next];
-        int way_id = 0;
-        for (int j = 0; j < node1->num_ways; j++) {
-            for (int k = 0; k < node2->num_ways; k++) {
-                if (node1->ways[j]->id == node2->ways[k]->id) {
-                    for (int l = 0; l < node1->ways[j]->num_nodes - 1; l++) {
-                        if (node1->ways[j]->one_way && node1->ways[j]->node_ids[l] == current && node1->ways[j]->node_ids[l + 1] == next) {
-                            way_id = node1->ways[j]->id;
-                            break;
-                        } else if (!node1->ways[j]->one_way && ((node1->ways[j]->node_ids[l] == current && node1->ways[j]->node_ids[l + 1] == next) || (node1->ways[j]->node_ids[l] == next && node1->ways[j]->node_ids[l + 1] == current))) {
-                              way_id = node1->ways[j]->id;
-                              break;
-                        }
-                    }
-                }
+        const struct adjacency *adj = &m->forward;
+        for (int e = adj->offsets[u]; e < adj->offsets[u + 1]; ++e) {
+            int v = adj->targets[e];
+            double alt = dist_u + adj->weights[e];
+            if (!query_settled(ctx, 0, v) && alt < query_dist(ctx, 0, v)) {
+                query_label(ctx, 0, v, alt, u);
+                queue_push(ctx, 0, v, alt + straight_line_minutes(m, &m->xyz[3 * v], to->p));
             }
         }
+    }
 
-        // Getting the Way object for the pair of nodes.
-        struct way *way = m->ways[way_id];
-
-        // The Max speed limit of the Way Object.
-        float speed = way->max_speed;
-
-        // The distance between the nodes, calculated using the Haversine Formula.
-        double distance = distance_between_nodes(node1, node2);
-
-        // The Time taken for each pair of nodes added to the existing travel_time.
-        travel_time = travel_time + (distance / speed);
-
+    if (end < 0) {
+        return best < INFINITY ? 0 : -1;
     }
 
-    // Return the travel time in minutes.
-    return travel_time * 60;
+    int length = 0;
+    for (int at = end; at != -1; at = query_parent(ctx, 0, at)) {
+        length++;
+    }
+    int i = length;
+    for (int at = end; at != -1; at = query_parent(ctx, 0, at)) {
+        ctx->path[--i] = at;
+    }
+    return length;
+}
 
+/**
+ * Prints a point on a road segment as "@lat,lon".
+ *
+ * @param snap The point.
+ * @param separator The character to print after it.
+ */
+static void
+print_snap(const struct snap *snap, char separator)
+{
+    const double *p = snap->p;
+    double lat = atan2(p[2], sqrt(p[0] * p[0] + p[1] * p[1])) * 180 / M_PI;
+    double lon = atan2(p[1], p[0]) * 180 / M_PI;
+    fprintf(output(), "@%.7f,%.7f%c", lat, lon, separator);
 }
 
 /**
- * Generates and prints a path from a start node to an end node within the Simple Street Map (ssmap).
+ * Generates and prints the fastest path between two positions given by latitude and longitude.
  *
  * @param m Pointer to the ssmap structure representing the map.
- * @param start_id The unique identifier of the starting node.
- * @param end_id The unique identifier of the ending node.
+ * @param ctx The query workspace to use, or NULL to allocate one just for this query.
+ * @param from_lat The latitude of the position to start from, in degrees.
+ * @param from_lon The longitude of the position to start from, in degrees.
+ * @param to_lat The latitude of the position to reach, in degrees.
+ * @param to_lon The longitude of the position to reach, in degrees.
  *
- * This function implements Dijkstra's algorithm to find the shortest path from the start node to the
- * end node based on the distances between connected nodes. It initializes necessary structures for
- * tracking distances, visited nodes, and parent nodes to reconstruct the path. The function then
- * iterates through the map, updating distances and parents until it processes all reachable nodes or
- * finds the shortest path to the end node. Finally, it reconstructs and prints the path from the
- * end node back to the start node.
+ * Each position is snapped to the nearest point on any road segment, found with the segment
+ * index built by ssmap_initialize, so a position in the middle of a long street starts or ends
+ * the path there instead of at whichever end of the street happens to be closer. The path is
+ * printed as the start point, the nodes it passes through and the end point. Nothing is printed
+ * if the end point cannot be reached.
  */
 void
-ssmap_path_create(const struct ssmap * m, int start_id, int end_id)
+ssmap_path_create_between(const struct ssmap * m, struct ssmap_query_ctx * ctx, double from_lat,
+                          double from_lon, double to_lat, double to_lon)
 {
-    // Validate start and end node existence.
-    if (start_id < 0 || start_id >= m->num_nodes || m->nodes[start_id] == NULL) {
-        printf("error: node %d does not exist.\n", start_id);
+    if (m->segments.num_segments == 0) {
+        fprintf(output(), "error: the map has no roads.\n");
         return;
     }
 
-    if (end_id < 0 || end_id >= m->num_nodes || m->nodes[end_id] == NULL) {
-        printf("error: node %d does not exist.\n", end_id);
-        return;
-    }
+    struct snap from = { -1, 0, { 0, 0, 0 }, INFINITY }, to = from;
+    double q[3];
+    position_of(from_lat, from_lon, q);
+    segment_search(m, q, 0, m->segments.tree.size, &from);
+    position_of(to_lat, to_lon, q);
+    segment_search(m, q, 0, m->segments.tree.size, &to);
 
-    // Handle the case where the start and end nodes are the same.
-    if (start_id == end_id) {
-        printf("%d %d\n", start_id, end_id);
+    // Without a workspace from the caller, use one just for this query.
+    struct ssmap_query_ctx *own = NULL;
+    if (ctx == NULL && (ctx = own = ssmap_query_ctx_create(m)) == NULL) {
         return;
     }
-
-    // Initialize arrays for distances, visited flags, and parent node IDs.
-    double dist[m->num_nodes];
-    bool visited[m->num_nodes];
-    int parent[m->num_nodes];
-
-    // Initialize distances as infinite, visited as false, and parent as -1.
-    for (int i = 0; i < m->num_nodes; ++i) {
-        dist[i] = INFINITY;
-        visited[i] = false;
-        parent[i] = -1;
+    if (!query_ctx_begin(ctx, m)) {
+        ssmap_query_ctx_destroy(own);
+        return;
     }
 
-    // Initialize the priority queue (min_heap) and set the start node's distance to 0.
-    min_heap *min_heap = create_min_heap(m->num_nodes);
-    insert_min_heap(min_heap, start_id, 0.0);
-    dist[start_id] = 0.0;
-
-    // Dijkstra's algorithm main loop.
-    while (min_heap->size > 0) {
-        heap_node min_heap_node = extract_min(min_heap); // Extract the node with minimum distance.
-        int u = min_heap_node.node_id;
-        visited[u] = true; // Mark the node as visited.
-
-        // If the end node is reached, exit the loop.
-        if (u == end_id) {
-            break;
-        }
-
-        // Explore all ways connected to the current node.
-        for (int i = 0; i < m->nodes[u]->num_ways; ++i) {
-            struct way *way = m->nodes[u]->ways[i];
-
-            int node_index = find_node_index_in_way(way, u);
-
-            // Explore nodes adjacent to the current node within the way.
-            for (int offset = -1; offset <= 1; offset += 2) { // Checks both directions.
-                int next_node_index = node_index + offset;
-
-                if (next_node_index >= 0 && next_node_index < way->num_nodes) {
-                    int v = way->node_ids[next_node_index];
-
-                    // Skip reverse traversal on one-way ways.
-                    if (way->one_way && offset < 0) {
-                        continue;
-                    }
-
-                    // Update the distance if a shorter path is found.
-                    if (!visited[v] && dist[u] != INFINITY) {
-                        double alt = dist[u] + distance_between_nodes(m->nodes[u], m->nodes[v]) / way->max_speed * 60;
-
-                        if (alt < dist[v]) {
-                            dist[v] = alt;
-                            parent[v] = u;
-                            // Add or update the node in the min_heap.
-                            if (!is_in_min_heap(min_heap, v)) {
-                              insert_min_heap(min_heap, v, alt);
-                            } else {
-                              decrease_key(min_heap, v, alt);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    int length = route_between_snaps(m, ctx, &from, &to);
+    if (queue_failed(ctx)) {
+        length = -1;
     }
 
-    // Path reconstruction
-    if (parent[end_id] == -1) {
-    } else {
-        int stack[m->num_nodes], top = -1;
-        // Reconstruct the path by tracing parent nodes from the end node to the start node.
-        for (int at = end_id; at != -1; at = parent[at]) {
-            stack[++top] = at;
-        }
-        // Print the path in reverse order (start to end).
-        while (top >= 0) {
-            printf("%d ", stack[top--]);
+    if (length >= 0) {
+        print_snap(&from, ' ');
+        for (int i = 0; i < length; i++) {
+            fprintf(output(), "%d ", ctx->path[i]);
         }
-        printf("\n");
+        print_snap(&to, '\n');
     }
 
-    free_min_heap(min_heap);
+    ssmap_query_ctx_destroy(own);
 }
@@ -1,15 +1,112 @@
 #ifndef _STREETS_H_
 #define _STREETS_H_
 
+/*
+ * The public interface of the street map engine, built as libssmap.a and
+ * libssmap.so as well as into the ssmap executable.
+ *
+ * Thread safety: a map is built by one thread at a time, with ssmap_create,
+ * ssmap_add_way, ssmap_add_node (see there for the exceptions), ssmap_initialize
+ * and optionally ssmap_contract; or loaded with ssmap_load_snapshot. After that
+ * it is never modified, and any number of threads may query it at the same time
+ * through the functions taking a const struct ssmap *, provided each thread
+ * passes its own query workspace or NULL. ssmap_destroy must wait until every
+ * query has returned. The print functions write to stdout, so their lines may
+ * interleave between threads, unless each thread directs them to a stream of
+ * its own with ssmap_set_output; the ones filling in buffers print nothing.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * The version of this interface. The major version changes whenever a change
+ * breaks existing callers, the minor version when functions are added.
+ */
+#define SSMAP_VERSION_MAJOR 2
+#define SSMAP_VERSION_MINOR 0
+#define SSMAP_VERSION_PATCH 0
+#define SSMAP_VERSION "2.0.0"
+
+/**
+ * Marks the functions libssmap.so exports. Everything else is compiled with
+ * -fvisibility=hidden, so internal symbols cannot clash with the caller's.
+ */
+#if defined(__GNUC__)
+#define SSMAP_API __attribute__((visibility("default")))
+#else
+#define SSMAP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Valid node or way IDs start from 0, so we use -1 to denote invalid ID.
  */
 #define INVALID_ID (-1)
 
+/**
+ * The first 8 bytes of every binary map snapshot written by ssmap_save.
+ */
+#define SSMAP_SNAPSHOT_MAGIC "SSMB\r\n\x1a\n"
+
 struct ssmap;
 struct node;
 struct way;
 struct path;
+struct ssmap_query_ctx;
+
+/**
+ * A node reached by ssmap_isochrone, with the travel time to it.
+ */
+struct ssmap_arrival {
+    int node_id;
+    double minutes;
+};
+
+/**
+ * A route found by ssmap_route. The caller provides node_ids and capacity;
+ * the rest is filled in.
+ */
+struct ssmap_route {
+    int *node_ids;  /* Receives the nodes of the path, from start to end. */
+    int capacity;   /* Number of entries node_ids has room for. */
+    int num_nodes;  /* Number of nodes on the path, 0 if there is none. Only
+                       the first capacity of them are stored if it is more. */
+    double minutes; /* Travel time along the path, or -1 if there is none. */
+    int settled;    /* Number of nodes the search settled to find it. */
+};
+
+/**
+ * The search algorithms ssmap_path_create_with can use. All of them return an
+ * optimal path.
+ */
+enum ssmap_route_mode {
+    SSMAP_ROUTE_DIJKSTRA, /* Dijkstra's algorithm, settling nodes in order of distance. */
+    SSMAP_ROUTE_ASTAR,    /* A*, guided by the great-circle distance to the destination. */
+    SSMAP_ROUTE_BIDIRECTIONAL, /* Dijkstra from both ends, meeting in the middle. */
+    SSMAP_ROUTE_HIERARCHY, /* Contraction hierarchy query, see ssmap_contract. */
+};
+
+/**
+ * The priority queues route queries can keep their frontier in. Both give the
+ * same routes.
+ */
+enum ssmap_queue {
+    SSMAP_QUEUE_BINARY_HEAP, /* Binary min-heap with decrease-key; the default. */
+    SSMAP_QUEUE_RADIX_HEAP,  /* Monotone radix heap over the bits of the keys. */
+};
+
+/**
+ * Why a call that reports errors through its int result failed. All of them
+ * are negative, so they cannot be mistaken for a count.
+ */
+enum ssmap_error {
+    SSMAP_ERROR_NO_NODE = -1,   /* A node id does not refer to a node of the map. */
+    SSMAP_ERROR_NO_MEMORY = -2, /* Memory ran out. */
+};
 
 /**
  * Create a new ssmap data structure.
@@ -18,15 +115,35 @@ struct path;
  * @param nr_ways Maximum number of ways that will be added.
  * @return A heap-allocated ssmap structure or NULL if malloc fails.
  */
-struct ssmap * ssmap_create(int nr_nodes, int nr_ways);
+SSMAP_API struct ssmap * ssmap_create(int nr_nodes, int nr_ways);
 
 /**
  * Perform any other initialization after ways and nodes have been added.
  *
+ * From here on the map is read-only: queries keep all their state in a
+ * query workspace or in memory of their own, so threads may share the map.
+ *
  * @param m The ssmap data structure to be initialized.
  * @return true upon successful initialization, false otherwise.
  */
-bool ssmap_initialize(struct ssmap * m);
+SSMAP_API bool ssmap_initialize(struct ssmap * m);
+
+/**
+ * Build a contraction hierarchy for fast point-to-point routing.
+ *
+ * This is an optional preprocessing step run after ssmap_initialize. Nodes
+ * are contracted from least to most important, and shortcut edges are added
+ * wherever a contracted node lay on a fastest path between two of its
+ * neighbours. Queries with SSMAP_ROUTE_HIERARCHY then only have to search
+ * upwards in the hierarchy from both ends. Calling it again rebuilds the
+ * hierarchy. This modifies the map, so no query may run at the same time.
+ *
+ * @param m The ssmap data structure to be contracted.
+ * @param num_shortcuts If not NULL, receives the number of shortcuts added.
+ * @return true upon success, false if memory runs out. The map remains
+ *         usable either way.
+ */
+SSMAP_API bool ssmap_contract(struct ssmap * m, int * num_shortcuts);
 
 /**
  * Destroy an existing ssmap data structure.
@@ -35,7 +152,51 @@ bool ssmap_initialize(struct ssmap * m);
  * allocated memory associated with the structure, including the nodes and
  * ways that have been added.
  */
-void ssmap_destroy(struct ssmap * m);
+SSMAP_API void ssmap_destroy(struct ssmap * m);
+
+/**
+ * Write a binary snapshot of an initialized map.
+ *
+ * The snapshot is a versioned, checksummed image of the nodes, ways, names,
+ * and the adjacency and indexes built by ssmap_initialize. It is meant to be
+ * loaded with ssmap_load_snapshot, on a machine with the same byte order.
+ *
+ * @param m The ssmap data structure to save.
+ * @param filename The file to write.
+ * @return true upon success, false if the file could not be written.
+ */
+SSMAP_API bool ssmap_save(const struct ssmap * m, const char * filename);
+
+/**
+ * Load a map from a binary snapshot written by ssmap_save.
+ *
+ * The file is mapped into memory and used in place, so loading takes about
+ * as long as reading the file once to verify its checksum, and processes
+ * loading the same snapshot share its pages. The returned map is already
+ * initialized and must be released with ssmap_destroy.
+ *
+ * @param filename The snapshot file.
+ * @return A heap-allocated ssmap structure, or NULL if the file cannot be
+ *         read, is not a valid snapshot, or fails its checksum.
+ */
+SSMAP_API struct ssmap * ssmap_load_snapshot(const char * filename);
+
+/**
+ * Return the number of node slots, i.e. the nr_nodes passed to ssmap_create.
+ */
+SSMAP_API int ssmap_num_nodes(const struct ssmap * m);
+
+/**
+ * Return the number of way slots, i.e. the nr_ways passed to ssmap_create.
+ */
+SSMAP_API int ssmap_num_ways(const struct ssmap * m);
+
+/**
+ * Look up the position of a node.
+ *
+ * @return true if the node exists, in which case *lat and *lon are set.
+ */
+SSMAP_API bool ssmap_node_position(const struct ssmap * m, int id, double * lat, double * lon);
 
 /**
  * Add a new way object to the ssmap data structure.
@@ -49,10 +210,12 @@ void ssmap_destroy(struct ssmap * m);
  * @param num_nodes The number of nodes associated with this way object.
  * @param node_ids An array of node ids associated with this way object.
  * @return The way object that was just added.
+ *
+ * Ways with different ids may be added from different threads at the same time.
  */
-struct way * ssmap_add_way(struct ssmap * m, int id, const char * name, 
-                           float maxspeed, bool oneway, int num_nodes, 
-                           const int node_ids[num_nodes]);
+SSMAP_API struct way * ssmap_add_way(struct ssmap * m, int id, const char * name, 
+                                     float maxspeed, bool oneway, int num_nodes, 
+                                     const int node_ids[]);
 
 /**
  * Add a new node object to the ssmap data structure.
@@ -64,9 +227,12 @@ struct way * ssmap_add_way(struct ssmap * m, int id, const char * name,
  * @param num_ways The number of ways associated with this node object.
  * @param way_ids An array of way ids assocaited with this node object.
  * @return The node object that was just added. 
+ *
+ * All ways must have been added before any node. Nodes with different ids may
+ * be added from different threads at the same time.
  */
-struct node * ssmap_add_node(struct ssmap * m, int id, double lat, double lon, 
-                             int num_ways, const int way_ids[num_ways]);
+SSMAP_API struct node * ssmap_add_node(struct ssmap * m, int id, double lat, double lon, 
+                                       int num_ways, const int way_ids[]);
 
 /**
  * Find a way object by id, then print its information
@@ -81,7 +247,7 @@ struct node * ssmap_add_node(struct ssmap * m, int id, double lat, double lon,
  * @param m The ssmap structure where the way object should be located.
  * @param id The id of the way object to be printed.
  */
-void ssmap_print_way(const struct ssmap * m, int id);
+SSMAP_API void ssmap_print_way(const struct ssmap * m, int id);
 
 /**
  * Find a node object by id, then print its information
@@ -96,7 +262,42 @@ void ssmap_print_way(const struct ssmap * m, int id);
  * @param m The ssmap structure where the node object should be located.
  * @param id The id of the node object to be printed.
  */
-void ssmap_print_node(const struct ssmap * m, int id);
+SSMAP_API void ssmap_print_node(const struct ssmap * m, int id);
+
+/**
+ * Look up the edge leading directly from one node to another.
+ *
+ * Edge lengths and travel times are computed once by ssmap_initialize; this
+ * function only reports the stored values. If several ways connect the two
+ * nodes, the fastest edge is reported.
+ *
+ * @param m The ssmap structure where the edge is located.
+ * @param from_id The node the edge starts at.
+ * @param to_id The node the edge ends at.
+ * @param way_id If not NULL, receives the id of the way the edge belongs to.
+ * @param length If not NULL, receives the length of the edge in metres.
+ * @param minutes If not NULL, receives the travel time along the edge in minutes.
+ * @return true if the edge exists, false if either node does not exist or
+ *         the nodes are not directly connected in that direction.
+ */
+SSMAP_API bool ssmap_edge_info(const struct ssmap * m, int from_id, int to_id,
+                               int * way_id, double * length, double * minutes);
+
+/**
+ * Find the edge from one node to another, then print its information.
+ *
+ * The output has the format:
+ * Edge <from> -> <to>: way <id>, <length> metres, <time> minutes
+ *
+ * If a node id is invalid, print "error: node <id> does not exist". If the
+ * nodes are not directly connected in that direction, print "error: there is
+ * no edge from node <from> to node <to>".
+ *
+ * @param m The ssmap structure where the edge is located.
+ * @param from_id The node the edge starts at.
+ * @param to_id The node the edge ends at.
+ */
+SSMAP_API void ssmap_print_edge(const struct ssmap * m, int from_id, int to_id);
 
 /**
  * Find all way objects with a particular keyword in its name and print them.
@@ -109,7 +310,22 @@ void ssmap_print_node(const struct ssmap * m, int id);
  * @param m The ssmap structure where the way objects should be located.
  * @param name The keyword that should be used to search for way objects.
  */
-void ssmap_find_way_by_name(const struct ssmap * m, const char * name);
+SSMAP_API void ssmap_find_way_by_name(const struct ssmap * m, const char * name);
+
+/**
+ * Find all way objects with a particular keyword in their name, like
+ * ssmap_find_way_by_name, but store their ids instead of printing them.
+ *
+ * @param m The ssmap structure where the way objects should be located.
+ * @param name The keyword that should be used to search for way objects.
+ * @param way_ids Receives the ids of the matching ways, in ascending order.
+ * @param capacity The number of entries way_ids has room for. No more than
+ *                 ssmap_num_ways(m) ways can match.
+ * @return The number of matching ways, which may be more than capacity, in
+ *         which case only the first capacity are stored; or -1 if malloc fails.
+ */
+SSMAP_API int ssmap_find_ways(const struct ssmap * m, const char * name, int way_ids[],
+                              int capacity);
 
 /**
  * Find all node objects that are associated with way objects that have the 
@@ -129,7 +345,22 @@ void ssmap_find_way_by_name(const struct ssmap * m, const char * name);
  *              This parameter is allowed to NULL. In which case, the function
  *              displays all nodes with ways that have name1 in their names.
  */
-void ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2);
+SSMAP_API void ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2);
+
+/**
+ * Find the nodes ssmap_find_node_by_names would print, and store their ids
+ * instead.
+ *
+ * @param m The ssmap structure where the node objects should be located.
+ * @param name1 The first keyword that should be used to search for a node.
+ * @param name2 The second keyword, or NULL.
+ * @param node_ids Receives the ids of the matching nodes, in ascending order.
+ * @param capacity The number of entries node_ids has room for.
+ * @return The number of matching nodes, which may be more than capacity, in
+ *         which case only the first capacity are stored; or -1 if malloc fails.
+ */
+SSMAP_API int ssmap_find_nodes(const struct ssmap * m, const char * name1,
+                               const char * name2, int node_ids[], int capacity);
 
 /**
  * Calculate the travel time of a path (an ordered array of node ids)
@@ -169,7 +400,35 @@ void ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const
  * b and c, respectively. Then the travel time would be distance(a, b) / maxspeed(x)
  * + distance(b, c) / maxspeed(y). Hint: use the distance function provided.
  */
-double ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[size]);
+SSMAP_API double ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[]);
+
+/**
+ * Create a reusable workspace for route queries on a map.
+ *
+ * The workspace holds every per-node array a query needs. It is allocated
+ * once, and each query only resets the entries it touched. A workspace may be
+ * used for one query at a time; give each thread its own.
+ *
+ * @param m The map the workspace is sized for.
+ * @return A heap-allocated workspace, or NULL if malloc fails.
+ */
+SSMAP_API struct ssmap_query_ctx * ssmap_query_ctx_create(const struct ssmap * m);
+
+/**
+ * Select the priority queue a workspace uses for its queries.
+ *
+ * @param ctx The workspace.
+ * @param queue The kind of priority queue to use.
+ * @return true upon success, false if malloc fails.
+ */
+SSMAP_API bool ssmap_query_ctx_set_queue(struct ssmap_query_ctx * ctx, enum ssmap_queue queue);
+
+/**
+ * Free a workspace created by ssmap_query_ctx_create.
+ *
+ * @param ctx The workspace to free, or NULL.
+ */
+SSMAP_API void ssmap_query_ctx_destroy(struct ssmap_query_ctx * ctx);
 
 /**
  * Compute a path from one node to another.
@@ -182,11 +441,196 @@ double ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[siz
  *
  * Note: you should try to optimize this function so that the travel time is 
  * minimized.
+ *
+ * This runs Dijkstra's algorithm on a temporary workspace; see
+ * ssmap_path_create_with to choose the algorithm and reuse a workspace.
  * 
  * @param m The ssmap structure where the path will be created.
  * @param start_id the starting node id 
  * @param end_id the destination node id
  */
-void ssmap_path_create(const struct ssmap * m, int start_id, int end_id);
+SSMAP_API void ssmap_path_create(const struct ssmap * m, int start_id, int end_id);
+
+/**
+ * Compute and print a path from one node to another, like ssmap_path_create,
+ * with the search algorithm and workspace of the caller's choosing.
+ *
+ * SSMAP_ROUTE_ASTAR estimates the remaining travel time as the great-circle
+ * distance to end_id driven at the highest speed limit in the map. This never
+ * overestimates, so the path is still optimal, but far fewer nodes are
+ * explored than with SSMAP_ROUTE_DIJKSTRA. SSMAP_ROUTE_BIDIRECTIONAL searches
+ * forward from start_id and backward from end_id at the same time (following
+ * one-way streets against their direction) and stops once the two searches
+ * meet, which roughly halves the radius that has to be explored.
+ * SSMAP_ROUTE_HIERARCHY uses the contraction hierarchy built by ssmap_contract,
+ * settling only a few hundred nodes even on large maps; without one it falls
+ * back to SSMAP_ROUTE_BIDIRECTIONAL.
+ *
+ * @param m The ssmap structure where the path will be created.
+ * @param ctx A workspace from ssmap_query_ctx_create, or NULL to use a
+ *            temporary one. Reusing a workspace makes short routes cost time
+ *            proportional to the part of the map explored, not to its size.
+ * @param start_id the starting node id
+ * @param end_id the destination node id
+ * @param mode the search algorithm to use
+ */
+SSMAP_API void ssmap_path_create_with(const struct ssmap * m, struct ssmap_query_ctx * ctx,
+                                      int start_id, int end_id, enum ssmap_route_mode mode);
+
+/**
+ * Find the fastest path between two nodes, like ssmap_path_create, but fill
+ * in a route instead of printing it. Nothing is printed, not even errors.
+ *
+ * A path from a node to itself consists of that node alone. A path that
+ * cannot fit into route->node_ids is still measured, so a caller can retry
+ * with a larger buffer; no path has more than ssmap_num_nodes(m) nodes.
+ *
+ * @param m The ssmap structure where the path will be created.
+ * @param ctx A workspace from ssmap_query_ctx_create, or NULL to use a
+ *            temporary one.
+ * @param start_id the starting node id
+ * @param end_id the destination node id
+ * @param mode the search algorithm to use
+ * @param route The buffer for the path, which receives the result.
+ * @return true upon success, also when there is no path; false if a node id
+ *         is invalid or malloc fails, in which case route is left untouched.
+ */
+SSMAP_API bool ssmap_route(const struct ssmap * m, struct ssmap_query_ctx * ctx,
+                           int start_id, int end_id, enum ssmap_route_mode mode,
+                           struct ssmap_route * route);
+
+/**
+ * Generate and print the fastest path between two positions, e.g. GPS fixes.
+ *
+ * Each position is snapped to the nearest point on a road: the closest point
+ * of any segment between two consecutive nodes of a way, found with a spatial
+ * index rather than a scan. The route starts and ends at these points, paying
+ * only for the part of their segments actually driven, and leaves or enters a
+ * one-way segment only in its direction. It is found with A*.
+ *
+ * The output is "@lat,lon id ... id @lat,lon\n": the start point, the nodes
+ * passed through and the end point. Nothing is printed if there is no route.
+ * A map without roads prints "error: the map has no roads.\n".
+ *
+ * @param m The ssmap structure where the path will be created.
+ * @param ctx A workspace from ssmap_query_ctx_create, or NULL to use a
+ *            temporary one.
+ * @param from_lat the latitude to start from, in degrees
+ * @param from_lon the longitude to start from, in degrees
+ * @param to_lat the latitude of the destination, in degrees
+ * @param to_lon the longitude of the destination, in degrees
+ */
+SSMAP_API void ssmap_path_create_between(const struct ssmap * m,
+                                         struct ssmap_query_ctx * ctx,
+                                         double from_lat, double from_lon,
+                                         double to_lat, double to_lon);
+
+/**
+ * Compute the travel time from every one of a set of nodes to every one of
+ * another set, e.g. an origin-destination matrix for dispatching.
+ *
+ * With a contraction hierarchy (see ssmap_contract) this runs bucket-based
+ * many-to-many search: one small upward search per source and per target,
+ * rather than one search per pair. Without one, it runs a one-to-many Dijkstra
+ * search from each source that stops once every target is settled. The
+ * searches are shared out among num_threads threads.
+ *
+ * Every node id is validated first; if one is invalid, times is left
+ * untouched. Nothing is printed.
+ *
+ * @param m The ssmap structure to route on.
+ * @param num_sources The number of rows.
+ * @param sources The node id of each row.
+ * @param num_targets The number of columns.
+ * @param targets The node id of each column.
+ * @param times Room for num_sources * num_targets entries, filled in row by
+ *              row: entry i * num_targets + j is the travel time in minutes
+ *              from sources[i] to targets[j], or -1 if there is no path.
+ * @param num_threads The number of threads to use, at least 1.
+ * @return 0 upon success, SSMAP_ERROR_NO_NODE if a node id is invalid, or
+ *         SSMAP_ERROR_NO_MEMORY if malloc fails.
+ */
+SSMAP_API int ssmap_matrix(const struct ssmap * m, int num_sources, const int sources[],
+                           int num_targets, const int targets[], double times[],
+                           int num_threads);
+
+/**
+ * Find every node that can be reached from a node within a travel time budget,
+ * e.g. the service area of a depot.
+ *
+ * This runs the Dijkstra search of ssmap_path_create from start_id and stops
+ * once the frontier passes the budget. Like ssmap_path_create with a reused
+ * workspace, it only touches the nodes it reaches, so small budgets are cheap
+ * on any map.
+ *
+ * @param m The ssmap structure to search.
+ * @param ctx A workspace from ssmap_query_ctx_create, or NULL to use a
+ *            temporary one.
+ * @param start_id The node to start from.
+ * @param minutes The travel time budget, in minutes.
+ * @param arrivals Set to a malloc'ed array of the nodes reached and their
+ *                 travel times, in order of travel time and starting with
+ *                 start_id. The caller must free it.
+ * @return The number of nodes reached, or SSMAP_ERROR_NO_NODE if start_id is
+ *         invalid or SSMAP_ERROR_NO_MEMORY if malloc fails, in which case
+ *         arrivals is left untouched. Nothing is printed.
+ */
+SSMAP_API int ssmap_isochrone(const struct ssmap * m, struct ssmap_query_ctx * ctx,
+                              int start_id, double minutes,
+                              struct ssmap_arrival ** arrivals);
+
+/**
+ * Compute the convex hull of a set of nodes, e.g. to outline an isochrone.
+ *
+ * @param m The ssmap structure the nodes belong to.
+ * @param count The number of nodes.
+ * @param node_ids The nodes, which must be valid.
+ * @param hull Room for count node ids, set to the corners of the hull in
+ *             counterclockwise order.
+ * @return The number of corners, or -1 if malloc fails.
+ */
+SSMAP_API int ssmap_convex_hull(const struct ssmap * m, int count, const int node_ids[],
+                                int hull[]);
+
+/**
+ * Find the nodes nearest to a GPS coordinate, e.g. to turn it into a node id
+ * that other queries accept.
+ *
+ * The nodes are looked up in a k-d tree built by ssmap_initialize, so a query
+ * takes microseconds on any map.
+ *
+ * @param m The ssmap structure to search.
+ * @param lat The latitude of the coordinate, in degrees.
+ * @param lon The longitude of the coordinate, in degrees.
+ * @param k The number of nodes to find.
+ * @param node_ids Room for k node ids, set to the nearest nodes, nearest first.
+ * @param metres Room for k distances, set to the great-circle distance of each
+ *               node from the coordinate in metres, or NULL.
+ * @return The number of nodes found, which is less than k only if the map has
+ *         fewer nodes, or -1 if malloc fails.
+ */
+SSMAP_API int ssmap_nearest_nodes(const struct ssmap * m, double lat, double lon, int k,
+                                  int node_ids[], double metres[]);
+
+/**
+ * Direct the output of the print functions, e.g. ssmap_path_create, to a
+ * stream, on the calling thread only. Other threads keep their own setting,
+ * so each can collect the responses to its queries separately, e.g. in a
+ * stream from open_memstream.
+ *
+ * @param stream The stream to write to, or NULL to write to stdout again.
+ */
+SSMAP_API void ssmap_set_output(FILE * stream);
+
+/**
+ * Return the version of the library, i.e. the SSMAP_VERSION it was built with.
+ * A program linked against libssmap.so can compare it with the SSMAP_VERSION
+ * it was compiled against.
+ */
+SSMAP_API const char * ssmap_version(void);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* _STREETS_H_ */
\ No newline at end of file
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Map with an empty way slot.
+#
+# usage: tests/duplicate_way.sh [BINARY]
+#
+# Loads uoft.txt with way 5 renamed to a second way 4, so slot 5 is never
+# added and the nodes of that way list an empty slot, then runs the name
+# searches that look at every node's ways, on the map and on its snapshot.
+
+BINARY=${1:-./ssmap}
+map=$(mktemp)
+snapshot=$(mktemp)
+trap 'rm -f "$map" "$snapshot"' EXIT
+sed 's/^way 5 /way 4 /' uoft.txt > "$map"
+
+fail() { echo "duplicate_way: $*"; exit 1; }
+
+$BINARY --compile "$map" "$snapshot" > /dev/null || fail "--compile exited with status $?"
+
+for file in "$map" "$snapshot"; do
+    out=$(printf 'find node Bloor\nfind node Bloor College\nquit\n' | $BINARY "$file") ||
+        fail "$BINARY exited with status $?"
+    echo "$out" | grep -q "successfully loaded" || fail "$file not loaded"
+    echo "$out" | grep -q '^>> [0-9]' || fail "find node printed no nodes"
+done
+echo "duplicate_way: ok"